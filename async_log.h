@@ -0,0 +1,397 @@
+#pragma once
+
+#include <fmt/format.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+
+/// Asynchronous logger behind errsv. Callers copy the format string pointer
+/// and their arguments into a preallocated slot of a lock-free bounded MPSC
+/// ring and return; a drain thread formats the messages and writes them to
+/// stderr in batches. When the ring is full messages are dropped and
+/// counted instead of blocking the caller, which may be a driver thread
+/// inside a validation callback.
+///
+/// Arguments are captured by value: strings are copied into the slot,
+/// trivially copyable values are stored as is. A message whose arguments
+/// cannot be captured like that is formatted on the calling thread instead.
+class AsyncLog {
+public:
+  /// Slots in the ring, a power of two.
+  static constexpr size_t Capacity = 2048;
+  /// Bytes per slot for captured arguments and copied strings; longer
+  /// messages are truncated.
+  static constexpr size_t PayloadSize = 1000;
+
+  static AsyncLog &get() {
+    static AsyncLog Log;
+    return Log;
+  }
+
+  AsyncLog(AsyncLog const &) = delete;
+  AsyncLog &operator=(AsyncLog const &) = delete;
+
+  ~AsyncLog() {
+    Stop.store(true);
+    wake();
+    Drainer.join();
+    drain();
+  }
+
+  template <typename... Ts>
+  void write(fmt::format_string<Ts...> Fmt, Ts &&...Args) {
+    uint64_t Position;
+    Slot *S = claim(Position);
+    if (!S) {
+      Dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    fmt::string_view Format = Fmt;
+    S->FormatData = Format.data();
+    S->FormatSize = Format.size();
+    if constexpr ((IsDeferrable<std::decay_t<Ts>> && ...) &&
+                  valuesSize<std::decay_t<Ts>...>() <= PayloadSize) {
+      size_t Offset = 0;
+      size_t Text = valuesSize<std::decay_t<Ts>...>();
+      (store<std::decay_t<Ts>>(*S, Offset, Text, Args), ...);
+      S->Format = &formatDeferred<std::decay_t<Ts>...>;
+    } else {
+      auto Result = fmt::format_to_n(S->Payload, PayloadSize, Fmt,
+                                     std::forward<Ts>(Args)...);
+      S->Used = static_cast<uint16_t>(std::min(Result.size, PayloadSize));
+      S->Truncated = Result.size > PayloadSize;
+      S->Format = &formatEager;
+    }
+    S->Sequence.store(Position + 1, std::memory_order_release);
+    wake();
+  }
+
+  /// Blocks until everything logged before the call has been written.
+  void flush() {
+    uint64_t Target = EnqueuePosition.load();
+    wake();
+    for (uint64_t Done = Drained.load(); Done < Target; Done = Drained.load())
+      Drained.wait(Done);
+  }
+
+  /// Messages lost to a full ring since startup.
+  uint64_t getDropped() const noexcept {
+    return Dropped.load(std::memory_order_relaxed);
+  }
+
+  /// Opt-in, from main: on a crashing signal, writes the messages still in
+  /// the ring and then hands the signal to the handler installed before.
+  /// The crash path only calls write(2); messages whose arguments were not
+  /// formatted yet come out as their format string.
+  static void installCrashHandlers() {
+    get();
+#if defined(_WIN32)
+    for (size_t I = 0; I < CrashSignals.size(); ++I)
+      PreviousHandlers[I] = std::signal(CrashSignals[I], &onCrash);
+#else
+    struct sigaction Action = {};
+    Action.sa_sigaction = &onCrash;
+    Action.sa_flags = SA_SIGINFO;
+    sigemptyset(&Action.sa_mask);
+    for (size_t I = 0; I < CrashSignals.size(); ++I)
+      sigaction(CrashSignals[I], &Action, &PreviousHandlers[I]);
+#endif
+  }
+
+private:
+  struct Slot {
+    /// Vyukov sequence: equals the ring position when the slot is free,
+    /// position + 1 once the message in it is complete.
+    std::atomic<uint64_t> Sequence{0};
+    void (*Format)(Slot const &, fmt::memory_buffer &) = nullptr;
+    /// The format string is a literal and outlives the message.
+    char const *FormatData = nullptr;
+    size_t FormatSize = 0;
+    uint16_t Used = 0;
+    bool Truncated = false;
+    alignas(16) char Payload[PayloadSize];
+  };
+
+  /// A string copied into the slot's payload.
+  struct SlotText {
+    uint16_t Offset;
+    uint16_t Size;
+  };
+
+  template <typename T>
+  static constexpr bool IsString =
+      std::is_same_v<T, char const *> || std::is_same_v<T, char *> ||
+      std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>;
+  template <typename T>
+  static constexpr bool IsDeferrable =
+      IsString<T> || std::is_trivially_copyable_v<T>;
+  template <typename T>
+  using Stored = std::conditional_t<IsString<T>, SlotText, T>;
+  template <typename T>
+  using Loaded = std::conditional_t<IsString<T>, std::string_view, T>;
+
+  static constexpr size_t alignUp(size_t Offset, size_t Alignment) {
+    return (Offset + Alignment - 1) & ~(Alignment - 1);
+  }
+
+  template <typename... Ts> static constexpr size_t valuesSize() {
+    size_t Offset = 0;
+    ((Offset = alignUp(Offset, alignof(Stored<Ts>)) + sizeof(Stored<Ts>)),
+     ...);
+    return Offset;
+  }
+
+  template <typename T, typename Arg>
+  static void store(Slot &S, size_t &Offset, size_t &Text, Arg const &Value) {
+    Offset = alignUp(Offset, alignof(Stored<T>));
+    if constexpr (IsString<T>) {
+      std::string_view Str;
+      if constexpr (std::is_pointer_v<T>)
+        Str = Value ? std::string_view(Value) : std::string_view();
+      else
+        Str = Value;
+      size_t Size = std::min(Str.size(), PayloadSize - Text);
+      S.Truncated |= Size < Str.size();
+      std::memcpy(S.Payload + Text, Str.data(), Size);
+      SlotText Copied{static_cast<uint16_t>(Text),
+                      static_cast<uint16_t>(Size)};
+      std::memcpy(S.Payload + Offset, &Copied, sizeof(Copied));
+      Text += Size;
+    } else {
+      T Copy = Value;
+      std::memcpy(S.Payload + Offset, &Copy, sizeof(T));
+    }
+    Offset += sizeof(Stored<T>);
+  }
+
+  template <typename T> static Loaded<T> load(Slot const &S, size_t &Offset) {
+    Offset = alignUp(Offset, alignof(Stored<T>));
+    std::array<char, sizeof(Stored<T>)> Bytes;
+    std::memcpy(Bytes.data(), S.Payload + Offset, Bytes.size());
+    Offset += sizeof(Stored<T>);
+    auto Value = std::bit_cast<Stored<T>>(Bytes);
+    if constexpr (IsString<T>)
+      return std::string_view(S.Payload + Value.Offset, Value.Size);
+    else
+      return Value;
+  }
+
+  template <typename... Ts>
+  static void formatDeferred(Slot const &S, fmt::memory_buffer &Out) {
+    [[maybe_unused]] size_t Offset = 0;
+    // Braced initialization evaluates the loads left to right
+    std::tuple<Loaded<Ts>...> Values{load<Ts>(S, Offset)...};
+    std::apply(
+        [&](auto const &...Value) {
+          fmt::vformat_to(std::back_inserter(Out),
+                          fmt::string_view(S.FormatData, S.FormatSize),
+                          fmt::make_format_args(Value...));
+        },
+        Values);
+  }
+
+  static void formatEager(Slot const &S, fmt::memory_buffer &Out) {
+    Out.append(S.Payload, S.Payload + S.Used);
+  }
+
+  AsyncLog() : Slots(std::make_unique<Slot[]>(Capacity)) {
+    for (size_t I = 0; I < Capacity; ++I)
+      Slots[I].Sequence.store(I, std::memory_order_relaxed);
+    Drainer = std::thread([this] { drainMain(); });
+  }
+
+  Slot *claim(uint64_t &Position) {
+    Position = EnqueuePosition.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &S = Slots[Position & (Capacity - 1)];
+      uint64_t Sequence = S.Sequence.load(std::memory_order_acquire);
+      auto Diff = static_cast<int64_t>(Sequence - Position);
+      if (Diff == 0) {
+        if (EnqueuePosition.compare_exchange_weak(Position, Position + 1,
+                                                  std::memory_order_relaxed))
+          return &S;
+      } else if (Diff < 0) {
+        return nullptr; // full
+      } else {
+        Position = EnqueuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void wake() {
+    Published.fetch_add(1, std::memory_order_release);
+    Published.notify_one();
+  }
+
+  void drainMain() {
+    while (true) {
+      uint32_t Seen = Published.load(std::memory_order_acquire);
+      drain();
+      if (Stop.load())
+        return;
+      Published.wait(Seen, std::memory_order_acquire);
+    }
+  }
+
+  /// Formats and writes everything published so far, one write per batch.
+  void drain() {
+    while (Draining.test_and_set(std::memory_order_acquire))
+      std::this_thread::yield();
+    fmt::memory_buffer Batch;
+    while (true) {
+      Slot &S = Slots[DequeuePosition & (Capacity - 1)];
+      if (S.Sequence.load(std::memory_order_acquire) != DequeuePosition + 1)
+        break;
+      try {
+        S.Format(S, Batch);
+      } catch (...) {
+        fmt::format_to(std::back_inserter(Batch), "[log] bad message <{}>",
+                       std::string_view(S.FormatData, S.FormatSize));
+      }
+      if (S.Truncated)
+        fmt::format_to(std::back_inserter(Batch), " [truncated]");
+      Batch.push_back('\n');
+      S.Truncated = false;
+      S.Sequence.store(DequeuePosition + Capacity, std::memory_order_release);
+      ++DequeuePosition;
+      if (Batch.size() >= 64 * 1024)
+        writeBatch(Batch);
+    }
+    uint64_t DroppedNow = Dropped.load(std::memory_order_relaxed);
+    if (DroppedNow != ReportedDropped) {
+      fmt::format_to(std::back_inserter(Batch), "[log] {} messages dropped\n",
+                     DroppedNow - ReportedDropped);
+      ReportedDropped = DroppedNow;
+    }
+    writeBatch(Batch);
+    Drained.store(DequeuePosition);
+    Draining.clear(std::memory_order_release);
+    Drained.notify_all();
+  }
+
+  static void writeBatch(fmt::memory_buffer &Batch) {
+    if (Batch.size() == 0)
+      return;
+    std::fwrite(Batch.data(), 1, Batch.size(), stderr);
+    std::fflush(stderr);
+    Batch.clear();
+  }
+
+  static void writeStderr(char const *Data, size_t Size) {
+#if defined(_WIN32)
+    _write(2, Data, static_cast<unsigned>(Size));
+#else
+    while (Size > 0) {
+      ssize_t Written = ::write(STDERR_FILENO, Data, Size);
+      if (Written <= 0)
+        return;
+      Data += Written;
+      Size -= static_cast<size_t>(Written);
+    }
+#endif
+  }
+
+  /// Async-signal-safe part of the crash path: no formatting, allocation or
+  /// stdio. Skipped when the drain thread does not let go of the ring soon,
+  /// as it may be the one that crashed.
+  void writeUnformatted() {
+    for (int Attempt = 0; Draining.test_and_set(std::memory_order_acquire);
+         ++Attempt)
+      if (Attempt == 1000000)
+        return;
+    for (uint64_t Position = DequeuePosition;; ++Position) {
+      Slot const &S = Slots[Position & (Capacity - 1)];
+      if (S.Sequence.load(std::memory_order_acquire) != Position + 1)
+        break;
+      if (S.Format == &formatEager) {
+        writeStderr(S.Payload, S.Used);
+      } else {
+        writeStderr(S.FormatData, S.FormatSize);
+        writeStderr(" [unformatted]", 14);
+      }
+      writeStderr("\n", 1);
+    }
+    Draining.clear(std::memory_order_release);
+  }
+
+  static size_t crashSignalIndex(int Signal) {
+    for (size_t I = 0; I < CrashSignals.size(); ++I)
+      if (CrashSignals[I] == Signal)
+        return I;
+    return 0;
+  }
+
+#if defined(_WIN32)
+  static void onCrash(int Signal) {
+    get().writeUnformatted();
+    auto Previous = PreviousHandlers[crashSignalIndex(Signal)];
+    if (Previous != SIG_DFL && Previous != SIG_IGN && Previous != SIG_ERR) {
+      Previous(Signal);
+      return;
+    }
+    std::signal(Signal, SIG_DFL);
+    std::raise(Signal);
+  }
+
+  static constexpr std::array CrashSignals{SIGSEGV, SIGABRT, SIGFPE, SIGILL};
+  static inline std::array<void (*)(int), CrashSignals.size()>
+      PreviousHandlers{};
+#else
+  static void onCrash(int Signal, siginfo_t *Info, void *Context) {
+    get().writeUnformatted();
+    struct sigaction const &Previous =
+        PreviousHandlers[crashSignalIndex(Signal)];
+    if (Previous.sa_flags & SA_SIGINFO) {
+      Previous.sa_sigaction(Signal, Info, Context);
+      return;
+    }
+    if (Previous.sa_handler != SIG_DFL && Previous.sa_handler != SIG_IGN) {
+      Previous.sa_handler(Signal);
+      return;
+    }
+    // Default action, which the signal gets once this handler returns
+    struct sigaction Default = {};
+    Default.sa_handler = SIG_DFL;
+    sigemptyset(&Default.sa_mask);
+    sigaction(Signal, &Default, nullptr);
+    raise(Signal);
+  }
+
+  static constexpr std::array CrashSignals{SIGSEGV, SIGABRT, SIGBUS, SIGFPE,
+                                           SIGILL};
+  static inline std::array<struct sigaction, CrashSignals.size()>
+      PreviousHandlers{};
+#endif
+
+  std::unique_ptr<Slot[]> Slots;
+  std::atomic<uint64_t> EnqueuePosition{0};
+  /// Only touched by whoever holds Draining.
+  uint64_t DequeuePosition = 0;
+  uint64_t ReportedDropped = 0;
+  std::atomic_flag Draining = ATOMIC_FLAG_INIT;
+  std::atomic<uint64_t> Drained{0};
+  std::atomic<uint64_t> Dropped{0};
+  /// Bumped on every message so the drain thread can sleep on it.
+  std::atomic<uint32_t> Published{0};
+  std::atomic<bool> Stop{false};
+  std::thread Drainer;
+};
@@ -0,0 +1,618 @@
+#include "draw_capture.h"
+#include "format.h"
+#include "frame.h"
+#include "options.h"
+#include "vulkan_context.h"
+
+#include <SDL2pp/SDL2pp.hh>
+#include <SDL_vulkan.h>
+#include <imgui_impl_sdl.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+namespace {
+
+/// Knobs of the scripted workload. The UI only depends on these and on the
+/// frame number, so two runs with the same options draw the same frames.
+struct BenchOptions {
+  uint32_t Frames = 1000;
+  /// Frames rendered before measuring, to get past pipeline creation and
+  /// first-use allocations.
+  uint32_t Warmup = 60;
+  uint32_t Windows = 4;
+  uint32_t Widgets = 32;
+  uint32_t TextLines = 64;
+  uint32_t Width = 1280;
+  uint32_t Height = 720;
+  bool Headless = true;
+  /// Physical device by index or name, see selectPhysicalDevice.
+  std::string Device;
+  uint32_t FramesInFlight = 2;
+  uint32_t SwapchainImages = 2;
+  vk::PresentModeKHR PresentMode = vk::PresentModeKHR::eImmediate;
+  /// Synthetic render layers below the UI and the commands each records.
+  uint32_t Layers = 0;
+  uint32_t LayerCommands = 1000;
+  uint32_t RecordThreads = 0;
+  /// Cells per side of the compute simulation stepped every frame, 0 for
+  /// none, and whether its steps may overlap rendering.
+  uint32_t SimulationSize = 0;
+  bool ComputeOverlap = true;
+  /// Resize the window every N frames, 0 to never. Window mode only.
+  uint32_t ResizeEvery = 0;
+  /// OS windows showing the same UI, rendered in one submit and presented
+  /// in one call. Window mode only.
+  uint32_t Surfaces = 1;
+  /// Calls per run of the dispatch microbenchmark, 0 to skip it.
+  uint32_t DispatchCalls = 200'000;
+  /// Render the frames of this capture (demo --capture) in a loop instead
+  /// of the scripted UI, at the size they were captured at.
+  std::string ReplayPath;
+  /// Where to write the JSON report, stdout if empty.
+  std::string OutputPath;
+};
+
+void printBenchUsage(char const *Argv0) {
+  errsv("Usage: {} [options]\n"
+        "  --frames <N>       measured frames (default 1000)\n"
+        "  --warmup <N>       unmeasured frames before that (default 60)\n"
+        "  --windows <N>      ImGui windows per frame (default 4)\n"
+        "  --widgets <N>      widgets per window (default 32)\n"
+        "  --text-lines <N>   text lines per window (default 64)\n"
+        "  --size <W>x<H>     framebuffer size (default 1280x720)\n"
+        "  --window           present to an SDL window instead of offscreen\n"
+        "  --device <N|name>  use this GPU (also VULKAN_DEVICE)\n"
+        "  --frames-in-flight <N>  frames recorded ahead of the GPU (1-4)\n"
+        "  --swapchain-images <N>  minimum swapchain image count\n"
+        "  --present-mode <fifo|mailbox|immediate>  (default immediate)\n"
+        "  --layers <N>       render layers recorded below the UI (default 0)\n"
+        "  --layer-commands <N>  commands recorded per layer (default 1000)\n"
+        "  --record-threads <N>  worker threads recording layers (default 0)\n"
+        "  --simulation <N>   step an NxN compute simulation every frame\n"
+        "  --serialize-compute  do not overlap simulation and rendering\n"
+        "  --resize-every <N>  resize the window every N frames (--window)\n"
+        "  --surfaces <N>     mirror the UI into N windows (--window)\n"
+        "  --dispatch-calls <N>  calls per dispatch microbenchmark run\n"
+        "  --replay <file>    render a captured session instead of the UI\n"
+        "  --output <file>    write the JSON report to a file",
+        Argv0);
+}
+
+BenchOptions parseBenchOptions(int Argc, char **Argv) {
+  BenchOptions Options;
+  for (int I = 1; I < Argc; ++I) {
+    std::string_view Arg = Argv[I];
+    auto NextValue = [&]() -> std::string_view {
+      if (I + 1 >= Argc) {
+        printBenchUsage(Argv[0]);
+        throw std::invalid_argument(fmt::format("Missing value for {}", Arg));
+      }
+      return Argv[++I];
+    };
+
+    if (Arg == "--frames") {
+      Options.Frames = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--warmup") {
+      Options.Warmup = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--windows") {
+      Options.Windows = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--widgets") {
+      Options.Widgets = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--text-lines") {
+      Options.TextLines = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--size") {
+      std::tie(Options.Width, Options.Height) = parseSize(Arg, NextValue());
+    } else if (Arg == "--window") {
+      Options.Headless = false;
+    } else if (Arg == "--device") {
+      Options.Device = NextValue();
+    } else if (Arg == "--frames-in-flight") {
+      Options.FramesInFlight = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--swapchain-images") {
+      Options.SwapchainImages =
+          std::max(parseUnsigned(Arg, NextValue()), 2u);
+    } else if (Arg == "--present-mode") {
+      Options.PresentMode = parsePresentMode(Arg, NextValue());
+    } else if (Arg == "--layers") {
+      Options.Layers = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--layer-commands") {
+      Options.LayerCommands = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--record-threads") {
+      Options.RecordThreads = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--simulation") {
+      Options.SimulationSize = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--serialize-compute") {
+      Options.ComputeOverlap = false;
+    } else if (Arg == "--resize-every") {
+      Options.ResizeEvery = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--surfaces") {
+      Options.Surfaces = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--dispatch-calls") {
+      Options.DispatchCalls = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--replay") {
+      Options.ReplayPath = NextValue();
+    } else if (Arg == "--output") {
+      Options.OutputPath = NextValue();
+    } else {
+      printBenchUsage(Argv[0]);
+      throw std::invalid_argument(fmt::format("Unknown option {}", Arg));
+    }
+  }
+  if (Options.Frames == 0)
+    throw std::invalid_argument("--frames must be non-zero");
+  if (Options.ResizeEvery != 0 && Options.Headless)
+    throw std::invalid_argument("--resize-every requires --window");
+  if (Options.Surfaces != 1 && Options.Headless)
+    throw std::invalid_argument("--surfaces requires --window");
+  if (Options.Surfaces == 0 || Options.Surfaces > VulkanContext::MaxWindows)
+    throw std::invalid_argument(fmt::format(
+        "--surfaces must be between 1 and {}", VulkanContext::MaxWindows));
+  return Options;
+}
+
+/// Lays the windows out on a fixed grid and animates every widget from the
+/// frame number alone.
+void buildBenchUi(BenchOptions const &Options, uint32_t Frame,
+                  std::vector<float> &Values) {
+  Values.resize(size_t{Options.Windows} * Options.Widgets);
+
+  auto Columns = static_cast<uint32_t>(
+      std::ceil(std::sqrt(static_cast<float>(Options.Windows))));
+  Columns = std::max(Columns, 1u);
+  uint32_t Rows = (Options.Windows + Columns - 1) / Columns;
+  ImVec2 Cell(static_cast<float>(Options.Width) / Columns,
+              static_cast<float>(Options.Height) / std::max(Rows, 1u));
+
+  for (uint32_t W = 0; W < Options.Windows; ++W) {
+    ImGui::SetNextWindowPos(
+        ImVec2(Cell.x * (W % Columns), Cell.y * (W / Columns)),
+        ImGuiCond_Always);
+    ImGui::SetNextWindowSize(Cell, ImGuiCond_Always);
+
+    char Title[32];
+    std::snprintf(Title, sizeof(Title), "Bench window %u", W);
+    ImGui::Begin(Title);
+
+    for (uint32_t I = 0; I < Options.Widgets; ++I) {
+      float &Value = Values[size_t{W} * Options.Widgets + I];
+      Value = 0.5f + 0.5f * std::sin(0.05f * Frame + 0.7f * I + 1.3f * W);
+      ImGui::PushID(static_cast<int>(I));
+      switch (I % 4) {
+      case 0:
+        ImGui::SliderFloat("slider", &Value, 0.0f, 1.0f);
+        break;
+      case 1:
+        ImGui::ProgressBar(Value);
+        break;
+      case 2: {
+        bool Checked = Value > 0.5f;
+        ImGui::Checkbox("checkbox", &Checked);
+        break;
+      }
+      case 3:
+        ImGui::Button("button");
+        ImGui::SameLine();
+        ImGui::Text("%.3f", Value);
+        break;
+      }
+      ImGui::PopID();
+    }
+
+    for (uint32_t I = 0; I < Options.TextLines; ++I)
+      ImGui::Text("Window %u, line %u, frame %u: the quick brown fox jumps "
+                  "over the lazy dog",
+                  W, I, Frame);
+
+    ImGui::End();
+  }
+}
+
+/// Synthetic layer that is cheap for the GPU but costs CPU time to record:
+/// \p Commands small attachment clears scattered over the framebuffer.
+RenderLayer makeBenchLayer(uint32_t Layer, uint32_t Commands) {
+  return [Layer, Commands](vk::CommandBuffer CommandBuffer,
+                           vk::Extent2D Extent) {
+    constexpr uint32_t Cell = 8;
+    uint32_t Columns = std::max(Extent.width / Cell, 1u);
+    uint32_t Rows = std::max(Extent.height / Cell, 1u);
+    float Shade = 0.1f + 0.05f * (Layer % 8);
+    vk::ClearAttachment Attachment(
+        vk::ImageAspectFlagBits::eColor, 0,
+        vk::ClearColorValue(std::array<float, 4>{Shade, Shade, Shade, 1.0f}));
+    for (uint32_t I = 0; I < Commands; ++I) {
+      uint32_t Index = (I * 7919u + Layer * 104729u) % (Columns * Rows);
+      vk::ClearRect Rect({{static_cast<int32_t>(Index % Columns * Cell),
+                           static_cast<int32_t>(Index / Columns * Cell)},
+                          {Cell, Cell}},
+                         0, 1);
+      CommandBuffer.clearAttachments(Attachment, Rect);
+    }
+  };
+}
+
+/// CPU cost of one Vulkan call through the loader's exported entry point,
+/// which forwards through a trampoline, and through the device's dispatch
+/// table that every call of the demo now takes.
+struct DispatchStats {
+  uint32_t Calls = 0;
+  double LoaderNs = 0;
+  double DeviceTableNs = 0;
+};
+
+/// Records \p Calls vkCmdSetScissor, a call with next to no driver work,
+/// through either pointer. Best of a few alternating runs, each into a
+/// freshly reset command buffer.
+DispatchStats measureDispatch(VulkanContext &Vulkan, uint32_t Calls) {
+  DispatchStats Stats{Calls};
+  if (Calls == 0)
+    return Stats;
+  vk::Device Device = Vulkan.getDevice();
+  vk::CommandPool Pool = Device.createCommandPool(
+      {{}, Vulkan.getQueueFamilyIndex()}, Vulkan.getAllocationCallbacks());
+  vk::CommandBuffer CommandBuffer =
+      Device.allocateCommandBuffers({Pool, vk::CommandBufferLevel::ePrimary, 1})
+          .front();
+  VkRect2D Scissor = {{0, 0}, {1, 1}};
+  auto Run = [&](PFN_vkCmdSetScissor SetScissor) {
+    Device.resetCommandPool(Pool);
+    CommandBuffer.begin(
+        {vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr});
+    VkCommandBuffer Handle = CommandBuffer;
+    Clock::time_point Start = Clock::now();
+    for (uint32_t I = 0; I < Calls; ++I)
+      SetScissor(Handle, 0, 1, &Scissor);
+    double Ns = millisecondsBetween(Start, Clock::now()) * 1e6 / Calls;
+    CommandBuffer.end();
+    return Ns;
+  };
+  PFN_vkCmdSetScissor DeviceTable =
+      VULKAN_HPP_DEFAULT_DISPATCHER.vkCmdSetScissor;
+  Stats.LoaderNs = Stats.DeviceTableNs = HUGE_VAL;
+  for (int Round = 0; Round < 5; ++Round) {
+    Stats.LoaderNs = std::min(Stats.LoaderNs, Run(&::vkCmdSetScissor));
+    Stats.DeviceTableNs = std::min(Stats.DeviceTableNs, Run(DeviceTable));
+  }
+  Device.destroyCommandPool(Pool, Vulkan.getAllocationCallbacks());
+  return Stats;
+}
+
+/// Nearest-rank percentile of an already sorted sample.
+double percentile(std::vector<double> const &Sorted, double P) {
+  if (Sorted.empty())
+    return 0;
+  auto Rank = static_cast<size_t>(std::ceil(P / 100.0 * Sorted.size()));
+  return Sorted[std::clamp<size_t>(Rank, 1, Sorted.size()) - 1];
+}
+
+std::string phaseJson(std::vector<double> Samples) {
+  std::sort(Samples.begin(), Samples.end());
+  double Sum = 0;
+  for (double Sample : Samples)
+    Sum += Sample;
+  return fmt::format(
+      "{{\"mean\": {:.4f}, \"p50\": {:.4f}, \"p95\": {:.4f}, "
+      "\"p99\": {:.4f}, \"max\": {:.4f}}}",
+      Samples.empty() ? 0.0 : Sum / Samples.size(), percentile(Samples, 50),
+      percentile(Samples, 95), percentile(Samples, 99),
+      Samples.empty() ? 0.0 : Samples.back());
+}
+
+struct BenchSamples {
+  std::vector<double> Build;
+  std::vector<double> Wait;
+  std::vector<double> Record;
+  std::vector<double> Submit;
+  std::vector<double> Present;
+  std::vector<double> Frame;
+  std::vector<double> GpuRenderPass;
+  std::vector<double> GpuImGui;
+  std::vector<double> HostAllocations;
+  /// From the resize request to presenting the first frame at the new size.
+  std::vector<double> ResizeLatency;
+  /// CPU time of createOrResizeSwapchain alone.
+  std::vector<double> SwapchainRebuild;
+
+  void reserve(size_t N) {
+    for (auto *V : {&Build, &Wait, &Record, &Submit, &Present, &Frame,
+                    &GpuRenderPass, &GpuImGui, &HostAllocations})
+      V->reserve(N);
+  }
+
+  void add(FrameTimings const &T, double FrameMs) {
+    Build.push_back(T.Build);
+    Wait.push_back(T.Wait);
+    Record.push_back(T.Record);
+    Submit.push_back(T.Submit);
+    Present.push_back(T.Present);
+    Frame.push_back(FrameMs);
+  }
+};
+
+std::string reportJson(BenchOptions const &Options, VulkanContext &Vulkan,
+                       BenchSamples const &Samples,
+                       FontAtlasStats const &FontAtlas,
+                       DispatchStats const &Dispatch) {
+  vk::PhysicalDeviceProperties Properties =
+      Vulkan.getPhysicalDevice().getProperties();
+  return fmt::format(
+      "{{\n"
+      "  \"device\": \"{}\",\n"
+      "  \"headless\": {},\n"
+      "  \"width\": {},\n"
+      "  \"height\": {},\n"
+      "  \"frames\": {},\n"
+      "  \"warmup\": {},\n"
+      "  \"windows\": {},\n"
+      "  \"widgets\": {},\n"
+      "  \"text_lines\": {},\n"
+      "  \"frames_in_flight\": {},\n"
+      "  \"layers\": {},\n"
+      "  \"layer_commands\": {},\n"
+      "  \"record_threads\": {},\n"
+      "  \"simulation_size\": {},\n"
+      "  \"compute_overlap\": {},\n"
+      "  \"async_compute\": {},\n"
+      "  \"present_mode\": \"{}\",\n"
+      "  \"surfaces\": {},\n"
+      "  \"replay\": \"{}\",\n"
+      "  \"font_atlas_cache_hit\": {},\n"
+      "  \"font_atlas_ms\": {:.3f},\n"
+      "  \"font_upload_ms\": {:.3f},\n"
+      "  \"dispatch_ns_per_call\": {{\"calls\": {}, \"loader\": {:.2f}, "
+      "\"device_table\": {:.2f}}},\n"
+      "  \"phases_ms\": {{\n"
+      "    \"cpu_build\": {},\n"
+      "    \"wait\": {},\n"
+      "    \"record\": {},\n"
+      "    \"submit\": {},\n"
+      "    \"present\": {},\n"
+      "    \"frame\": {},\n"
+      "    \"gpu_render_pass\": {},\n"
+      "    \"gpu_imgui\": {}\n"
+      "  }},\n"
+      "  \"host_allocations_per_frame\": {},\n"
+      "  \"resizes\": {},\n"
+      "  \"resize_latency_ms\": {},\n"
+      "  \"swapchain_rebuild_ms\": {},\n"
+      "  \"log_dropped\": {}\n"
+      "}}\n",
+      jsonEscape(Properties.deviceName.data()), Options.Headless,
+      Options.Width, Options.Height, Options.Frames, Options.Warmup,
+      Options.Windows, Options.Widgets, Options.TextLines,
+      Vulkan.getFramesInFlight(), Options.Layers, Options.LayerCommands,
+      Vulkan.getRecordPool().threadCount(),
+      Vulkan.getSimulation().isSupported() ? Options.SimulationSize : 0,
+      Options.ComputeOverlap, Vulkan.getSimulation().hasAsyncQueue(),
+      Options.Headless ? "none" : vk::to_string(Vulkan.getPresentMode()),
+      Vulkan.getWindows().size(), jsonEscape(Options.ReplayPath),
+      FontAtlas.CacheHit, FontAtlas.BuildMs,
+      FontAtlas.UploadMs, Dispatch.Calls, Dispatch.LoaderNs,
+      Dispatch.DeviceTableNs,
+      phaseJson(Samples.Build), phaseJson(Samples.Wait),
+      phaseJson(Samples.Record), phaseJson(Samples.Submit),
+      phaseJson(Samples.Present), phaseJson(Samples.Frame),
+      phaseJson(Samples.GpuRenderPass), phaseJson(Samples.GpuImGui),
+      phaseJson(Samples.HostAllocations), Samples.ResizeLatency.size(),
+      phaseJson(Samples.ResizeLatency), phaseJson(Samples.SwapchainRebuild),
+      AsyncLog::get().getDropped());
+}
+
+int runBench(BenchOptions Options) {
+  std::optional<DrawReplay> Replay;
+  if (!Options.ReplayPath.empty()) {
+    Replay.emplace(Options.ReplayPath);
+    ImVec2 Size = Replay->getFramebufferSize();
+    Options.Width = std::max(static_cast<uint32_t>(Size.x), 1u);
+    Options.Height = std::max(static_cast<uint32_t>(Size.y), 1u);
+    errsv("Replaying {} frames of <{}> at {}x{}", Replay->size(),
+          Options.ReplayPath, Options.Width, Options.Height);
+  }
+
+  std::optional<SDL2pp::SDL> SDL;
+  std::optional<SDL2pp::Window> Window;
+  // Outlive the context, which destroys their surfaces
+  std::vector<SDL2pp::Window> ExtraWindows;
+  std::vector<char const *> Extensions;
+  if (!Options.Headless) {
+    SDL.emplace(SDL_INIT_VIDEO | SDL_INIT_TIMER);
+    Window.emplace("vulkan_sdl2_demo_bench", SDL_WINDOWPOS_CENTERED,
+                   SDL_WINDOWPOS_CENTERED, static_cast<int>(Options.Width),
+                   static_cast<int>(Options.Height), SDL_WINDOW_VULKAN);
+    uint32_t ExtensionsCount = 0;
+    SDL_Vulkan_GetInstanceExtensions(Window->Get(), &ExtensionsCount, nullptr);
+    Extensions.resize(ExtensionsCount);
+    SDL_Vulkan_GetInstanceExtensions(Window->Get(), &ExtensionsCount,
+                                     Extensions.data());
+  }
+
+  VulkanContext Vulkan("vulkan_sdl2_demo_bench", "EngineName", Extensions, {},
+                       Options.Device);
+  Vulkan.getFramesInFlight() = Options.FramesInFlight;
+  Vulkan.getRecordThreads() = Options.RecordThreads;
+  for (uint32_t I = 0; I < Options.Layers; ++I)
+    Vulkan.getRenderLayers().push_back(
+        makeBenchLayer(I, Options.LayerCommands));
+  Vulkan.getMinImageCount() = Options.SwapchainImages;
+  Vulkan.setPresentMode(Options.PresentMode);
+  ComputeStage &Simulation = Vulkan.getSimulation();
+  if (Options.SimulationSize != 0) {
+    if (!Simulation.isSupported())
+      errsv("No timeline semaphores, --simulation ignored");
+    Simulation.getSize() = Options.SimulationSize;
+    Simulation.getRunning() = true;
+    Simulation.getOverlap() = Options.ComputeOverlap;
+  }
+
+  if (Window) {
+    VkSurfaceKHR Surface;
+    if (SDL_Vulkan_CreateSurface(Window->Get(), Vulkan.getInstance(),
+                                 &Surface) == 0) {
+      errsv("Failed to create Vulkan surface.");
+      return 1;
+    }
+    Vulkan.setupWindow(Surface, Window->GetWidth(), Window->GetHeight());
+    for (uint32_t I = 1; I < Options.Surfaces; ++I) {
+      SDL2pp::Window &Extra = ExtraWindows.emplace_back(
+          fmt::format("vulkan_sdl2_demo bench {}", I), SDL_WINDOWPOS_UNDEFINED,
+          SDL_WINDOWPOS_UNDEFINED, static_cast<int>(Options.Width),
+          static_cast<int>(Options.Height), SDL_WINDOW_VULKAN);
+      if (SDL_Vulkan_CreateSurface(Extra.Get(), Vulkan.getInstance(),
+                                   &Surface) == 0) {
+        errsv("Failed to create Vulkan surface.");
+        return 1;
+      }
+      Vulkan.addWindow(Surface, Extra.GetWidth(), Extra.GetHeight());
+    }
+  } else {
+    Vulkan.setupOffscreen(Options.Width, Options.Height);
+  }
+
+  IMGUI_CHECKVERSION();
+  ImGui::CreateContext();
+  ImGuiIO &Io = ImGui::GetIO();
+  Io.IniFilename = nullptr;
+  ImGui::StyleColorsDark();
+  if (Window)
+    ImGui_ImplSDL2_InitForVulkan(Window->Get());
+  FontAtlasStats FontAtlas = initImGuiVulkan(Vulkan);
+  // Every texture the capture drew with gets a descriptor set of its own
+  // over the font atlas, so replay switches sets as often as the session
+  std::vector<ImTextureID> Placeholders;
+  if (Replay)
+    for (size_t I = 0; I < Replay->getTextures().size(); ++I)
+      Placeholders.push_back(
+          reinterpret_cast<ImTextureID>(ImGui_ImplVulkan_AddTexture(
+              Vulkan.getUploads().getSampler(), Vulkan.getFontImage().View,
+              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)));
+  setClearColor(Vulkan, ImVec4(0.45f, 0.55f, 0.60f, 1.00f));
+  DispatchStats Dispatch = measureDispatch(Vulkan, Options.DispatchCalls);
+
+  std::vector<float> Values;
+  // Every window mirrors the same UI
+  std::vector<ImDrawData *> DrawData(Vulkan.getWindows().size());
+  BenchSamples Samples;
+  Samples.reserve(Options.Frames);
+
+  // GPU timestamps arrive a few frames late, profiler frames count from 1
+  auto &Profiler = Vulkan.getProfiler();
+  Profiler.setFrameCallback([&](FrameRecord const &Record) {
+    if (Record.Frame > Options.Warmup && Record.GpuValid) {
+      Samples.GpuRenderPass.push_back(Record.GpuRenderPassMs);
+      Samples.GpuImGui.push_back(Record.GpuImGuiMs);
+    }
+  });
+
+  // Pending window resize, measured until a frame at the new size is shown
+  std::optional<Clock::time_point> ResizeStart;
+  bool Shrunk = false;
+
+  for (uint32_t Frame = 0; Frame < Options.Warmup + Options.Frames; ++Frame) {
+    Profiler.beginFrame();
+    // Rolls over the counts of the previous frame
+    HostAllocator &HostAllocations = Vulkan.getHostAllocator();
+    HostAllocations.beginFrame();
+    if (Frame > Options.Warmup)
+      Samples.HostAllocations.push_back(
+          static_cast<double>(HostAllocations.getLastFrameAllocations()));
+    Clock::time_point FrameStart = Clock::now();
+    FrameTimings Timings;
+
+    if (Window) {
+      if (Options.ResizeEvery != 0 && Frame > Options.Warmup &&
+          Frame % Options.ResizeEvery == 0 && !ResizeStart) {
+        // Alternate between the requested size and three quarters of it
+        Shrunk = !Shrunk;
+        uint32_t Scale = Shrunk ? 3 : 4;
+        Window->SetSize(static_cast<int>(Options.Width * Scale / 4),
+                        static_cast<int>(Options.Height * Scale / 4));
+        Vulkan.getSwapChainRebuild() = true;
+        ResizeStart = Clock::now();
+      }
+      SDL_Event Event;
+      while (SDL_PollEvent(&Event))
+        if (Event.type == SDL_QUIT)
+          throw std::runtime_error("Benchmark window closed");
+      bool Rebuild = Vulkan.getSwapChainRebuild();
+      rebuildSwapChain(Vulkan, Window->GetWidth(), Window->GetHeight());
+      if (Rebuild && !Vulkan.getSwapChainRebuild() && Frame >= Options.Warmup)
+        Samples.SwapchainRebuild.push_back(
+            Vulkan.getLastSwapchainRebuildMs());
+    }
+
+    Clock::time_point BuildStart = Clock::now();
+    if (Replay) {
+      // No UI code at all, the captured lists go straight to the renderer
+      std::fill(DrawData.begin(), DrawData.end(),
+                Replay->frame(Frame % Replay->size(), Io.Fonts->TexID,
+                              Placeholders));
+    } else {
+      ImGui_ImplVulkan_NewFrame();
+      if (Window)
+        ImGui_ImplSDL2_NewFrame();
+      else
+        Io.DisplaySize = ImVec2(static_cast<float>(Options.Width),
+                                static_cast<float>(Options.Height));
+      // Fixed time step keeps the workload independent of the frame rate
+      Io.DeltaTime = 1.0f / 60.0f;
+      ImGui::NewFrame();
+      buildBenchUi(Options, Frame, Values);
+      if (ImTextureID Texture = Simulation.getTexture()) {
+        ImGui::Begin("Simulation");
+        ImGui::Image(Texture, ImVec2(256, 256));
+        ImGui::End();
+      }
+      ImGui::Render();
+      std::fill(DrawData.begin(), DrawData.end(), ImGui::GetDrawData());
+    }
+    Timings.Build = millisecondsBetween(BuildStart, Clock::now());
+
+    frameRender(Vulkan, DrawData, &Timings);
+    framePresent(Vulkan, &Timings);
+    // A present that came back out of date retries on the next frame
+    if (ResizeStart && !Vulkan.getSwapChainRebuild()) {
+      Samples.ResizeLatency.push_back(
+          millisecondsBetween(*ResizeStart, Clock::now()));
+      ResizeStart.reset();
+    }
+
+    if (Frame >= Options.Warmup)
+      Samples.add(Timings, millisecondsBetween(FrameStart, Clock::now()));
+  }
+
+  Vulkan.getDevice().waitIdle();
+  Profiler.flush();
+
+  std::string Report = reportJson(Options, Vulkan, Samples, FontAtlas,
+                                  Dispatch);
+  if (Options.OutputPath.empty()) {
+    std::cout << Report;
+  } else {
+    std::ofstream Out(Options.OutputPath, std::ios::trunc);
+    Out << Report;
+    if (!Out)
+      throw std::runtime_error(
+          fmt::format("Failed to write <{}>", Options.OutputPath));
+  }
+  return 0;
+}
+
+} // namespace
+
+int main(int Argc, char **Argv) {
+  AsyncLog::installCrashHandlers();
+  try {
+    return runBench(parseBenchOptions(Argc, Argv));
+  } catch (std::exception &E) {
+    errsv("Exception occurred: {}", E.what());
+    return -1;
+  }
+}
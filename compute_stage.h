@@ -0,0 +1,354 @@
+#pragma once
+
+#include "device_memory.h"
+#include "profiler.h"
+
+#include <imgui.h>
+#include <imgui_impl_vulkan.h>
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+/// SPIR-V of shaders/simulation.comp, compiled by glslc at build time.
+inline constexpr uint32_t SimulationSpirv[] = {
+#include "simulation.comp.inc"
+};
+
+/// What the frame's graphics submit waits on and signals for the
+/// simulation; null semaphores when there is nothing to do.
+struct ComputeSync {
+  vk::Semaphore Wait;
+  uint64_t WaitValue = 0;
+  vk::Semaphore Signal;
+  uint64_t SignalValue = 0;
+};
+
+/// GPU simulation (a damped wave field) stepped once per rendered frame on
+/// the compute queue and shown through an ImGui texture.
+///
+/// Two timeline semaphores order the queues: the compute timeline counts
+/// simulation steps, the graphics timeline counts frames that sampled the
+/// field. The field is double buffered, so step N + 1 only has to wait for
+/// the last frame that sampled its buffer, two steps back, and runs while
+/// the frame showing step N renders. With overlap off, each step also waits
+/// for the latest frame, which serializes compute and graphics.
+class ComputeStage {
+public:
+  static constexpr uint32_t DefaultSize = 1024;
+  /// Matches local_size in simulation.comp.
+  static constexpr uint32_t WorkgroupSize = 16;
+
+  ComputeStage() = default;
+  ComputeStage(ComputeStage const &) = delete;
+  ComputeStage &operator=(ComputeStage const &) = delete;
+
+  /// Needs timeline semaphores; without init the stage stays unsupported
+  /// and every other call is a no-op.
+  void init(vk::Device Device, DeviceMemoryAllocator &DeviceMemory,
+            vk::AllocationCallbacks const &AllocationCallbacks,
+            vk::PipelineCache PipelineCache,
+            vk::DescriptorPool DescriptorPool, vk::Sampler Sampler,
+            uint32_t GraphicsQueueFamilyIndex,
+            uint32_t ComputeQueueFamilyIndex, vk::Queue ComputeQueue) {
+    this->Device = Device;
+    this->DeviceMemory = &DeviceMemory;
+    this->AllocationCallbacks = AllocationCallbacks;
+    this->DescriptorPool = DescriptorPool;
+    this->Sampler = Sampler;
+    this->GraphicsQueueFamilyIndex = GraphicsQueueFamilyIndex;
+    this->ComputeQueueFamilyIndex = ComputeQueueFamilyIndex;
+    this->ComputeQueue = ComputeQueue;
+
+    { // Create Pipeline
+      std::array<vk::DescriptorSetLayoutBinding, 3> Bindings = {{
+          {0, vk::DescriptorType::eStorageBuffer, 1,
+           vk::ShaderStageFlagBits::eCompute},
+          {1, vk::DescriptorType::eStorageBuffer, 1,
+           vk::ShaderStageFlagBits::eCompute},
+          {2, vk::DescriptorType::eStorageImage, 1,
+           vk::ShaderStageFlagBits::eCompute},
+      }};
+      SetLayout = Device.createDescriptorSetLayout({{}, Bindings},
+                                                   AllocationCallbacks);
+      vk::PushConstantRange PushConstants(vk::ShaderStageFlagBits::eCompute,
+                                          0, sizeof(Params));
+      PipelineLayout = Device.createPipelineLayout(
+          {{}, SetLayout, PushConstants}, AllocationCallbacks);
+      vk::ShaderModule Module = Device.createShaderModule(
+          {{}, sizeof(SimulationSpirv), SimulationSpirv},
+          AllocationCallbacks);
+      vk::ComputePipelineCreateInfo CreateInfo(
+          {}, {{}, vk::ShaderStageFlagBits::eCompute, Module, "main"},
+          PipelineLayout);
+      Pipeline = Device.createComputePipeline(PipelineCache, CreateInfo,
+                                              AllocationCallbacks)
+                     .value;
+      Device.destroyShaderModule(Module, AllocationCallbacks);
+    }
+
+    CommandPool = Device.createCommandPool(
+        {vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+         ComputeQueueFamilyIndex},
+        AllocationCallbacks);
+    vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo>
+        TimelineInfo(vk::SemaphoreCreateInfo(),
+                     vk::SemaphoreTypeCreateInfo(vk::SemaphoreType::eTimeline,
+                                                 0));
+    ComputeTimeline =
+        Device.createSemaphore(TimelineInfo.get<vk::SemaphoreCreateInfo>(),
+                               AllocationCallbacks);
+    GraphicsTimeline =
+        Device.createSemaphore(TimelineInfo.get<vk::SemaphoreCreateInfo>(),
+                               AllocationCallbacks);
+  }
+
+  void destroy() {
+    if (!Device)
+      return;
+    ComputeQueue.waitIdle();
+    for (Field &F : Fields) {
+      if (!F.Image)
+        continue;
+      Device.destroyImageView(F.View, AllocationCallbacks);
+      DeviceMemory->destroyImage(F.Image, F.ImageAllocation);
+      DeviceMemory->destroyBuffer(F.State, F.StateAllocation);
+      Device.freeDescriptorSets(DescriptorPool, F.Set);
+      F = Field{};
+    }
+    Device.destroySemaphore(ComputeTimeline, AllocationCallbacks);
+    Device.destroySemaphore(GraphicsTimeline, AllocationCallbacks);
+    Device.destroyCommandPool(CommandPool, AllocationCallbacks);
+    Device.destroyPipeline(Pipeline, AllocationCallbacks);
+    Device.destroyPipelineLayout(PipelineLayout, AllocationCallbacks);
+    Device.destroyDescriptorSetLayout(SetLayout, AllocationCallbacks);
+    Device = nullptr;
+  }
+
+  bool isSupported() const noexcept { return static_cast<bool>(Device); }
+  bool hasAsyncQueue() const noexcept {
+    return ComputeQueueFamilyIndex != GraphicsQueueFamilyIndex;
+  }
+
+  /// Cells per side. Only takes effect before the field is first created.
+  auto &getSize() noexcept { return Size; }
+  auto &getRunning() noexcept { return Running; }
+  /// Lets step N + 1 run while the frame showing step N renders.
+  auto &getOverlap() noexcept { return Overlap; }
+  uint64_t getStep() const noexcept { return Step; }
+  uint32_t getStepsPerSecond() const noexcept { return StepsPerSecond; }
+
+  /// The texture the next rendered frame shows: the step it submits while
+  /// running, else the last one. Null before the first step.
+  ImTextureID getTexture() {
+    if (!Device || (!Running && Step == 0))
+      return nullptr;
+    createFields();
+    Shown = static_cast<int>((Running ? Step + 1 : Step) % 2);
+    return Fields[Shown].Texture;
+  }
+
+  /// Records and submits the next step when running and returns what the
+  /// graphics submit of frame slot \p Frame must wait for and signal. Call
+  /// once per rendered frame after the slot's fence has been waited for,
+  /// which also retires the slot's previous command buffer.
+  ComputeSync submit(uint32_t Frame) {
+    ComputeSync Sync;
+    if (!Device || !Fields[0].Image)
+      return Sync;
+
+    Clock::time_point Now = Clock::now();
+    if (Now - WindowStart >= std::chrono::seconds(1)) {
+      StepsPerSecond = StepsInWindow;
+      StepsInWindow = 0;
+      WindowStart = Now;
+    }
+
+    if (Running) {
+      uint64_t Current = ++Step;
+      ++StepsInWindow;
+      Field &F = Fields[Current % 2];
+      while (CommandBuffers.size() <= Frame)
+        CommandBuffers.push_back(
+            Device
+                .allocateCommandBuffers(
+                    {CommandPool, vk::CommandBufferLevel::ePrimary, 1})
+                .front());
+      vk::CommandBuffer CommandBuffer = CommandBuffers[Frame];
+      CommandBuffer.reset();
+      CommandBuffer.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+      recordStep(CommandBuffer, F, Current);
+      CommandBuffer.end();
+
+      uint64_t WaitValue = Overlap ? F.LastRead : GraphicsValue;
+      vk::TimelineSemaphoreSubmitInfo Timeline(WaitValue, Current);
+      vk::PipelineStageFlags WaitStage =
+          vk::PipelineStageFlagBits::eComputeShader;
+      ComputeQueue.submit(vk::SubmitInfo(GraphicsTimeline, WaitStage,
+                                         CommandBuffer, ComputeTimeline,
+                                         &Timeline));
+      Sync.Wait = ComputeTimeline;
+      Sync.WaitValue = Current;
+    }
+
+    if (Shown >= 0) {
+      Fields[Shown].LastRead = ++GraphicsValue;
+      Sync.Signal = GraphicsTimeline;
+      Sync.SignalValue = GraphicsValue;
+      Shown = -1;
+    }
+    return Sync;
+  }
+
+private:
+  struct Params {
+    uint32_t Size;
+    float Time;
+  };
+
+  /// One half of the double buffer: the state a step writes and its
+  /// visualization.
+  struct Field {
+    vk::Buffer State;
+    DeviceAllocation StateAllocation;
+    vk::Image Image;
+    DeviceAllocation ImageAllocation;
+    vk::ImageView View;
+    /// Reads the other field's state, writes this one.
+    vk::DescriptorSet Set;
+    ImTextureID Texture = nullptr;
+    /// Graphics timeline value of the last frame that sampled the image.
+    uint64_t LastRead = 0;
+  };
+
+  /// Created on first use, once ImGui can hand out texture IDs.
+  void createFields() {
+    if (Fields[0].Image)
+      return;
+    std::array<uint32_t, 2> Families = {GraphicsQueueFamilyIndex,
+                                        ComputeQueueFamilyIndex};
+    // Sampled by graphics and written by compute; concurrent sharing saves
+    // the ownership transfers
+    vk::SharingMode Sharing = hasAsyncQueue() ? vk::SharingMode::eConcurrent
+                                              : vk::SharingMode::eExclusive;
+    uint32_t FamilyCount = hasAsyncQueue() ? 2 : 0;
+    vk::DeviceSize StateSize = vk::DeviceSize{Size} * Size * sizeof(float) * 2;
+
+    for (Field &F : Fields) {
+      std::tie(F.State, F.StateAllocation) = DeviceMemory->createBuffer(
+          {{},
+           StateSize,
+           vk::BufferUsageFlagBits::eStorageBuffer |
+               vk::BufferUsageFlagBits::eTransferDst},
+          vk::MemoryPropertyFlagBits::eDeviceLocal);
+      vk::ImageCreateInfo ImageInfo(
+          {}, vk::ImageType::e2D, vk::Format::eR8G8B8A8Unorm, {Size, Size, 1},
+          1, 1, vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+          vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled,
+          Sharing, FamilyCount, Families.data());
+      std::tie(F.Image, F.ImageAllocation) = DeviceMemory->createImage(
+          ImageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      F.View = Device.createImageView(
+          {{},
+           F.Image,
+           vk::ImageViewType::e2D,
+           vk::Format::eR8G8B8A8Unorm,
+           {},
+           {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}},
+          AllocationCallbacks);
+      F.Set = Device
+                  .allocateDescriptorSets(
+                      vk::DescriptorSetAllocateInfo(DescriptorPool, SetLayout))
+                  .front();
+      // Stays in GENERAL, which both the storage writes and sampling allow
+      F.Texture = reinterpret_cast<ImTextureID>(ImGui_ImplVulkan_AddTexture(
+          Sampler, F.View, VK_IMAGE_LAYOUT_GENERAL));
+    }
+
+    for (size_t I = 0; I < Fields.size(); ++I) {
+      Field &F = Fields[I];
+      vk::DescriptorBufferInfo Previous(Fields[1 - I].State, 0, StateSize);
+      vk::DescriptorBufferInfo Next(F.State, 0, StateSize);
+      vk::DescriptorImageInfo Output({}, F.View, vk::ImageLayout::eGeneral);
+      Device.updateDescriptorSets(
+          {{F.Set, 0, 0, vk::DescriptorType::eStorageBuffer, {}, Previous},
+           {F.Set, 1, 0, vk::DescriptorType::eStorageBuffer, {}, Next},
+           {F.Set, 2, 0, vk::DescriptorType::eStorageImage, Output}},
+          {});
+    }
+    NeedsClear = true;
+  }
+
+  void recordStep(vk::CommandBuffer CommandBuffer, Field const &F,
+                  uint64_t Current) {
+    if (NeedsClear) {
+      std::array<vk::ImageMemoryBarrier, 2> ToGeneral;
+      for (size_t I = 0; I < Fields.size(); ++I) {
+        CommandBuffer.fillBuffer(Fields[I].State, 0, VK_WHOLE_SIZE, 0);
+        ToGeneral[I] = vk::ImageMemoryBarrier(
+            {}, vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eUndefined,
+            vk::ImageLayout::eGeneral, VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED, Fields[I].Image,
+            {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+      }
+      CommandBuffer.pipelineBarrier(
+          vk::PipelineStageFlagBits::eTopOfPipe,
+          vk::PipelineStageFlagBits::eComputeShader, {}, {}, {}, ToGeneral);
+      NeedsClear = false;
+    }
+    // The previous step, or the clear, wrote the state this one reads
+    vk::MemoryBarrier Written(vk::AccessFlagBits::eShaderWrite |
+                                  vk::AccessFlagBits::eTransferWrite,
+                              vk::AccessFlagBits::eShaderRead |
+                                  vk::AccessFlagBits::eShaderWrite);
+    CommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader |
+                                      vk::PipelineStageFlagBits::eTransfer,
+                                  vk::PipelineStageFlagBits::eComputeShader,
+                                  {}, Written, {}, {});
+
+    CommandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, Pipeline);
+    CommandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                     PipelineLayout, 0, F.Set, {});
+    Params P{Size, 0.01f * static_cast<float>(Current)};
+    CommandBuffer.pushConstants(PipelineLayout,
+                                vk::ShaderStageFlagBits::eCompute, 0,
+                                sizeof(P), &P);
+    uint32_t Groups = (Size + WorkgroupSize - 1) / WorkgroupSize;
+    CommandBuffer.dispatch(Groups, Groups, 1);
+  }
+
+  vk::Device Device;
+  DeviceMemoryAllocator *DeviceMemory = nullptr;
+  vk::AllocationCallbacks AllocationCallbacks;
+  vk::DescriptorPool DescriptorPool;
+  vk::Sampler Sampler;
+  uint32_t GraphicsQueueFamilyIndex = 0;
+  uint32_t ComputeQueueFamilyIndex = 0;
+  vk::Queue ComputeQueue;
+
+  vk::DescriptorSetLayout SetLayout;
+  vk::PipelineLayout PipelineLayout;
+  vk::Pipeline Pipeline;
+  vk::CommandPool CommandPool;
+  /// One per frame slot.
+  std::vector<vk::CommandBuffer> CommandBuffers;
+  vk::Semaphore ComputeTimeline;
+  vk::Semaphore GraphicsTimeline;
+
+  std::array<Field, 2> Fields;
+  bool NeedsClear = false;
+  uint32_t Size = DefaultSize;
+  bool Running = false;
+  bool Overlap = true;
+  uint64_t Step = 0;
+  uint64_t GraphicsValue = 0;
+  /// Field the UI built this frame samples, -1 if none.
+  int Shown = -1;
+
+  Clock::time_point WindowStart = Clock::now();
+  uint32_t StepsInWindow = 0;
+  uint32_t StepsPerSecond = 0;
+};
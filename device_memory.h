@@ -0,0 +1,576 @@
+#pragma once
+
+#include "format.h"
+
+#include <imgui.h>
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// Picks a memory type from \p TypeBits that has all \p Required flags,
+/// preferring one that additionally has \p Preferred.
+inline uint32_t findMemoryType(vk::PhysicalDevice PhysicalDevice,
+                               uint32_t TypeBits,
+                               vk::MemoryPropertyFlags Required,
+                               vk::MemoryPropertyFlags Preferred = {}) {
+  vk::PhysicalDeviceMemoryProperties Properties =
+      PhysicalDevice.getMemoryProperties();
+  for (vk::MemoryPropertyFlags Wanted : {Required | Preferred, Required})
+    for (uint32_t I = 0; I < Properties.memoryTypeCount; ++I)
+      if ((TypeBits & (1u << I)) &&
+          (Properties.memoryTypes[I].propertyFlags & Wanted) == Wanted)
+        return I;
+  throw std::runtime_error("No suitable memory type");
+}
+
+enum class AllocationStrategy {
+  /// Power-of-two buddy ranges; every allocation can be freed on its own and
+  /// neighbours merge back as they are.
+  Buddy,
+  /// Bump allocation. Freed space is only reclaimed once everything in the
+  /// block has been freed, which suits batches released together.
+  Linear,
+};
+
+/// A range of device memory handed out by DeviceMemoryAllocator.
+struct DeviceAllocation {
+  vk::DeviceMemory Memory;
+  vk::DeviceSize Offset = 0;
+  vk::DeviceSize Size = 0;
+  /// Host pointer to Offset when the memory type is host visible.
+  void *Mapped = nullptr;
+  uint32_t MemoryType = 0;
+  bool Coherent = true;
+
+  explicit operator bool() const noexcept { return static_cast<bool>(Memory); }
+
+private:
+  friend class DeviceMemoryAllocator;
+  /// Owning block, nullptr for a dedicated allocation.
+  void *Block = nullptr;
+  vk::DeviceSize MemorySize = 0;
+};
+
+/// Usage of one memory heap.
+struct DeviceHeapStats {
+  vk::MemoryHeapFlags Flags;
+  vk::DeviceSize HeapSize = 0;
+  /// Memory obtained from the driver, blocks and dedicated allocations.
+  vk::DeviceSize ReservedBytes = 0;
+  /// Bytes handed out, including buddy rounding and linear padding.
+  vk::DeviceSize UsedBytes = 0;
+  /// Largest allocation the existing blocks can take without a new one.
+  vk::DeviceSize LargestFreeRange = 0;
+  uint32_t Blocks = 0;
+  uint32_t Allocations = 0;
+  uint32_t DedicatedAllocations = 0;
+  /// Process budget and usage from VK_EXT_memory_budget, or an estimate
+  /// from the heap size and our own allocations without it.
+  vk::DeviceSize Budget = 0;
+  vk::DeviceSize Usage = 0;
+
+  vk::DeviceSize freeBytes() const noexcept {
+    return ReservedBytes - UsedBytes;
+  }
+  /// 0 while the free space is a single range, approaching 1 as it splinters.
+  double fragmentation() const noexcept {
+    vk::DeviceSize Free = freeBytes();
+    return Free == 0 ? 0.0
+                     : 1.0 - static_cast<double>(LargestFreeRange) / Free;
+  }
+};
+
+/// Offsets within one block of device memory, handed out as power-of-two
+/// buddy ranges or bump allocated. Bookkeeping only: DeviceMemoryAllocator
+/// owns the memory and does the Vulkan calls.
+class MemoryBlockRanges {
+public:
+  static constexpr vk::DeviceSize MinBuddySize = 256;
+
+  /// \p Size must be a power of two of at least MinBuddySize for Buddy.
+  MemoryBlockRanges(vk::DeviceSize Size, AllocationStrategy Strategy)
+      : Size(Size), Strategy(Strategy) {
+    if (Strategy == AllocationStrategy::Buddy) {
+      FreeLists.resize(std::countr_zero(Size) - std::countr_zero(MinBuddySize) +
+                       1);
+      FreeLists.back().insert(0);
+    }
+  }
+
+  std::optional<vk::DeviceSize> allocate(vk::DeviceSize Size,
+                                         vk::DeviceSize Alignment) {
+    if (Strategy == AllocationStrategy::Linear) {
+      vk::DeviceSize Offset = alignUp(Used, Alignment);
+      if (Offset + Size > this->Size)
+        return std::nullopt;
+      Used = Offset + Size;
+      ++Allocations;
+      return Offset;
+    }
+
+    // Buddy ranges are aligned to their own size
+    vk::DeviceSize Needed =
+        std::bit_ceil(std::max({Size, Alignment, MinBuddySize}));
+    auto Order = static_cast<uint32_t>(std::countr_zero(Needed) -
+                                       std::countr_zero(MinBuddySize));
+    uint32_t From = Order;
+    while (From < FreeLists.size() && FreeLists[From].empty())
+      ++From;
+    if (From >= FreeLists.size())
+      return std::nullopt;
+    // Lowest address first, so the top of the block stays in one piece
+    vk::DeviceSize Offset = *FreeLists[From].begin();
+    FreeLists[From].erase(FreeLists[From].begin());
+    for (; From > Order; --From)
+      FreeLists[From - 1].insert(Offset + (MinBuddySize << (From - 1)));
+    Orders.emplace(Offset, Order);
+    Used += Needed;
+    ++Allocations;
+    return Offset;
+  }
+
+  void release(vk::DeviceSize Offset) {
+    --Allocations;
+    if (Strategy == AllocationStrategy::Linear) {
+      if (Allocations == 0)
+        Used = 0;
+      return;
+    }
+
+    auto It = Orders.find(Offset);
+    uint32_t Order = It->second;
+    Orders.erase(It);
+    Used -= MinBuddySize << Order;
+    for (; Order + 1 < FreeLists.size(); ++Order) {
+      vk::DeviceSize Buddy = Offset ^ (MinBuddySize << Order);
+      if (FreeLists[Order].erase(Buddy) == 0)
+        break;
+      Offset = std::min(Offset, Buddy);
+    }
+    FreeLists[Order].insert(Offset);
+  }
+
+  /// Largest allocation that fits without alignment beyond its size.
+  vk::DeviceSize largestFree() const noexcept {
+    if (Strategy == AllocationStrategy::Linear)
+      return Size - Used;
+    for (size_t Order = FreeLists.size(); Order-- > 0;)
+      if (!FreeLists[Order].empty())
+        return MinBuddySize << Order;
+    return 0;
+  }
+
+  vk::DeviceSize getSize() const noexcept { return Size; }
+  AllocationStrategy getStrategy() const noexcept { return Strategy; }
+  /// Bytes handed out, including buddy rounding and linear padding.
+  vk::DeviceSize getUsed() const noexcept { return Used; }
+  uint32_t getAllocations() const noexcept { return Allocations; }
+
+  static constexpr vk::DeviceSize alignUp(vk::DeviceSize Value,
+                                          vk::DeviceSize Alignment) noexcept {
+    return Alignment <= 1 ? Value
+                          : (Value + Alignment - 1) / Alignment * Alignment;
+  }
+
+private:
+  vk::DeviceSize Size;
+  AllocationStrategy Strategy;
+  vk::DeviceSize Used = 0;
+  uint32_t Allocations = 0;
+  /// Buddy: free offsets per order, order N being MinBuddySize << N bytes,
+  /// and the order of each live allocation.
+  std::vector<std::set<vk::DeviceSize>> FreeLists;
+  std::unordered_map<vk::DeviceSize, uint32_t> Orders;
+};
+
+/// Carves buffers and images out of large per-memory-type blocks, so that
+/// resources do not each cost a vkAllocateMemory and count against
+/// maxMemoryAllocationCount. Requests over half a block get dedicated
+/// memory. New memory is only taken while the heap stays within its budget;
+/// otherwise the next memory type with the required flags is tried.
+class DeviceMemoryAllocator {
+public:
+  static constexpr vk::DeviceSize MaxBlockSize = vk::DeviceSize{64} << 20;
+  static constexpr vk::DeviceSize MinBuddySize =
+      MemoryBlockRanges::MinBuddySize;
+  /// Share of a heap assumed usable when VK_EXT_memory_budget is missing.
+  static constexpr double EstimatedBudgetFraction = 0.8;
+
+  DeviceMemoryAllocator() = default;
+  DeviceMemoryAllocator(DeviceMemoryAllocator const &) = delete;
+  DeviceMemoryAllocator &operator=(DeviceMemoryAllocator const &) = delete;
+
+  void init(vk::PhysicalDevice PhysicalDevice, vk::Device Device,
+            vk::AllocationCallbacks const &AllocationCallbacks,
+            bool MemoryBudget) {
+    this->PhysicalDevice = PhysicalDevice;
+    this->Device = Device;
+    this->AllocationCallbacks = AllocationCallbacks;
+    this->MemoryBudget = MemoryBudget;
+    Properties = PhysicalDevice.getMemoryProperties();
+    vk::PhysicalDeviceLimits Limits = PhysicalDevice.getProperties().limits;
+    Granularity = Limits.bufferImageGranularity;
+    NonCoherentAtomSize = Limits.nonCoherentAtomSize;
+    Blocks.resize(Properties.memoryTypeCount);
+    Heaps.resize(Properties.memoryHeapCount);
+  }
+
+  /// Frees every block. Resources still bound to them must be gone.
+  void destroy() {
+    std::lock_guard Lock(Mutex);
+    for (auto &TypeBlocks : Blocks) {
+      for (auto &B : TypeBlocks)
+        Device.freeMemory(B->Memory, AllocationCallbacks);
+      TypeBlocks.clear();
+    }
+    for (Heap &H : Heaps)
+      H = Heap{};
+  }
+
+  bool hasMemoryBudget() const noexcept { return MemoryBudget; }
+
+  DeviceAllocation
+  allocate(vk::MemoryRequirements const &Requirements,
+           vk::MemoryPropertyFlags Required,
+           vk::MemoryPropertyFlags Preferred = {},
+           AllocationStrategy Strategy = AllocationStrategy::Buddy) {
+    // Rounding to the granularity keeps linear and optimal resources from
+    // ever sharing a page, so blocks need not be split by resource kind
+    vk::DeviceSize Alignment = std::max(Requirements.alignment, Granularity);
+    vk::DeviceSize Size =
+        MemoryBlockRanges::alignUp(Requirements.size, Granularity);
+
+    std::lock_guard Lock(Mutex);
+    for (vk::MemoryPropertyFlags Wanted : {Required | Preferred, Required})
+      for (uint32_t Type = 0; Type < Properties.memoryTypeCount; ++Type)
+        if ((Requirements.memoryTypeBits & (1u << Type)) &&
+            (Properties.memoryTypes[Type].propertyFlags & Wanted) == Wanted)
+          if (std::optional<DeviceAllocation> Allocation =
+                  allocateFromType(Type, Size, Alignment, Strategy)) {
+            Allocation->Size = Requirements.size;
+            return *Allocation;
+          }
+    throw std::runtime_error(fmt::format(
+        "Failed to allocate {} bytes of device memory within budget", Size));
+  }
+
+  void free(DeviceAllocation &Allocation) {
+    if (!Allocation)
+      return;
+    std::lock_guard Lock(Mutex);
+    Heap &H = Heaps[Properties.memoryTypes[Allocation.MemoryType].heapIndex];
+    if (!Allocation.Block) {
+      Device.freeMemory(Allocation.Memory, AllocationCallbacks);
+      H.Reserved -= Allocation.MemorySize;
+      H.DedicatedUsed -= Allocation.MemorySize;
+      --H.Dedicated;
+      Allocation = {};
+      return;
+    }
+
+    auto *B = static_cast<Block *>(Allocation.Block);
+    B->release(Allocation.Offset);
+    Allocation = {};
+    if (B->getAllocations() != 0)
+      return;
+    // Keep one empty block per type and strategy around, so a resource
+    // that is recreated every frame does not hit vkAllocateMemory each time
+    auto &TypeBlocks = Blocks[B->MemoryType];
+    bool OtherEmpty = std::any_of(
+        TypeBlocks.begin(), TypeBlocks.end(), [B](auto const &Other) {
+          return Other.get() != B &&
+                 Other->getStrategy() == B->getStrategy() &&
+                 Other->getAllocations() == 0;
+        });
+    if (!OtherEmpty)
+      return;
+    Device.freeMemory(B->Memory, AllocationCallbacks);
+    H.Reserved -= B->getSize();
+    std::erase_if(TypeBlocks,
+                  [B](auto const &Other) { return Other.get() == B; });
+  }
+
+  std::pair<vk::Buffer, DeviceAllocation>
+  createBuffer(vk::BufferCreateInfo const &CreateInfo,
+               vk::MemoryPropertyFlags Required,
+               vk::MemoryPropertyFlags Preferred = {},
+               AllocationStrategy Strategy = AllocationStrategy::Buddy) {
+    vk::Buffer Buffer = Device.createBuffer(CreateInfo, AllocationCallbacks);
+    DeviceAllocation Allocation;
+    try {
+      Allocation = allocate(Device.getBufferMemoryRequirements(Buffer),
+                            Required, Preferred, Strategy);
+      Device.bindBufferMemory(Buffer, Allocation.Memory, Allocation.Offset);
+    } catch (...) {
+      free(Allocation);
+      Device.destroyBuffer(Buffer, AllocationCallbacks);
+      throw;
+    }
+    return {Buffer, Allocation};
+  }
+
+  std::pair<vk::Image, DeviceAllocation>
+  createImage(vk::ImageCreateInfo const &CreateInfo,
+              vk::MemoryPropertyFlags Required,
+              vk::MemoryPropertyFlags Preferred = {},
+              AllocationStrategy Strategy = AllocationStrategy::Buddy) {
+    vk::Image Image = Device.createImage(CreateInfo, AllocationCallbacks);
+    DeviceAllocation Allocation;
+    try {
+      Allocation = allocate(Device.getImageMemoryRequirements(Image), Required,
+                            Preferred, Strategy);
+      Device.bindImageMemory(Image, Allocation.Memory, Allocation.Offset);
+    } catch (...) {
+      free(Allocation);
+      Device.destroyImage(Image, AllocationCallbacks);
+      throw;
+    }
+    return {Image, Allocation};
+  }
+
+  void destroyBuffer(vk::Buffer Buffer, DeviceAllocation &Allocation) {
+    Device.destroyBuffer(Buffer, AllocationCallbacks);
+    free(Allocation);
+  }
+
+  void destroyImage(vk::Image Image, DeviceAllocation &Allocation) {
+    Device.destroyImage(Image, AllocationCallbacks);
+    free(Allocation);
+  }
+
+  /// Makes host writes to [Offset, Offset + Size) of the allocation visible
+  /// to the device; a no-op for coherent memory.
+  void flush(DeviceAllocation const &Allocation, vk::DeviceSize Offset = 0,
+             vk::DeviceSize Size = VK_WHOLE_SIZE) {
+    if (!Allocation.Coherent && Allocation.Mapped)
+      Device.flushMappedMemoryRanges(mappedRange(Allocation, Offset, Size));
+  }
+
+  /// Makes device writes to [Offset, Offset + Size) of the allocation
+  /// visible to the host; a no-op for coherent memory.
+  void invalidate(DeviceAllocation const &Allocation,
+                  vk::DeviceSize Offset = 0,
+                  vk::DeviceSize Size = VK_WHOLE_SIZE) {
+    if (!Allocation.Coherent && Allocation.Mapped)
+      Device.invalidateMappedMemoryRanges(
+          mappedRange(Allocation, Offset, Size));
+  }
+
+  /// One entry per memory heap.
+  std::vector<DeviceHeapStats> getHeapStats() {
+    std::lock_guard Lock(Mutex);
+    updateBudget();
+    std::vector<DeviceHeapStats> Stats(Properties.memoryHeapCount);
+    for (uint32_t I = 0; I < Properties.memoryHeapCount; ++I) {
+      DeviceHeapStats &S = Stats[I];
+      S.Flags = Properties.memoryHeaps[I].flags;
+      S.HeapSize = Properties.memoryHeaps[I].size;
+      S.ReservedBytes = Heaps[I].Reserved;
+      S.UsedBytes = Heaps[I].DedicatedUsed;
+      S.DedicatedAllocations = Heaps[I].Dedicated;
+      S.Allocations = Heaps[I].Dedicated;
+      S.Budget = Heaps[I].Budget;
+      S.Usage = Heaps[I].Usage;
+    }
+    for (auto const &TypeBlocks : Blocks)
+      for (auto const &B : TypeBlocks) {
+        DeviceHeapStats &S =
+            Stats[Properties.memoryTypes[B->MemoryType].heapIndex];
+        S.UsedBytes += B->getUsed();
+        S.LargestFreeRange = std::max(S.LargestFreeRange, B->largestFree());
+        S.Allocations += B->getAllocations();
+        ++S.Blocks;
+      }
+    return Stats;
+  }
+
+private:
+  /// One vkAllocateMemory, persistently mapped if host visible.
+  struct Block : MemoryBlockRanges {
+    using MemoryBlockRanges::MemoryBlockRanges;
+    vk::DeviceMemory Memory;
+    std::byte *Mapped = nullptr;
+    uint32_t MemoryType = 0;
+  };
+
+  struct Heap {
+    vk::DeviceSize Reserved = 0;
+    vk::DeviceSize DedicatedUsed = 0;
+    uint32_t Dedicated = 0;
+    vk::DeviceSize Budget = 0;
+    vk::DeviceSize Usage = 0;
+  };
+
+  vk::MappedMemoryRange mappedRange(DeviceAllocation const &Allocation,
+                                    vk::DeviceSize Offset,
+                                    vk::DeviceSize Size) const {
+    Size = std::min(Size, Allocation.Size - std::min(Offset, Allocation.Size));
+    Offset += Allocation.Offset;
+    vk::DeviceSize Begin = Offset / NonCoherentAtomSize * NonCoherentAtomSize;
+    vk::DeviceSize End =
+        MemoryBlockRanges::alignUp(Offset + Size, NonCoherentAtomSize);
+    return {Allocation.Memory, Begin,
+            End >= Allocation.MemorySize ? VK_WHOLE_SIZE : End - Begin};
+  }
+
+  void updateBudget() {
+    if (!MemoryBudget) {
+      for (uint32_t I = 0; I < Properties.memoryHeapCount; ++I) {
+        Heaps[I].Budget = static_cast<vk::DeviceSize>(
+            Properties.memoryHeaps[I].size * EstimatedBudgetFraction);
+        Heaps[I].Usage = Heaps[I].Reserved;
+      }
+      return;
+    }
+    auto Chain = PhysicalDevice.getMemoryProperties2<
+        vk::PhysicalDeviceMemoryProperties2,
+        vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    auto const &Budget =
+        Chain.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    for (uint32_t I = 0; I < Properties.memoryHeapCount; ++I) {
+      Heaps[I].Budget = Budget.heapBudget[I];
+      Heaps[I].Usage = Budget.heapUsage[I];
+    }
+  }
+
+  /// Asks the driver for memory if the heap budget allows it.
+  std::optional<std::pair<vk::DeviceMemory, std::byte *>>
+  allocateMemory(uint32_t Type, vk::DeviceSize Size) {
+    Heap &H = Heaps[Properties.memoryTypes[Type].heapIndex];
+    updateBudget();
+    if (H.Usage + Size > H.Budget)
+      return std::nullopt;
+    vk::DeviceMemory Memory;
+    try {
+      Memory = Device.allocateMemory({Size, Type}, AllocationCallbacks);
+    } catch (vk::OutOfDeviceMemoryError const &) {
+      return std::nullopt;
+    }
+    std::byte *Mapped = nullptr;
+    if (Properties.memoryTypes[Type].propertyFlags &
+        vk::MemoryPropertyFlagBits::eHostVisible)
+      Mapped = static_cast<std::byte *>(
+          Device.mapMemory(Memory, 0, VK_WHOLE_SIZE));
+    H.Reserved += Size;
+    return std::pair{Memory, Mapped};
+  }
+
+  std::optional<DeviceAllocation>
+  allocateFromType(uint32_t Type, vk::DeviceSize Size,
+                   vk::DeviceSize Alignment, AllocationStrategy Strategy) {
+    DeviceAllocation Allocation;
+    Allocation.MemoryType = Type;
+    Allocation.Coherent = static_cast<bool>(
+        Properties.memoryTypes[Type].propertyFlags &
+        vk::MemoryPropertyFlagBits::eHostCoherent);
+
+    vk::DeviceSize BlockSize = std::min(
+        MaxBlockSize,
+        std::bit_floor(
+            Properties.memoryHeaps[Properties.memoryTypes[Type].heapIndex]
+                .size /
+            8));
+    if (Size > BlockSize / 2) {
+      auto Memory = allocateMemory(Type, Size);
+      if (!Memory)
+        return std::nullopt;
+      Heap &H = Heaps[Properties.memoryTypes[Type].heapIndex];
+      H.DedicatedUsed += Size;
+      ++H.Dedicated;
+      Allocation.Memory = Memory->first;
+      Allocation.Mapped = Memory->second;
+      Allocation.MemorySize = Size;
+      return Allocation;
+    }
+
+    auto Place = [&](Block &B) -> bool {
+      std::optional<vk::DeviceSize> Offset = B.allocate(Size, Alignment);
+      if (!Offset)
+        return false;
+      Allocation.Memory = B.Memory;
+      Allocation.Offset = *Offset;
+      Allocation.Mapped = B.Mapped ? B.Mapped + *Offset : nullptr;
+      Allocation.Block = &B;
+      Allocation.MemorySize = B.getSize();
+      return true;
+    };
+
+    for (auto &B : Blocks[Type])
+      if (B->getStrategy() == Strategy && Place(*B))
+        return Allocation;
+
+    // Near the budget, settle for a smaller block that still fits
+    vk::DeviceSize MinSize =
+        std::bit_ceil(std::max({Size, Alignment, MinBuddySize}));
+    for (; BlockSize >= MinSize; BlockSize /= 2) {
+      auto Memory = allocateMemory(Type, BlockSize);
+      if (!Memory)
+        continue;
+      auto B = std::make_unique<Block>(BlockSize, Strategy);
+      B->Memory = Memory->first;
+      B->Mapped = Memory->second;
+      B->MemoryType = Type;
+      Place(*B);
+      Blocks[Type].push_back(std::move(B));
+      return Allocation;
+    }
+    return std::nullopt;
+  }
+
+  vk::PhysicalDevice PhysicalDevice;
+  vk::Device Device;
+  vk::AllocationCallbacks AllocationCallbacks;
+  vk::PhysicalDeviceMemoryProperties Properties;
+  vk::DeviceSize Granularity = 1;
+  vk::DeviceSize NonCoherentAtomSize = 1;
+  bool MemoryBudget = false;
+  std::mutex Mutex;
+  std::vector<std::vector<std::unique_ptr<Block>>> Blocks;
+  std::vector<Heap> Heaps;
+};
+
+/// Table of per-heap device memory usage, for the profiler panel.
+inline void drawDeviceMemoryStats(DeviceMemoryAllocator &Allocator) {
+  std::vector<DeviceHeapStats> Stats = Allocator.getHeapStats();
+  ImGui::Text("Budget: %s", Allocator.hasMemoryBudget()
+                                ? "VK_EXT_memory_budget"
+                                : "estimated");
+  if (!ImGui::BeginTable("device memory", 7,
+                         ImGuiTableFlags_Borders |
+                             ImGuiTableFlags_SizingFixedFit))
+    return;
+  for (char const *Column : {"heap", "reserved MiB", "used MiB", "allocs",
+                             "frag", "usage MiB", "budget MiB"})
+    ImGui::TableSetupColumn(Column);
+  ImGui::TableHeadersRow();
+  constexpr double MiB = 1024.0 * 1024.0;
+  for (size_t I = 0; I < Stats.size(); ++I) {
+    DeviceHeapStats const &S = Stats[I];
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    ImGui::Text("%zu%s", I,
+                S.Flags & vk::MemoryHeapFlagBits::eDeviceLocal ? " (device)"
+                                                               : "");
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", S.ReservedBytes / MiB);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", S.UsedBytes / MiB);
+    ImGui::TableNextColumn();
+    ImGui::Text("%u", S.Allocations);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.2f", S.fragmentation());
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", S.Usage / MiB);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", S.Budget / MiB);
+  }
+  ImGui::EndTable();
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "format.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Queue families the context creates queues on. Compute and transfer fall
+/// back to the graphics family when the hardware has nothing better.
+struct QueueTopology {
+  uint32_t Graphics = 0;
+  /// A compute family without graphics, the async compute engine.
+  uint32_t Compute = 0;
+  /// A transfer-only family (the DMA engines), else any non-graphics one.
+  uint32_t Transfer = 0;
+
+  bool hasAsyncCompute() const noexcept { return Compute != Graphics; }
+  bool hasDedicatedTransfer() const noexcept { return Transfer != Graphics; }
+};
+
+/// Picks the queue families, or nothing if there is no graphics family.
+inline std::optional<QueueTopology>
+selectQueueTopology(std::vector<vk::QueueFamilyProperties> const &Queues) {
+  auto Find = [&](vk::QueueFlags Required,
+                  vk::QueueFlags Excluded) -> std::optional<uint32_t> {
+    for (size_t I = 0; I < Queues.size(); ++I)
+      if ((Queues[I].queueFlags & Required) == Required &&
+          !(Queues[I].queueFlags & Excluded) && Queues[I].queueCount > 0)
+        return static_cast<uint32_t>(I);
+    return std::nullopt;
+  };
+  using F = vk::QueueFlagBits;
+
+  std::optional<uint32_t> Graphics = Find(F::eGraphics | F::eCompute, {});
+  if (!Graphics)
+    Graphics = Find(F::eGraphics, {});
+  if (!Graphics)
+    return std::nullopt;
+
+  QueueTopology Topology;
+  Topology.Graphics = *Graphics;
+  Topology.Compute = Find(F::eCompute, F::eGraphics).value_or(*Graphics);
+  // Transfer-only first, then a non-graphics family other than the compute
+  // one, then the compute family itself
+  std::optional<uint32_t> Transfer =
+      Find(F::eTransfer, F::eGraphics | F::eCompute);
+  for (size_t I = 0; !Transfer && I < Queues.size(); ++I)
+    if ((Queues[I].queueFlags & F::eTransfer) &&
+        !(Queues[I].queueFlags & F::eGraphics) && I != Topology.Compute)
+      Transfer = static_cast<uint32_t>(I);
+  if (!Transfer)
+    Transfer = Find(F::eTransfer, F::eGraphics);
+  // Compute families implicitly support transfers
+  if (!Transfer && Topology.hasAsyncCompute())
+    Transfer = Topology.Compute;
+  Topology.Transfer = Transfer.value_or(*Graphics);
+  return Topology;
+}
+
+/// Ranks \p Device for rendering the demo, or nothing if it cannot run it
+/// at all. Device type dominates; device local memory, image limits and
+/// dedicated compute/transfer queues break ties between GPUs of a kind.
+inline std::optional<int64_t> scorePhysicalDevice(vk::PhysicalDevice Device,
+                                                  bool NeedSwapchain) {
+  std::optional<QueueTopology> Topology =
+      selectQueueTopology(Device.getQueueFamilyProperties());
+  if (!Topology)
+    return std::nullopt;
+
+  // The surface does not exist yet; a device without the swapchain
+  // extension cannot present to it whatever the platform. setupWindow
+  // checks the surface itself.
+  if (NeedSwapchain) {
+    std::vector<vk::ExtensionProperties> Extensions =
+        Device.enumerateDeviceExtensionProperties();
+    if (std::none_of(Extensions.begin(), Extensions.end(),
+                     [](vk::ExtensionProperties const &Extension) {
+                       return std::strcmp(Extension.extensionName,
+                                          VK_KHR_SWAPCHAIN_EXTENSION_NAME) ==
+                              0;
+                     }))
+      return std::nullopt;
+  }
+
+  vk::PhysicalDeviceProperties Properties = Device.getProperties();
+  int64_t Score = 0;
+  switch (Properties.deviceType) {
+  case vk::PhysicalDeviceType::eDiscreteGpu:
+    Score += 100'000;
+    break;
+  case vk::PhysicalDeviceType::eIntegratedGpu:
+    Score += 50'000;
+    break;
+  case vk::PhysicalDeviceType::eVirtualGpu:
+    Score += 20'000;
+    break;
+  case vk::PhysicalDeviceType::eCpu:
+    Score += 10'000;
+    break;
+  default:
+    break;
+  }
+
+  vk::PhysicalDeviceMemoryProperties Memory = Device.getMemoryProperties();
+  vk::DeviceSize DeviceLocal = 0;
+  for (uint32_t I = 0; I < Memory.memoryHeapCount; ++I)
+    if (Memory.memoryHeaps[I].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+      DeviceLocal = std::max(DeviceLocal, Memory.memoryHeaps[I].size);
+  // A point per 64 MiB, capped well below a device type step
+  Score += static_cast<int64_t>(
+      std::min<vk::DeviceSize>(DeviceLocal >> 26, 10'000));
+
+  Score += Properties.limits.maxImageDimension2D / 1024;
+  if (Topology->hasAsyncCompute())
+    Score += 500;
+  if (Topology->hasDedicatedTransfer())
+    Score += 500;
+  return Score;
+}
+
+/// Chooses the physical device. \p Override, or the VULKAN_DEVICE
+/// environment variable when it is empty, selects a device by index in
+/// enumeration order or by a case-insensitive substring of its name;
+/// otherwise the best scoring device wins. Throws if no device qualifies.
+inline vk::PhysicalDevice selectPhysicalDevice(vk::Instance Instance,
+                                               std::string Override,
+                                               bool NeedSwapchain) {
+  std::vector<vk::PhysicalDevice> Devices =
+      Instance.enumeratePhysicalDevices();
+  if (Devices.empty())
+    throw std::runtime_error("No Vulkan devices");
+  if (Override.empty())
+    if (char const *Env = std::getenv("VULKAN_DEVICE"))
+      Override = Env;
+
+  auto Lower = [](std::string_view Str) {
+    std::string Result(Str);
+    for (char &C : Result)
+      C = static_cast<char>(std::tolower(static_cast<unsigned char>(C)));
+    return Result;
+  };
+  uint32_t OverrideIndex = 0;
+  auto [Ptr, Ec] = std::from_chars(
+      Override.data(), Override.data() + Override.size(), OverrideIndex);
+  bool ByIndex = !Override.empty() && Ec == std::errc() &&
+                 Ptr == Override.data() + Override.size();
+  std::string OverrideName = Lower(Override);
+
+  std::optional<size_t> Best;
+  int64_t BestScore = 0;
+  for (size_t I = 0; I < Devices.size(); ++I) {
+    vk::PhysicalDeviceProperties Properties = Devices[I].getProperties();
+    std::optional<int64_t> Score =
+        scorePhysicalDevice(Devices[I], NeedSwapchain);
+    errsv("Device {}: <{}> {}, score {}", I, Properties.deviceName.data(),
+          vk::to_string(Properties.deviceType),
+          Score ? std::to_string(*Score) : "unusable");
+    if (!Override.empty()) {
+      bool Match = ByIndex ? I == OverrideIndex
+                           : Lower(Properties.deviceName.data())
+                                     .find(OverrideName) != std::string::npos;
+      if (Match && !Best) {
+        if (!Score)
+          throw std::runtime_error(fmt::format(
+              "Device <{}> selected by <{}> cannot be used",
+              Properties.deviceName.data(), Override));
+        Best = I;
+      }
+    } else if (Score && (!Best || *Score > BestScore)) {
+      Best = I;
+      BestScore = *Score;
+    }
+  }
+  if (!Best)
+    throw std::runtime_error(
+        Override.empty()
+            ? std::string("No usable Vulkan device")
+            : fmt::format("No Vulkan device matches <{}>", Override));
+  errsv("Selected device: <{}>{}",
+        Devices[*Best].getProperties().deviceName.data(),
+        Override.empty() ? "" : " (override)");
+  return Devices[*Best];
+}
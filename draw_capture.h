@@ -0,0 +1,494 @@
+#pragma once
+
+#include "format.h"
+#include "mapped_file.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace draw_capture {
+
+/// Bumped whenever the layout below changes.
+constexpr uint32_t Version = 2;
+constexpr char Magic[8] = {'I', 'M', 'D', 'R', 'A', 'W', 'C', 'P'};
+
+/// The file is this header followed by frames until the end of the file.
+/// Everything is in the byte order of the capturing machine, and every
+/// frame, list and array starts 8-byte aligned so that replay can use the
+/// vertex and index arrays where they are mapped.
+struct FileHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t ImGuiVersion;
+  /// ImDrawVert can be overridden per build, replay needs the same layout.
+  uint32_t VertexSize;
+  uint32_t IndexSize;
+  /// Texture ID of the font atlas in the capturing process.
+  uint64_t FontTexture;
+};
+
+/// Followed by ListCount lists.
+struct FrameHeader {
+  /// Bytes from the start of this header to the next frame.
+  uint64_t Size;
+  ImVec2 DisplayPos;
+  ImVec2 DisplaySize;
+  ImVec2 FramebufferScale;
+  uint32_t ListCount;
+  uint32_t TotalVtxCount;
+  uint32_t TotalIdxCount;
+  uint32_t Reserved;
+};
+
+/// Followed by CmdCount commands, VtxCount ImDrawVert and IdxCount
+/// ImDrawIdx. The vertices and the indices are each padded to 8 bytes.
+struct ListHeader {
+  uint32_t CmdCount;
+  uint32_t VtxCount;
+  uint32_t IdxCount;
+  uint32_t Flags;
+};
+
+enum class Callback : uint32_t { None, ResetRenderState };
+
+struct Command {
+  ImVec4 ClipRect;
+  uint64_t TextureId;
+  uint32_t VtxOffset;
+  uint32_t IdxOffset;
+  uint32_t ElemCount;
+  Callback UserCallback;
+};
+
+static_assert(sizeof(FileHeader) % 8 == 0 && sizeof(FrameHeader) % 8 == 0 &&
+              sizeof(ListHeader) % 8 == 0 && sizeof(Command) % 8 == 0);
+
+constexpr size_t alignUp(size_t Offset) { return (Offset + 7) & ~size_t{7}; }
+
+/// ImTextureID is a pointer by default but may be configured as an integer.
+inline uint64_t textureBits(ImTextureID Texture) {
+  static_assert(sizeof(Texture) <= sizeof(uint64_t));
+  uint64_t Bits = 0;
+  std::memcpy(&Bits, &Texture, sizeof(Texture));
+  return Bits;
+}
+
+/// Appends \p Data as one frame to \p Out, which is cleared first. Returns
+/// the number of user callbacks left out, which cannot be replayed.
+inline uint32_t serialize(ImDrawData const &Data, std::vector<uint8_t> &Out) {
+  Out.clear();
+  auto Append = [&Out](void const *Src, size_t Size) {
+    auto const *Bytes = static_cast<uint8_t const *>(Src);
+    Out.insert(Out.end(), Bytes, Bytes + Size);
+  };
+  auto Patch = [&Out](size_t Offset, void const *Src, size_t Size) {
+    std::memcpy(Out.data() + Offset, Src, Size);
+  };
+
+  uint32_t Dropped = 0;
+  FrameHeader Frame = {};
+  Frame.DisplayPos = Data.DisplayPos;
+  Frame.DisplaySize = Data.DisplaySize;
+  Frame.FramebufferScale = Data.FramebufferScale;
+  Frame.ListCount = static_cast<uint32_t>(Data.CmdListsCount);
+  Frame.TotalVtxCount = static_cast<uint32_t>(Data.TotalVtxCount);
+  Frame.TotalIdxCount = static_cast<uint32_t>(Data.TotalIdxCount);
+  Append(&Frame, sizeof(Frame));
+
+  for (int I = 0; I < Data.CmdListsCount; ++I) {
+    ImDrawList const &List = *Data.CmdLists[I];
+    size_t ListOffset = Out.size();
+    ListHeader Header = {0, static_cast<uint32_t>(List.VtxBuffer.Size),
+                         static_cast<uint32_t>(List.IdxBuffer.Size),
+                         static_cast<uint32_t>(List.Flags)};
+    Append(&Header, sizeof(Header));
+    for (ImDrawCmd const &Cmd : List.CmdBuffer) {
+      Command Entry = {Cmd.ClipRect,  textureBits(Cmd.TextureId),
+                       Cmd.VtxOffset, Cmd.IdxOffset,
+                       Cmd.ElemCount, Callback::None};
+      if (Cmd.UserCallback == ImDrawCallback_ResetRenderState) {
+        Entry.UserCallback = Callback::ResetRenderState;
+      } else if (Cmd.UserCallback) {
+        ++Dropped;
+        continue;
+      }
+      Append(&Entry, sizeof(Entry));
+      ++Header.CmdCount;
+    }
+    Patch(ListOffset, &Header, sizeof(Header));
+    Append(List.VtxBuffer.Data, List.VtxBuffer.size_in_bytes());
+    Out.resize(alignUp(Out.size()));
+    Append(List.IdxBuffer.Data, List.IdxBuffer.size_in_bytes());
+    Out.resize(alignUp(Out.size()));
+  }
+  Frame.Size = Out.size();
+  Patch(0, &Frame, sizeof(Frame));
+  return Dropped;
+}
+
+} // namespace draw_capture
+
+/// Records the ImDrawData of every rendered frame into a capture file that
+/// DrawReplay plays back, so the Vulkan path can be benchmarked on the exact
+/// traffic of a session. The calling thread only copies the draw lists into
+/// a pooled buffer; a writer thread does the file I/O. When the writer is
+/// MaxPending frames behind, add() waits for it instead of dropping frames,
+/// which would make the capture useless for replay.
+class DrawCaptureWriter {
+public:
+  static constexpr size_t MaxPending = 8;
+
+  /// \p FontTexture lets replay tell the font atlas from other textures.
+  DrawCaptureWriter(std::filesystem::path Path, ImTextureID FontTexture)
+      : Path(std::move(Path)) {
+    Out.open(this->Path, std::ios::binary | std::ios::trunc);
+    draw_capture::FileHeader Header = {};
+    std::memcpy(Header.Magic, draw_capture::Magic, sizeof(Header.Magic));
+    Header.Version = draw_capture::Version;
+    Header.ImGuiVersion = IMGUI_VERSION_NUM;
+    Header.VertexSize = sizeof(ImDrawVert);
+    Header.IndexSize = sizeof(ImDrawIdx);
+    Header.FontTexture = draw_capture::textureBits(FontTexture);
+    Out.write(reinterpret_cast<char const *>(&Header), sizeof(Header));
+    if (!Out)
+      throw std::runtime_error(
+          fmt::format("Failed to create capture <{}>", this->Path.string()));
+    Writer = std::thread([this] { writerMain(); });
+  }
+
+  DrawCaptureWriter(DrawCaptureWriter const &) = delete;
+  DrawCaptureWriter &operator=(DrawCaptureWriter const &) = delete;
+
+  ~DrawCaptureWriter() {
+    {
+      std::lock_guard Lock(Mutex);
+      Stop = true;
+    }
+    Cv.notify_all();
+    Writer.join();
+    Out.close();
+    errsv("Capture <{}>: {} frames, {} bytes, {} stalls, {} callbacks "
+          "dropped{}",
+          Path.string(), Frames, Bytes, Stalls, DroppedCallbacks,
+          Failed ? ", write failed" : "");
+  }
+
+  void add(ImDrawData const &Data) {
+    std::vector<uint8_t> Buffer;
+    {
+      std::unique_lock Lock(Mutex);
+      if (Failed)
+        return;
+      if (Pending.size() >= MaxPending) {
+        ++Stalls;
+        Cv.wait(Lock, [&] { return Pending.size() < MaxPending || Failed; });
+        if (Failed)
+          return;
+      }
+      if (!Free.empty()) {
+        Buffer = std::move(Free.back());
+        Free.pop_back();
+      }
+    }
+    DroppedCallbacks += draw_capture::serialize(Data, Buffer);
+    {
+      std::lock_guard Lock(Mutex);
+      Pending.push_back(std::move(Buffer));
+      ++Frames;
+    }
+    Cv.notify_all();
+  }
+
+private:
+  void writerMain() {
+    while (true) {
+      std::vector<uint8_t> Buffer;
+      {
+        std::unique_lock Lock(Mutex);
+        Cv.wait(Lock, [&] { return Stop || !Pending.empty(); });
+        if (Pending.empty())
+          return;
+        Buffer = std::move(Pending.front());
+        Pending.pop_front();
+      }
+      Out.write(reinterpret_cast<char const *>(Buffer.data()),
+                static_cast<std::streamsize>(Buffer.size()));
+      {
+        std::lock_guard Lock(Mutex);
+        Bytes += Buffer.size();
+        if (!Out && !Failed) {
+          Failed = true;
+          Pending.clear();
+          errsv("Failed to write capture <{}>, capturing stopped",
+                Path.string());
+        }
+        Free.push_back(std::move(Buffer));
+      }
+      Cv.notify_all();
+    }
+  }
+
+  std::filesystem::path Path;
+  /// Only touched by the writer thread once it runs.
+  std::ofstream Out;
+  std::mutex Mutex;
+  std::condition_variable Cv;
+  std::deque<std::vector<uint8_t>> Pending;
+  /// Written buffers, reused so that steady-state capture does not allocate.
+  std::vector<std::vector<uint8_t>> Free;
+  uint64_t Frames = 0;
+  uint64_t Bytes = sizeof(draw_capture::FileHeader);
+  uint64_t Stalls = 0;
+  /// Only touched by the thread calling add().
+  uint64_t DroppedCallbacks = 0;
+  bool Failed = false;
+  bool Stop = false;
+  std::thread Writer;
+};
+
+/// Plays a DrawCaptureWriter capture back without running any UI code. The
+/// file is mapped and the draw lists handed out use its vertex and index
+/// arrays in place, so a replayed frame costs the renderer what the
+/// original did and nothing else.
+class DrawReplay {
+public:
+  /// Throws if \p Path is not a capture with this build's vertex layout.
+  /// A capture cut short by a crash plays up to its last complete frame.
+  explicit DrawReplay(std::filesystem::path const &Path) : File(Path) {
+    std::span<uint8_t const> Bytes = File.bytes();
+    draw_capture::FileHeader Header;
+    if (Bytes.size() < sizeof(Header))
+      throw std::runtime_error(
+          fmt::format("<{}> is not a draw capture", Path.string()));
+    std::memcpy(&Header, Bytes.data(), sizeof(Header));
+    if (std::memcmp(Header.Magic, draw_capture::Magic, sizeof(Header.Magic)))
+      throw std::runtime_error(
+          fmt::format("<{}> is not a draw capture", Path.string()));
+    if (Header.Version != draw_capture::Version ||
+        Header.VertexSize != sizeof(ImDrawVert) ||
+        Header.IndexSize != sizeof(ImDrawIdx))
+      throw std::runtime_error(fmt::format(
+          "Draw capture <{}> is version {} with {}/{} byte vertices/indices, "
+          "expected version {} with {}/{}",
+          Path.string(), Header.Version, Header.VertexSize, Header.IndexSize,
+          draw_capture::Version, sizeof(ImDrawVert), sizeof(ImDrawIdx)));
+    if (Header.ImGuiVersion != IMGUI_VERSION_NUM)
+      errsv("Draw capture <{}> is from ImGui {}, this is {}", Path.string(),
+            Header.ImGuiVersion, IMGUI_VERSION_NUM);
+    FontTexture = Header.FontTexture;
+
+    size_t Offset = sizeof(Header);
+    while (Offset < Bytes.size()) {
+      if (!validFrame(Bytes.subspan(Offset))) {
+        errsv("Draw capture <{}> is truncated or damaged after frame {}",
+              Path.string(), Frames.size());
+        break;
+      }
+      Frames.push_back(Offset);
+      Offset += frameHeader(Offset).Size;
+    }
+    if (Frames.empty())
+      throw std::runtime_error(
+          fmt::format("Draw capture <{}> has no frames", Path.string()));
+    if (!Textures.empty())
+      errsv("Draw capture <{}>: {} textures besides the font atlas, drawn "
+            "with placeholders",
+            Path.string(), Textures.size());
+  }
+
+  DrawReplay(DrawReplay const &) = delete;
+  DrawReplay &operator=(DrawReplay const &) = delete;
+
+  ~DrawReplay() {
+    for (auto &List : Lists)
+      release(*List);
+  }
+
+  size_t size() const noexcept { return Frames.size(); }
+
+  /// Texture IDs of the capturing process, other than the font atlas, that
+  /// the capture draws with.
+  std::span<uint64_t const> getTextures() const noexcept { return Textures; }
+
+  /// Framebuffer size of the first frame, what the capture was rendered at.
+  ImVec2 getFramebufferSize() const {
+    draw_capture::FrameHeader Header = frameHeader(Frames.front());
+    return ImVec2(Header.DisplaySize.x * Header.FramebufferScale.x,
+                  Header.DisplaySize.y * Header.FramebufferScale.y);
+  }
+
+  /// Draw data of frame \p Index, valid until the next call. The textures
+  /// of the capturing process do not exist here: draws of the font atlas use
+  /// \p Font and draws of getTextures()[I] use \p Placeholders[I], so the
+  /// texture switches stay the same. Textures without a placeholder are
+  /// drawn with \p Font.
+  ImDrawData *frame(size_t Index, ImTextureID Font,
+                    std::span<ImTextureID const> Placeholders = {}) {
+    std::span<uint8_t const> Bytes = File.bytes();
+    size_t Offset = Frames[Index];
+    draw_capture::FrameHeader Header = frameHeader(Offset);
+    Offset += sizeof(Header);
+
+    while (Lists.size() < Header.ListCount)
+      Lists.push_back(std::make_unique<ImDrawList>(nullptr));
+    ListPointers.clear();
+    for (uint32_t I = 0; I < Header.ListCount; ++I) {
+      draw_capture::ListHeader ListHeader;
+      std::memcpy(&ListHeader, Bytes.data() + Offset, sizeof(ListHeader));
+      Offset += sizeof(ListHeader);
+
+      ImDrawList &List = *Lists[I];
+      release(List);
+      List.Flags = static_cast<ImDrawListFlags>(ListHeader.Flags);
+      List.CmdBuffer.resize(static_cast<int>(ListHeader.CmdCount));
+      for (ImDrawCmd &Cmd : List.CmdBuffer) {
+        draw_capture::Command Entry;
+        std::memcpy(&Entry, Bytes.data() + Offset, sizeof(Entry));
+        Offset += sizeof(Entry);
+        Cmd = ImDrawCmd();
+        Cmd.ClipRect = Entry.ClipRect;
+        Cmd.TextureId = Font;
+        auto Found =
+            std::lower_bound(Textures.begin(), Textures.end(), Entry.TextureId);
+        if (Found != Textures.end() && *Found == Entry.TextureId &&
+            size_t(Found - Textures.begin()) < Placeholders.size())
+          Cmd.TextureId = Placeholders[Found - Textures.begin()];
+        Cmd.VtxOffset = Entry.VtxOffset;
+        Cmd.IdxOffset = Entry.IdxOffset;
+        Cmd.ElemCount = Entry.ElemCount;
+        if (Entry.UserCallback == draw_capture::Callback::ResetRenderState)
+          Cmd.UserCallback = ImDrawCallback_ResetRenderState;
+      }
+      borrow(List.VtxBuffer, Bytes.data() + Offset, ListHeader.VtxCount);
+      Offset = draw_capture::alignUp(
+          Offset + size_t{ListHeader.VtxCount} * sizeof(ImDrawVert));
+      borrow(List.IdxBuffer, Bytes.data() + Offset, ListHeader.IdxCount);
+      Offset += size_t{ListHeader.IdxCount} * sizeof(ImDrawIdx);
+      Offset = draw_capture::alignUp(Offset);
+      ListPointers.push_back(&List);
+    }
+
+    Data = ImDrawData();
+    Data.Valid = true;
+    Data.CmdListsCount = static_cast<int>(Header.ListCount);
+    Data.TotalVtxCount = static_cast<int>(Header.TotalVtxCount);
+    Data.TotalIdxCount = static_cast<int>(Header.TotalIdxCount);
+    Data.CmdLists = ListPointers.data();
+    Data.DisplayPos = Header.DisplayPos;
+    Data.DisplaySize = Header.DisplaySize;
+    Data.FramebufferScale = Header.FramebufferScale;
+#ifdef IMGUI_HAS_VIEWPORT
+    // The backend finds its buffers through the viewport
+    Data.OwnerViewport = ImGui::GetMainViewport();
+#endif
+    return &Data;
+  }
+
+private:
+  draw_capture::FrameHeader frameHeader(size_t Offset) const {
+    draw_capture::FrameHeader Header;
+    std::memcpy(&Header, File.bytes().data() + Offset, sizeof(Header));
+    return Header;
+  }
+
+  /// Bounds-checks a frame once at load, including every index, so that
+  /// frame() can trust the file and a damaged capture cannot make the GPU
+  /// read outside the vertex buffer. Adds the textures of a valid frame to
+  /// Textures.
+  bool validFrame(std::span<uint8_t const> Bytes) {
+    draw_capture::FrameHeader Header;
+    if (Bytes.size() < sizeof(Header))
+      return false;
+    std::memcpy(&Header, Bytes.data(), sizeof(Header));
+    if (Header.Size < sizeof(Header) || Header.Size > Bytes.size())
+      return false;
+    Bytes = Bytes.first(Header.Size);
+    size_t Offset = sizeof(Header);
+    uint64_t VtxTotal = 0;
+    uint64_t IdxTotal = 0;
+    std::vector<uint64_t> FrameTextures;
+    for (uint32_t I = 0; I < Header.ListCount; ++I) {
+      draw_capture::ListHeader List;
+      if (Bytes.size() - Offset < sizeof(List))
+        return false;
+      std::memcpy(&List, Bytes.data() + Offset, sizeof(List));
+      size_t CmdStart = Offset + sizeof(List);
+      size_t IdxStart = draw_capture::alignUp(
+          CmdStart + size_t{List.CmdCount} * sizeof(draw_capture::Command) +
+          size_t{List.VtxCount} * sizeof(ImDrawVert));
+      size_t End = draw_capture::alignUp(
+          IdxStart + size_t{List.IdxCount} * sizeof(ImDrawIdx));
+      if (End > Bytes.size())
+        return false;
+      for (uint32_t C = 0; C < List.CmdCount; ++C) {
+        draw_capture::Command Cmd;
+        std::memcpy(&Cmd, Bytes.data() + CmdStart + C * sizeof(Cmd),
+                    sizeof(Cmd));
+        if (uint64_t{Cmd.IdxOffset} + Cmd.ElemCount > List.IdxCount)
+          return false;
+        for (uint32_t E = 0; E < Cmd.ElemCount; ++E) {
+          ImDrawIdx Index;
+          std::memcpy(&Index,
+                      Bytes.data() + IdxStart +
+                          (size_t{Cmd.IdxOffset} + E) * sizeof(ImDrawIdx),
+                      sizeof(Index));
+          if (uint64_t{Cmd.VtxOffset} + Index >= List.VtxCount)
+            return false;
+        }
+        if (Cmd.ElemCount != 0 && Cmd.TextureId != FontTexture)
+          FrameTextures.push_back(Cmd.TextureId);
+      }
+      Offset = End;
+      VtxTotal += List.VtxCount;
+      IdxTotal += List.IdxCount;
+    }
+    if (Offset != Bytes.size() || VtxTotal != Header.TotalVtxCount ||
+        IdxTotal != Header.TotalIdxCount)
+      return false;
+    for (uint64_t Texture : FrameTextures) {
+      auto Found = std::lower_bound(Textures.begin(), Textures.end(), Texture);
+      if (Found == Textures.end() || *Found != Texture)
+        Textures.insert(Found, Texture);
+    }
+    return true;
+  }
+
+  /// Points \p Vector at mapped memory; it must be released before ImGui
+  /// gets to free or grow it.
+  template <typename T>
+  static void borrow(ImVector<T> &Vector, uint8_t const *Data, uint32_t Size) {
+    Vector.Data = reinterpret_cast<T *>(const_cast<uint8_t *>(Data));
+    Vector.Size = Vector.Capacity = static_cast<int>(Size);
+  }
+
+  static void release(ImDrawList &List) {
+    List.VtxBuffer.Data = nullptr;
+    List.VtxBuffer.Size = List.VtxBuffer.Capacity = 0;
+    List.IdxBuffer.Data = nullptr;
+    List.IdxBuffer.Size = List.IdxBuffer.Capacity = 0;
+  }
+
+  MappedFile File;
+  /// Offset of every complete frame.
+  std::vector<size_t> Frames;
+  /// Texture ID of the font atlas in the capturing process.
+  uint64_t FontTexture = 0;
+  /// Sorted, for getTextures().
+  std::vector<uint64_t> Textures;
+  std::vector<std::unique_ptr<ImDrawList>> Lists;
+  std::vector<ImDrawList *> ListPointers;
+  ImDrawData Data;
+};
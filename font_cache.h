@@ -0,0 +1,287 @@
+#pragma once
+
+#include "format.h"
+#include "frame_skipper.h"
+#include "mapped_file.h"
+#include "profiler.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <vector>
+
+/// How the font atlas was obtained at startup.
+struct FontAtlasStats {
+  bool CacheHit = false;
+  /// Rasterizing, or loading the cache.
+  double BuildMs = 0;
+  double UploadMs = 0;
+};
+
+namespace font_cache {
+
+/// Bumped whenever the layout below changes.
+constexpr uint32_t Version = 1;
+constexpr char Magic[8] = {'I', 'M', 'F', 'A', 'T', 'L', 'A', 'S'};
+
+struct Header {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t ImGuiVersion;
+  uint64_t Key;
+  uint32_t Width;
+  uint32_t Height;
+  uint32_t FontCount;
+  uint32_t CustomRectCount;
+  ImVec2 UvScale;
+  ImVec2 UvWhitePixel;
+  ImVec4 UvLines[IM_DRAWLIST_TEX_LINES_WIDTH_MAX + 1];
+  int32_t PackIdMouseCursor;
+  int32_t PackIdLines;
+  uint32_t PixelsUseColors;
+};
+
+struct Font {
+  float FontSize;
+  float Ascent;
+  float Descent;
+  float Scale;
+  uint32_t FallbackChar;
+  uint32_t EllipsisChar;
+  uint32_t GlyphCount;
+};
+
+struct CustomRect {
+  uint16_t Width;
+  uint16_t Height;
+  uint16_t X;
+  uint16_t Y;
+  uint32_t GlyphID;
+  float GlyphAdvanceX;
+  ImVec2 GlyphOffset;
+  /// Into ImFontAtlas::Fonts, -1 for none.
+  int32_t FontIndex;
+};
+
+/// Identifies everything Build() reads: layout sizes, atlas settings and,
+/// per font config, its settings, glyph ranges and the font file's bytes.
+inline uint64_t atlasKey(ImFontAtlas const &Atlas) {
+  uint64_t Key = hashValue(Version, 0xcbf29ce484222325ull);
+  Key = hashValue(IMGUI_VERSION_NUM, Key);
+  Key = hashValue(sizeof(ImFontGlyph), Key);
+  Key = hashValue(sizeof(ImFontAtlasCustomRect), Key);
+  Key = hashValue(Atlas.Flags, Key);
+  Key = hashValue(Atlas.TexDesiredWidth, Key);
+  Key = hashValue(Atlas.TexGlyphPadding, Key);
+  Key = hashValue(Atlas.FontBuilderFlags, Key);
+  for (ImFontConfig const &Config : Atlas.ConfigData) {
+    Key = hashBytes(Config.FontData, static_cast<size_t>(Config.FontDataSize),
+                    Key);
+    Key = hashValue(Config.FontNo, Key);
+    Key = hashValue(Config.SizePixels, Key);
+    Key = hashValue(Config.OversampleH, Key);
+    Key = hashValue(Config.OversampleV, Key);
+    Key = hashValue(Config.PixelSnapH, Key);
+    Key = hashValue(Config.GlyphExtraSpacing, Key);
+    Key = hashValue(Config.GlyphOffset, Key);
+    Key = hashValue(Config.GlyphMinAdvanceX, Key);
+    Key = hashValue(Config.GlyphMaxAdvanceX, Key);
+    Key = hashValue(Config.MergeMode, Key);
+    Key = hashValue(Config.FontBuilderFlags, Key);
+    Key = hashValue(Config.RasterizerMultiply, Key);
+    Key = hashValue(Config.EllipsisChar, Key);
+    for (ImWchar const *Range = Config.GlyphRanges; Range && *Range; ++Range)
+      Key = hashValue(*Range, Key);
+  }
+  return Key;
+}
+
+// Only some ImGui versions have these; set them where they exist
+template <typename A>
+auto markTexReady(A &Atlas, int) -> decltype(Atlas.TexReady = true, void()) {
+  Atlas.TexReady = true;
+}
+template <typename A> void markTexReady(A &, long) {}
+
+/// Restores a built atlas from \p Bytes into \p Atlas, whose fonts have
+/// been added but not built. Returns false, leaving the atlas alone, if the
+/// data is not for this atlas.
+inline bool restore(ImFontAtlas &Atlas, std::span<uint8_t const> Bytes,
+                    uint64_t Key) {
+  Header H;
+  if (Bytes.size() < sizeof(H))
+    return false;
+  std::memcpy(&H, Bytes.data(), sizeof(H));
+  if (std::memcmp(H.Magic, Magic, sizeof(Magic)) != 0 ||
+      H.Version != Version || H.ImGuiVersion != IMGUI_VERSION_NUM ||
+      H.Key != Key || H.FontCount != static_cast<uint32_t>(Atlas.Fonts.Size))
+    return false;
+
+  // Validate all sizes before touching the atlas
+  size_t Offset = sizeof(H);
+  std::vector<Font> Fonts(H.FontCount);
+  std::vector<size_t> GlyphOffsets(H.FontCount);
+  for (uint32_t I = 0; I < H.FontCount; ++I) {
+    if (Bytes.size() - Offset < sizeof(Font))
+      return false;
+    std::memcpy(&Fonts[I], Bytes.data() + Offset, sizeof(Font));
+    Offset += sizeof(Font);
+    GlyphOffsets[I] = Offset;
+    size_t GlyphBytes = size_t{Fonts[I].GlyphCount} * sizeof(ImFontGlyph);
+    if (Bytes.size() - Offset < GlyphBytes)
+      return false;
+    Offset += GlyphBytes;
+  }
+  size_t RectsOffset = Offset;
+  Offset += size_t{H.CustomRectCount} * sizeof(CustomRect);
+  size_t PixelBytes = size_t{H.Width} * H.Height * 4;
+  if (Offset > Bytes.size() || Bytes.size() - Offset != PixelBytes ||
+      PixelBytes == 0)
+    return false;
+
+  for (uint32_t I = 0; I < H.FontCount; ++I) {
+    ImFont &Dst = *Atlas.Fonts[static_cast<int>(I)];
+    Font const &Src = Fonts[I];
+    Dst.FontSize = Src.FontSize;
+    Dst.Ascent = Src.Ascent;
+    Dst.Descent = Src.Descent;
+    Dst.Scale = Src.Scale;
+    Dst.FallbackChar = static_cast<ImWchar>(Src.FallbackChar);
+    Dst.EllipsisChar = static_cast<ImWchar>(Src.EllipsisChar);
+    Dst.Glyphs.resize(static_cast<int>(Src.GlyphCount));
+    std::memcpy(Dst.Glyphs.Data, Bytes.data() + GlyphOffsets[I],
+                size_t{Src.GlyphCount} * sizeof(ImFontGlyph));
+    Dst.BuildLookupTable();
+  }
+
+  Atlas.CustomRects.resize(static_cast<int>(H.CustomRectCount));
+  for (uint32_t I = 0; I < H.CustomRectCount; ++I) {
+    CustomRect Src;
+    std::memcpy(&Src, Bytes.data() + RectsOffset + I * sizeof(Src),
+                sizeof(Src));
+    ImFontAtlasCustomRect &Dst = Atlas.CustomRects[static_cast<int>(I)];
+    Dst.Width = Src.Width;
+    Dst.Height = Src.Height;
+    Dst.X = Src.X;
+    Dst.Y = Src.Y;
+    Dst.GlyphID = Src.GlyphID;
+    Dst.GlyphAdvanceX = Src.GlyphAdvanceX;
+    Dst.GlyphOffset = Src.GlyphOffset;
+    Dst.Font = Src.FontIndex >= 0 && Src.FontIndex < Atlas.Fonts.Size
+                   ? Atlas.Fonts[Src.FontIndex]
+                   : nullptr;
+  }
+  Atlas.PackIdMouseCursor = H.PackIdMouseCursor;
+  Atlas.PackIdLines = H.PackIdLines;
+  Atlas.TexWidth = static_cast<int>(H.Width);
+  Atlas.TexHeight = static_cast<int>(H.Height);
+  Atlas.TexUvScale = H.UvScale;
+  Atlas.TexUvWhitePixel = H.UvWhitePixel;
+  std::memcpy(Atlas.TexUvLines, H.UvLines, sizeof(H.UvLines));
+  Atlas.TexPixelsUseColors = H.PixelsUseColors != 0;
+  // ImGui frees the pixels itself, so they need its allocator
+  Atlas.TexPixelsRGBA32 = static_cast<unsigned *>(IM_ALLOC(PixelBytes));
+  std::memcpy(Atlas.TexPixelsRGBA32, Bytes.data() + Offset, PixelBytes);
+  markTexReady(Atlas, 0);
+  return true;
+}
+
+/// Serializes the built \p Atlas, written to a temporary and renamed so a
+/// crash never leaves a torn cache.
+inline void save(ImFontAtlas &Atlas, std::filesystem::path const &Path,
+                 uint64_t Key) {
+  unsigned char *Pixels;
+  int Width, Height;
+  Atlas.GetTexDataAsRGBA32(&Pixels, &Width, &Height);
+
+  Header H = {};
+  std::memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = Version;
+  H.ImGuiVersion = IMGUI_VERSION_NUM;
+  H.Key = Key;
+  H.Width = static_cast<uint32_t>(Width);
+  H.Height = static_cast<uint32_t>(Height);
+  H.FontCount = static_cast<uint32_t>(Atlas.Fonts.Size);
+  H.CustomRectCount = static_cast<uint32_t>(Atlas.CustomRects.Size);
+  H.UvScale = Atlas.TexUvScale;
+  H.UvWhitePixel = Atlas.TexUvWhitePixel;
+  std::memcpy(H.UvLines, Atlas.TexUvLines, sizeof(H.UvLines));
+  H.PackIdMouseCursor = Atlas.PackIdMouseCursor;
+  H.PackIdLines = Atlas.PackIdLines;
+  H.PixelsUseColors = Atlas.TexPixelsUseColors;
+
+  std::filesystem::path TmpPath = Path;
+  TmpPath += ".tmp";
+  {
+    std::ofstream Out(TmpPath, std::ios::binary | std::ios::trunc);
+    auto Write = [&Out](void const *Data, size_t Size) {
+      Out.write(static_cast<char const *>(Data),
+                static_cast<std::streamsize>(Size));
+    };
+    Write(&H, sizeof(H));
+    for (ImFont const *F : Atlas.Fonts) {
+      Font Entry = {F->FontSize,     F->Ascent,
+                    F->Descent,      F->Scale,
+                    F->FallbackChar, F->EllipsisChar,
+                    static_cast<uint32_t>(F->Glyphs.Size)};
+      Write(&Entry, sizeof(Entry));
+      Write(F->Glyphs.Data, size_t(F->Glyphs.Size) * sizeof(ImFontGlyph));
+    }
+    for (ImFontAtlasCustomRect const &R : Atlas.CustomRects) {
+      auto Found = std::find(Atlas.Fonts.begin(), Atlas.Fonts.end(), R.Font);
+      CustomRect Entry = {R.Width,   R.Height,        R.X,
+                          R.Y,       R.GlyphID,       R.GlyphAdvanceX,
+                          R.GlyphOffset, /*FontIndex=*/-1};
+      if (R.Font && Found != Atlas.Fonts.end())
+        Entry.FontIndex = static_cast<int32_t>(Found - Atlas.Fonts.begin());
+      Write(&Entry, sizeof(Entry));
+    }
+    Write(Pixels, size_t(Width) * Height * 4);
+    Out.flush();
+    if (!Out) {
+      errsv("Failed to write font atlas cache <{}>", TmpPath.string());
+      std::error_code Ignored;
+      std::filesystem::remove(TmpPath, Ignored);
+      return;
+    }
+  }
+  std::error_code Err;
+  std::filesystem::rename(TmpPath, Path, Err);
+  if (Err)
+    errsv("Failed to replace font atlas cache <{}>: {}", Path.string(),
+          Err.message());
+}
+
+} // namespace font_cache
+
+/// Makes the RGBA32 pixels of \p Atlas available, from the cache at \p Path
+/// if it was built from the same fonts, sizes and glyph ranges, else by
+/// building the atlas and rewriting the cache. Fonts must have been added,
+/// the default font is added if there are none.
+inline FontAtlasStats loadOrBuildFontAtlas(ImFontAtlas &Atlas,
+                                           std::filesystem::path const &Path) {
+  FontAtlasStats Stats;
+  Clock::time_point Start = Clock::now();
+  if (Atlas.ConfigData.empty())
+    Atlas.AddFontDefault();
+  uint64_t Key = font_cache::atlasKey(Atlas);
+  {
+    MappedFile File(Path);
+    Stats.CacheHit = font_cache::restore(Atlas, File.bytes(), Key);
+  }
+  if (!Stats.CacheHit) {
+    Atlas.Build();
+    font_cache::save(Atlas, Path, Key);
+  }
+  Stats.BuildMs = millisecondsBetween(Start, Clock::now());
+  errsv("Font atlas cache {} <{}>: {} in {:.3f} ms",
+        Stats.CacheHit ? "hit" : "miss", Path.string(),
+        Stats.CacheHit ? "loaded" : "built", Stats.BuildMs);
+  return Stats;
+}
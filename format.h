@@ -1,14 +1,48 @@
 #pragma once
 
+#include "async_log.h"
+
 #include <fmt/core.h>
 
 #include <iostream>
+#include <string>
+#include <string_view>
 
 auto& errs() {
   return std::cerr;
 }
 
+/// Logs one line to stderr through AsyncLog; formatting and the write
+/// happen on the log's drain thread.
 template<typename... Ts>
-constexpr void errsv(fmt::format_string<Ts...> Fmt, Ts&&... T) {
-  errs() << fmt::format(Fmt, std::forward<Ts>(T)...) << std::endl;
+void errsv(fmt::format_string<Ts...> Fmt, Ts&&... T) {
+  AsyncLog::get().write(Fmt, std::forward<Ts>(T)...);
+}
+
+/// Escapes \p Str for use inside a JSON string literal.
+inline std::string jsonEscape(std::string_view Str) {
+  std::string Result;
+  Result.reserve(Str.size());
+  for (char C : Str) {
+    switch (C) {
+    case '"':
+      Result += "\\\"";
+      break;
+    case '\\':
+      Result += "\\\\";
+      break;
+    case '\n':
+      Result += "\\n";
+      break;
+    case '\t':
+      Result += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(C) < 0x20)
+        Result += fmt::format("\\u{:04x}", static_cast<unsigned>(C));
+      else
+        Result += C;
+    }
+  }
+  return Result;
 }
@@ -0,0 +1,444 @@
+#pragma once
+
+#include "font_cache.h"
+#include "format.h"
+#include "vulkan_context.h"
+
+#include <imgui.h>
+#include <imgui_impl_vulkan.h>
+
+#include <chrono>
+#include <future>
+#include <span>
+#include <utility>
+#include <vector>
+
+/// CPU wall time spent in the phases of one frame, in milliseconds.
+/// frameRender and framePresent fill in their own phases; Build covers
+/// ImGui::NewFrame through ImGui::Render and is up to the caller.
+struct FrameTimings {
+  double Build = 0;
+  /// Swapchain acquire plus the wait for the frame that last used the slot.
+  double Wait = 0;
+  double Record = 0;
+  double Submit = 0;
+  double Present = 0;
+};
+
+inline void checkVkResult(VkResult Err) {
+  if (Err == 0)
+    return;
+  errsv("[vulkan] Error: VkResult = {}", Err);
+  throw std::runtime_error("Caught vulkan error");
+}
+
+/// Renders one frame into every window of the context: window I draws
+/// \p DrawData[I], and windows without draw data, minimized or waiting for a
+/// swapchain rebuild are left alone. All windows are recorded into the frame
+/// slot's command buffer and go out in a single submit, so the per-window
+/// cost is an acquire and a render pass; framePresent then presents them
+/// together.
+inline void frameRender(VulkanContext &Vulkan,
+                        std::span<ImDrawData *const> DrawData,
+                        FrameTimings *Timings = nullptr) {
+  auto &Profiler = Vulkan.getProfiler();
+  // Hand finished uploads out and queue newly recorded ones ahead of the
+  // frame's own submit
+  {
+    auto Zone = Profiler.zone("uploads");
+    Vulkan.getUploads().submit();
+  }
+
+  // Raw calls go through the device's dispatch table like vulkan.hpp's
+  auto const &Dispatch = VULKAN_HPP_DEFAULT_DISPATCHER;
+  VkResult Err;
+  Clock::time_point Start = Clock::now();
+  auto &Offscreen = Vulkan.getOffscreenTarget();
+  FrameSlot &Slot = Vulkan.getFrameRing().current();
+  uint32_t SlotIndex = Vulkan.getFrameRing().currentIndex();
+
+  // Bound the CPU by the frame queue: wait for the frame that last used this
+  // slot, whichever swapchain image it rendered to
+  Vulkan.getFrameRing().waitCurrent(Vulkan.getDevice());
+  Vulkan.collectRetiredSwapchains();
+  Clock::time_point AcquireStart = Clock::now();
+
+  // Headless frames have no swapchain image to acquire and nothing to wait
+  // on. A window whose swapchain is out of date sits this frame out.
+  std::vector<std::pair<PresentWindow *, ImDrawData *>> Targets;
+  std::vector<PresentWindow *> const &Windows = Vulkan.getWindows();
+  for (size_t I = 0; I < Windows.size() && I < DrawData.size(); ++I) {
+    PresentWindow &Window = *Windows[I];
+    ImDrawData *Data = DrawData[I];
+    if (!Data || Data->DisplaySize.x <= 0.0f || Data->DisplaySize.y <= 0.0f)
+      continue;
+    if (!Offscreen) {
+      if (Window.Rebuild)
+        continue;
+      Err = Dispatch.vkAcquireNextImageKHR(
+          Vulkan.getDevice(), Window.Data.Swapchain, UINT64_MAX,
+          Window.ImageAcquired[SlotIndex], VK_NULL_HANDLE,
+          &Window.Data.FrameIndex);
+      if (Err == VK_ERROR_OUT_OF_DATE_KHR) {
+        Window.Rebuild = true;
+        continue;
+      }
+      // A suboptimal image is still acquired and its semaphore signaled, so
+      // render and present it; framePresent flags the rebuild.
+      if (Err != VK_SUBOPTIMAL_KHR)
+        checkVkResult(Err);
+      Window.PendingPresent = true;
+    }
+    Targets.emplace_back(&Window, Data);
+  }
+  if (Targets.empty())
+    return;
+
+  Clock::time_point RecordStart = Clock::now();
+  {
+    Err = Dispatch.vkResetCommandPool(Vulkan.getDevice(), Slot.CommandPool,
+                                      0);
+    checkVkResult(Err);
+    VkCommandBufferBeginInfo Info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    Err = Dispatch.vkBeginCommandBuffer(Slot.CommandBuffer, &Info);
+    checkVkResult(Err);
+    Profiler.beginGpuFrame(Slot.CommandBuffer);
+  }
+  // Render layers and the profiler's UI marks belong to the main window
+  PresentWindow *Main = &Vulkan.getMainWindow();
+  auto &Layers = Vulkan.getRenderLayers();
+  for (auto [Window, Data] : Targets) {
+    auto &Wd = Window->Data;
+    // Only the framebuffer is tied to the swapchain image
+    VkFramebuffer Framebuffer = Wd.Frames[Wd.FrameIndex].Framebuffer;
+    bool WithLayers = Window == Main && !Layers.empty();
+    {
+      VkRenderPassBeginInfo Info = {
+          .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+          .renderPass = Wd.RenderPass,
+          .framebuffer = Framebuffer,
+          .clearValueCount = 1,
+          .pClearValues = &Main->Data.ClearValue};
+      Info.renderArea.extent.width = Wd.Width;
+      Info.renderArea.extent.height = Wd.Height;
+      Dispatch.vkCmdBeginRenderPass(
+          Slot.CommandBuffer, &Info,
+          WithLayers ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                     : VK_SUBPASS_CONTENTS_INLINE);
+    }
+
+    // Record dear imgui primitives into command buffer
+    auto RecordUi = [&, Window = Window, Data = Data](
+                        vk::CommandBuffer CommandBuffer, vk::Extent2D) {
+      if (Window == Main)
+        Profiler.mark(CommandBuffer, GpuMark::ImGuiBegin);
+      ImGui_ImplVulkan_RenderDrawData(Data, CommandBuffer);
+      if (Window == Main)
+        Profiler.mark(CommandBuffer, GpuMark::ImGuiEnd);
+    };
+    if (!WithLayers) {
+      RecordUi(Slot.CommandBuffer, {});
+    } else {
+      // The layers are recorded on the workers while this thread records
+      // the UI; the primary then only executes them, the UI on top
+      vk::CommandBufferInheritanceInfo Inheritance(Wd.RenderPass, 0,
+                                                   Framebuffer);
+      std::vector<vk::CommandBuffer> Secondaries =
+          Vulkan.getRecordPool().record(SlotIndex, Inheritance,
+                                        {static_cast<uint32_t>(Wd.Width),
+                                         static_cast<uint32_t>(Wd.Height)},
+                                        Layers, RecordUi);
+      vk::CommandBuffer(Slot.CommandBuffer).executeCommands(Secondaries);
+    }
+    Dispatch.vkCmdEndRenderPass(Slot.CommandBuffer);
+  }
+
+  // Submit command buffer
+  Profiler.mark(Slot.CommandBuffer, GpuMark::RenderPassEnd);
+  if (Offscreen && Offscreen->ReadbackEnabled)
+    recordOffscreenReadback(*Offscreen, Slot.CommandBuffer);
+  {
+    Err = Dispatch.vkEndCommandBuffer(Slot.CommandBuffer);
+    checkVkResult(Err);
+    Clock::time_point SubmitStart = Clock::now();
+
+    // The simulation step this frame shows goes to the compute queue first;
+    // the frame ring adds the frame's own signal
+    ComputeSync Compute = Vulkan.getSimulation().submit(SlotIndex);
+    std::vector<SemaphoreOp> Waits;
+    std::vector<SemaphoreOp> Signals;
+    if (!Offscreen) {
+      for (auto [Window, Data] : Targets) {
+        Waits.push_back({Window->ImageAcquired[SlotIndex], 0,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT});
+        Signals.push_back({Window->RenderComplete[Window->Data.FrameIndex]});
+      }
+    }
+    if (Compute.Wait)
+      Waits.push_back({static_cast<VkSemaphore>(Compute.Wait),
+                       Compute.WaitValue,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT});
+    if (Compute.Signal)
+      Signals.push_back(
+          {static_cast<VkSemaphore>(Compute.Signal), Compute.SignalValue});
+    Profiler.markSubmit();
+    Vulkan.getFrameRing().submit(Vulkan.getDevice(), Vulkan.getQueue(), Waits,
+                                 Signals);
+    Clock::time_point SubmitEnd = Clock::now();
+
+    Profiler.addCpuZone("frame wait", Start, AcquireStart);
+    Profiler.addCpuZone("acquire", AcquireStart, RecordStart);
+    Profiler.addCpuZone("record", RecordStart, SubmitStart);
+    Profiler.addCpuZone("submit", SubmitStart, SubmitEnd);
+    if (Timings) {
+      Timings->Wait = millisecondsBetween(Start, RecordStart);
+      Timings->Record = millisecondsBetween(RecordStart, SubmitStart);
+      Timings->Submit = millisecondsBetween(SubmitStart, SubmitEnd);
+    }
+  }
+}
+
+/// Single window (or headless) frame.
+inline void frameRender(VulkanContext &Vulkan, ImDrawData *DrawData,
+                        FrameTimings *Timings = nullptr) {
+  frameRender(Vulkan, std::span<ImDrawData *const>(&DrawData, 1), Timings);
+}
+
+/// Presents every window frameRender rendered with one vkQueuePresentKHR.
+/// Windows whose swapchain turned out of date or suboptimal are flagged for
+/// rebuildSwapChain; the others are shown regardless.
+inline void framePresent(VulkanContext &Vulkan,
+                         FrameTimings *Timings = nullptr) {
+  if (Vulkan.getOffscreenTarget())
+    return;
+  Clock::time_point Start = Clock::now();
+  std::vector<PresentWindow *> Presented;
+  std::vector<VkSemaphore> WaitSemaphores;
+  std::vector<VkSwapchainKHR> Swapchains;
+  std::vector<uint32_t> ImageIndices;
+  for (PresentWindow *Window : Vulkan.getWindows()) {
+    if (!Window->PendingPresent)
+      continue;
+    Window->PendingPresent = false;
+    Presented.push_back(Window);
+    WaitSemaphores.push_back(Window->RenderComplete[Window->Data.FrameIndex]);
+    Swapchains.push_back(Window->Data.Swapchain);
+    ImageIndices.push_back(Window->Data.FrameIndex);
+  }
+  if (Presented.empty())
+    return;
+  std::vector<VkResult> Results(Presented.size(), VK_SUCCESS);
+
+  VkPresentInfoKHR Info = {
+      .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+      .waitSemaphoreCount = static_cast<uint32_t>(WaitSemaphores.size()),
+      .pWaitSemaphores = WaitSemaphores.data(),
+      .swapchainCount = static_cast<uint32_t>(Swapchains.size()),
+      .pSwapchains = Swapchains.data(),
+      .pImageIndices = ImageIndices.data(),
+      .pResults = Results.data()};
+
+  VkResult Err =
+      VULKAN_HPP_DEFAULT_DISPATCHER.vkQueuePresentKHR(Vulkan.getQueue(), &Info);
+  Clock::time_point End = Clock::now();
+  Vulkan.getProfiler().addCpuZone("present", Start, End);
+  if (Timings)
+    Timings->Present = millisecondsBetween(Start, End);
+  for (size_t I = 0; I < Presented.size(); ++I) {
+    if (Results[I] == VK_ERROR_OUT_OF_DATE_KHR ||
+        Results[I] == VK_SUBOPTIMAL_KHR)
+      Presented[I]->Rebuild = true;
+    else
+      checkVkResult(Results[I]);
+  }
+  if (Err != VK_ERROR_OUT_OF_DATE_KHR && Err != VK_SUBOPTIMAL_KHR)
+    checkVkResult(Err);
+}
+
+/// Creates the ImGui Vulkan backend and uploads the font atlas, taken from
+/// the cache at \p FontCachePath when the fonts added so far match it.
+inline FontAtlasStats
+initImGuiVulkan(VulkanContext &Vulkan,
+                std::filesystem::path const &FontCachePath = "font_atlas.bin") {
+  ImGui_ImplVulkan_InitInfo InitInfo = {
+      .Instance = Vulkan.getInstance(),
+      .PhysicalDevice = Vulkan.getPhysicalDevice(),
+      .Device = Vulkan.getDevice(),
+      .QueueFamily = Vulkan.getQueueFamilyIndex(),
+      .Queue = Vulkan.getQueue(),
+      .PipelineCache = Vulkan.getPipelineCache(),
+      .DescriptorPool = Vulkan.getDescriptorPool(),
+      .Subpass = 0,
+      .MinImageCount = Vulkan.getMinImageCount(),
+      .ImageCount = Vulkan.getRenderBufferCount(),
+      .MSAASamples = VK_SAMPLE_COUNT_1_BIT,
+      .Allocator = reinterpret_cast<VkAllocationCallbacks const *>(
+          &Vulkan.getAllocationCallbacks()),
+      .CheckVkResultFn = checkVkResult};
+
+  // The backend is built with IMGUI_IMPL_VULKAN_NO_PROTOTYPES (see
+  // CMakeLists.txt), so its per-draw calls skip the loader too
+  bool Loaded = ImGui_ImplVulkan_LoadFunctions(
+      [](char const *Name, void *UserData) {
+        return static_cast<VulkanContext *>(UserData)->getProcAddr(Name);
+      },
+      &Vulkan);
+  if (!Loaded)
+    throw std::runtime_error("Failed to load the ImGui Vulkan functions");
+
+  {
+    Clock::time_point Start = Clock::now();
+    ImGui_ImplVulkan_Init(&InitInfo, Vulkan.getMainWindowData().RenderPass);
+    errsv("ImGui pipelines created in {:.3f} ms",
+          millisecondsBetween(Start, Clock::now()));
+  }
+
+  // Upload Fonts through the upload service, waiting on that upload alone
+  // rather than on the whole device
+  FontAtlasStats Stats;
+  {
+    Clock::time_point Start = Clock::now();
+    ImGuiIO &Io = ImGui::GetIO();
+    Stats = loadOrBuildFontAtlas(*Io.Fonts, FontCachePath);
+    Clock::time_point UploadStart = Clock::now();
+    unsigned char *Pixels;
+    int Width, Height;
+    Io.Fonts->GetTexDataAsRGBA32(&Pixels, &Width, &Height);
+    UploadService &Uploads = Vulkan.getUploads();
+    std::future<UploadedImage> Font = Uploads.uploadImage(
+        {Pixels, Pixels + size_t(Width) * Height * 4},
+        static_cast<uint32_t>(Width), static_cast<uint32_t>(Height));
+    Uploads.finish();
+    Vulkan.getFontImage() = Font.get();
+    Io.Fonts->SetTexID(reinterpret_cast<ImTextureID>(
+        ImGui_ImplVulkan_AddTexture(Uploads.getSampler(),
+                                    Vulkan.getFontImage().View,
+                                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)));
+    Clock::time_point End = Clock::now();
+    Stats.UploadMs = millisecondsBetween(UploadStart, End);
+    errsv("Font atlas {}x{} ready in {:.3f} ms ({} start: {} in {:.3f} ms, "
+          "uploaded in {:.3f} ms)",
+          Width, Height, millisecondsBetween(Start, End),
+          Stats.CacheHit ? "warm" : "cold",
+          Stats.CacheHit ? "loaded" : "built", Stats.BuildMs, Stats.UploadMs);
+  }
+  return Stats;
+}
+
+inline void setClearColor(VulkanContext &Vulkan,
+                          ImVec4 const &ClearColor) {
+  auto &ClearValue = Vulkan.getMainWindowData().ClearValue;
+  ClearValue.color.float32[0] = ClearColor.x * ClearColor.w;
+  ClearValue.color.float32[1] = ClearColor.y * ClearColor.w;
+  ClearValue.color.float32[2] = ClearColor.z * ClearColor.w;
+  ClearValue.color.float32[3] = ClearColor.w;
+}
+
+/// Recreates the swapchains frameRender or framePresent flagged as out of
+/// date: the main window's at \p Width x \p Height, the others at their
+/// PresentWindow::RequestedWidth/Height. Minimized windows are skipped.
+inline void rebuildSwapChain(VulkanContext &Vulkan, int Width, int Height) {
+  for (PresentWindow *Window : Vulkan.getWindows()) {
+    if (!Window->Rebuild)
+      continue;
+    bool IsMain = Window == &Vulkan.getMainWindow();
+    int W = IsMain ? Width : Window->RequestedWidth;
+    int H = IsMain ? Height : Window->RequestedHeight;
+    if (W <= 0 || H <= 0)
+      continue;
+    ImGui_ImplVulkan_SetMinImageCount(Vulkan.getMinImageCount());
+    Vulkan.createOrResizeSwapchain(*Window, W, H);
+    Window->Rebuild = false;
+  }
+}
+
+#ifdef IMGUI_HAS_VIEWPORT
+namespace viewports {
+
+inline VulkanContext *Context = nullptr;
+inline void (*BackendDestroyWindow)(ImGuiViewport *) = nullptr;
+
+inline PresentWindow *findWindow(ImGuiViewport *Viewport) {
+  for (PresentWindow *Window : Context->getWindows())
+    if (Window->UserData == Viewport)
+      return Window;
+  return nullptr;
+}
+
+inline void createWindow(ImGuiViewport *Viewport) {
+  VkSurfaceKHR Surface = VK_NULL_HANDLE;
+  if (ImGui::GetPlatformIO().Platform_CreateVkSurface(
+          Viewport, reinterpret_cast<ImU64>(
+                        static_cast<VkInstance>(Context->getInstance())),
+          nullptr, reinterpret_cast<ImU64 *>(&Surface)) != VK_SUCCESS) {
+    errsv("Failed to create a Vulkan surface for a viewport");
+    return;
+  }
+  try {
+    PresentWindow &Window =
+        Context->addWindow(Surface, static_cast<int>(Viewport->Size.x),
+                           static_cast<int>(Viewport->Size.y));
+    Window.UserData = Viewport;
+    // ImGui_ImplVulkan_RenderDrawData takes its vertex buffers from here;
+    // all windows share the main viewport's ring (see getRenderBufferCount)
+    Viewport->RendererUserData = ImGui::GetMainViewport()->RendererUserData;
+  } catch (std::exception &E) {
+    errsv("Failed to create a viewport window: {}", E.what());
+  }
+}
+
+inline void destroyWindow(ImGuiViewport *Viewport) {
+  PresentWindow *Window = findWindow(Viewport);
+  if (!Window || Window == &Context->getMainWindow()) {
+    if (BackendDestroyWindow)
+      BackendDestroyWindow(Viewport);
+    return;
+  }
+  Context->removeWindow(*Window);
+  Viewport->RendererUserData = nullptr;
+}
+
+inline void setWindowSize(ImGuiViewport *Viewport, ImVec2 Size) {
+  if (PresentWindow *Window = findWindow(Viewport)) {
+    Window->RequestedWidth = static_cast<int>(Size.x);
+    Window->RequestedHeight = static_cast<int>(Size.y);
+    Window->Rebuild = true;
+  }
+}
+
+} // namespace viewports
+
+/// Makes ImGui's platform windows windows of \p Vulkan, so that frameRender
+/// and framePresent batch them with the main window instead of the backend
+/// submitting and presenting each viewport on its own. Call after
+/// initImGuiVulkan with ImGuiConfigFlags_ViewportsEnable set; then, each
+/// frame, ImGui::UpdatePlatformWindows and frameRender with
+/// viewportDrawData, without ImGui::RenderPlatformWindowsDefault.
+inline void installViewportRenderer(VulkanContext &Vulkan) {
+  viewports::Context = &Vulkan;
+  Vulkan.getMainWindow().UserData = ImGui::GetMainViewport();
+  ImGuiPlatformIO &PlatformIo = ImGui::GetPlatformIO();
+  viewports::BackendDestroyWindow = PlatformIo.Renderer_DestroyWindow;
+  PlatformIo.Renderer_CreateWindow = &viewports::createWindow;
+  PlatformIo.Renderer_DestroyWindow = &viewports::destroyWindow;
+  PlatformIo.Renderer_SetWindowSize = &viewports::setWindowSize;
+  PlatformIo.Renderer_RenderWindow = nullptr;
+  PlatformIo.Renderer_SwapBuffers = nullptr;
+}
+
+/// Draw data of every window of \p Vulkan in getWindows() order, null for
+/// minimized viewports.
+inline std::vector<ImDrawData *> viewportDrawData(VulkanContext &Vulkan) {
+  std::vector<ImDrawData *> DrawData;
+  for (PresentWindow *Window : Vulkan.getWindows()) {
+    auto *Viewport = static_cast<ImGuiViewport *>(Window->UserData);
+    DrawData.push_back(Viewport && !(Viewport->Flags &
+                                     ImGuiViewportFlags_Minimized)
+                           ? Viewport->DrawData
+                           : nullptr);
+  }
+  return DrawData;
+}
+#endif
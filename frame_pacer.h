@@ -0,0 +1,66 @@
+#pragma once
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+/// Low-latency pacing for vsync'ed present modes. In FIFO the CPU normally
+/// samples input, builds the UI and then blocks on the fence or acquire until
+/// the display catches up, so the input is already stale when the frame is
+/// shown. The pacer measures that blocked time and sleeps it away at the top
+/// of the next frame instead, so events are polled and the UI built just
+/// before the deadline. It sleeps rather than spins, so an idle core stays
+/// idle.
+class FramePacer {
+public:
+  /// Slack kept unslept to absorb scheduler wake-up jitter and frames that
+  /// take longer than the last one.
+  static constexpr double MarginMs = 1.5;
+  /// Never sleep longer than this, whatever the estimate says.
+  static constexpr double MaxSleepMs = 50.0;
+
+  void setEnabled(bool Enable) noexcept {
+    Enabled = Enable;
+    PredictedSlackMs = 0;
+    LastSleepMs = 0;
+  }
+  bool isEnabled() const noexcept { return Enabled; }
+
+  /// Call at the very top of the frame, before polling input.
+  void sleep() {
+    LastSleepMs = 0;
+    if (!Enabled)
+      return;
+    double SleepMs = std::min(PredictedSlackMs - MarginMs, MaxSleepMs);
+    if (SleepMs <= 0)
+      return;
+    Clock::time_point Start = Clock::now();
+    std::this_thread::sleep_for(
+        std::chrono::duration<double, std::milli>(SleepMs));
+    LastSleepMs = millisecondsBetween(Start, Clock::now());
+  }
+
+  /// Feeds back how long the frame was blocked on its fence and swapchain
+  /// acquire after the sleep.
+  void update(double BlockedMs) noexcept {
+    if (!Enabled)
+      return;
+    double SlackMs = BlockedMs + LastSleepMs;
+    // Drop at once when a frame had less slack, creep back up slowly, so a
+    // single slow frame does not push the next one past its deadline
+    if (SlackMs < PredictedSlackMs)
+      PredictedSlackMs = SlackMs;
+    else
+      PredictedSlackMs += 0.05 * (SlackMs - PredictedSlackMs);
+  }
+
+  double getLastSleepMs() const noexcept { return LastSleepMs; }
+  double getPredictedSlackMs() const noexcept { return PredictedSlackMs; }
+
+private:
+  bool Enabled = false;
+  double PredictedSlackMs = 0;
+  double LastSleepMs = 0;
+};
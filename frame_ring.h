@@ -0,0 +1,277 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+/// Per-frame resources that are independent of the swapchain images. The
+/// acquire and render-complete semaphores are per window (PresentWindow).
+struct FrameSlot {
+  VkCommandPool CommandPool = VK_NULL_HANDLE;
+  VkCommandBuffer CommandBuffer = VK_NULL_HANDLE;
+  /// Only without timeline semaphores, see FrameRing.
+  VkFence Fence = VK_NULL_HANDLE;
+};
+
+/// A semaphore a submit waits on or signals. The value is ignored for
+/// binary semaphores; the stage is only used by waits.
+struct SemaphoreOp {
+  VkSemaphore Semaphore = VK_NULL_HANDLE;
+  uint64_t Value = 0;
+  VkPipelineStageFlags Stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+};
+
+/// Bounded queue of frames in flight, so the CPU runs at most size() frames
+/// ahead of the GPU no matter how many images the swapchains have or in
+/// which order the presentation engine hands them out.
+///
+/// Frame N is the N-th submission. With timeline semaphores every frame
+/// signals its number on a single timeline semaphore: reusing a slot waits
+/// for the value of the frame that last used it, and asking whether a frame
+/// has completed reads the counter without blocking. Nothing has to be
+/// reset between frames. Without them each slot has a fence instead.
+class FrameRing {
+public:
+  /// GPU profiler results are read FrameProfiler::FramesBehind frames late;
+  /// more frames in flight than that would leave them pending.
+  static constexpr uint32_t MaxFrames = 4;
+
+  /// \p Timeline selects the timeline semaphore path, \p Submit2 on top of
+  /// it submits through vkQueueSubmit2KHR (VK_KHR_synchronization2).
+  void create(vk::Device Device, uint32_t QueueFamilyIndex,
+              vk::AllocationCallbacks const &AllocationCallbacks,
+              uint32_t Count, bool Timeline, bool Submit2) {
+    destroy(Device, AllocationCallbacks);
+    this->Timeline = Timeline;
+    this->Submit2 = Timeline && Submit2;
+    Slots.resize(Count);
+    Serials.assign(Count, 0);
+    for (FrameSlot &Slot : Slots) {
+      vk::CommandPool CommandPool = Device.createCommandPool(
+          {{}, QueueFamilyIndex}, AllocationCallbacks);
+      Slot.CommandPool = CommandPool;
+      Slot.CommandBuffer =
+          Device
+              .allocateCommandBuffers(
+                  {CommandPool, vk::CommandBufferLevel::ePrimary, 1})
+              .front();
+      if (!Timeline)
+        Slot.Fence = Device.createFence({vk::FenceCreateFlagBits::eSignaled},
+                                        AllocationCallbacks);
+    }
+    if (Timeline) {
+      // Continues from the previous ring's count so serials stay unique
+      vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo>
+          TimelineInfo(vk::SemaphoreCreateInfo(),
+                       vk::SemaphoreTypeCreateInfo(vk::SemaphoreType::eTimeline,
+                                                   SubmitCount));
+      Semaphore = Device.createSemaphore(
+          TimelineInfo.get<vk::SemaphoreCreateInfo>(), AllocationCallbacks);
+    }
+    Completed = SubmitCount;
+    Index = 0;
+    Submitted = 0;
+  }
+
+  void destroy(vk::Device Device,
+               vk::AllocationCallbacks const &AllocationCallbacks) {
+    if (Slots.empty())
+      return;
+    Device.waitIdle();
+    for (FrameSlot &Slot : Slots) {
+      if (Slot.Fence)
+        Device.destroyFence(Slot.Fence, AllocationCallbacks);
+      Device.destroyCommandPool(Slot.CommandPool, AllocationCallbacks);
+    }
+    if (Semaphore)
+      Device.destroySemaphore(Semaphore, AllocationCallbacks);
+    Semaphore = nullptr;
+    Slots.clear();
+    // Everything submitted has completed, isComplete and wait must not
+    // reach for the semaphore anymore
+    Completed = SubmitCount;
+  }
+
+  /// Slot the next frame records into.
+  FrameSlot &current() noexcept { return Slots[Index]; }
+  uint32_t currentIndex() const noexcept { return Index; }
+  /// Slot of the most recently submitted frame.
+  FrameSlot &lastSubmitted() noexcept { return Slots[Submitted]; }
+  uint32_t lastSubmittedIndex() const noexcept { return Submitted; }
+
+  /// Blocks until the frame that last used the current slot has completed,
+  /// after which its command pool may be reset.
+  void waitCurrent(vk::Device Device) {
+    if (Timeline)
+      wait(Device, Serials[Index]);
+    else
+      check(VULKAN_HPP_DEFAULT_DISPATCHER.vkWaitForFences(
+          Device, 1, &Slots[Index].Fence, VK_TRUE, UINT64_MAX));
+  }
+
+  /// Submits the current slot's command buffer as the next frame and
+  /// advances to the next slot. Uses vkQueueSubmit2 where the device has
+  /// it; the frame's own timeline signal, or its fence, is added here.
+  void submit(vk::Device Device, vk::Queue Queue,
+              std::span<SemaphoreOp const> Waits,
+              std::span<SemaphoreOp const> Signals) {
+    auto const &Dispatch = VULKAN_HPP_DEFAULT_DISPATCHER;
+    FrameSlot &Slot = Slots[Index];
+    uint64_t Serial = SubmitCount + 1;
+    if (Submit2) {
+      std::vector<VkSemaphoreSubmitInfoKHR> WaitInfos;
+      std::vector<VkSemaphoreSubmitInfoKHR> SignalInfos;
+      for (SemaphoreOp const &Op : Waits)
+        WaitInfos.push_back(
+            {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
+             .semaphore = Op.Semaphore,
+             .value = Op.Value,
+             .stageMask = Op.Stage});
+      for (SemaphoreOp const &Op : Signals)
+        SignalInfos.push_back(
+            {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
+             .semaphore = Op.Semaphore,
+             .value = Op.Value,
+             .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR});
+      SignalInfos.push_back(
+          {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
+           .semaphore = Semaphore,
+           .value = Serial,
+           .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR});
+      VkCommandBufferSubmitInfoKHR CommandBuffer = {
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO_KHR,
+          .commandBuffer = Slot.CommandBuffer};
+      VkSubmitInfo2KHR Info = {
+          .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2_KHR,
+          .waitSemaphoreInfoCount = static_cast<uint32_t>(WaitInfos.size()),
+          .pWaitSemaphoreInfos = WaitInfos.data(),
+          .commandBufferInfoCount = 1,
+          .pCommandBufferInfos = &CommandBuffer,
+          .signalSemaphoreInfoCount =
+              static_cast<uint32_t>(SignalInfos.size()),
+          .pSignalSemaphoreInfos = SignalInfos.data()};
+      check(Dispatch.vkQueueSubmit2KHR(Queue, 1, &Info, VK_NULL_HANDLE));
+    } else {
+      std::vector<VkSemaphore> WaitSemaphores;
+      std::vector<VkPipelineStageFlags> WaitStages;
+      std::vector<uint64_t> WaitValues;
+      std::vector<VkSemaphore> SignalSemaphores;
+      std::vector<uint64_t> SignalValues;
+      for (SemaphoreOp const &Op : Waits) {
+        WaitSemaphores.push_back(Op.Semaphore);
+        WaitStages.push_back(Op.Stage);
+        WaitValues.push_back(Op.Value);
+      }
+      for (SemaphoreOp const &Op : Signals) {
+        SignalSemaphores.push_back(Op.Semaphore);
+        SignalValues.push_back(Op.Value);
+      }
+      if (Timeline) {
+        SignalSemaphores.push_back(Semaphore);
+        SignalValues.push_back(Serial);
+      }
+      VkTimelineSemaphoreSubmitInfo TimelineInfo = {
+          .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+          .waitSemaphoreValueCount = static_cast<uint32_t>(WaitValues.size()),
+          .pWaitSemaphoreValues = WaitValues.data(),
+          .signalSemaphoreValueCount =
+              static_cast<uint32_t>(SignalValues.size()),
+          .pSignalSemaphoreValues = SignalValues.data()};
+      // Without timeline support none of the semaphores can be one
+      VkSubmitInfo Info = {
+          .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+          .pNext = Timeline ? &TimelineInfo : nullptr,
+          .waitSemaphoreCount = static_cast<uint32_t>(WaitSemaphores.size()),
+          .pWaitSemaphores = WaitSemaphores.data(),
+          .pWaitDstStageMask = WaitStages.data(),
+          .commandBufferCount = 1,
+          .pCommandBuffers = &Slot.CommandBuffer,
+          .signalSemaphoreCount =
+              static_cast<uint32_t>(SignalSemaphores.size()),
+          .pSignalSemaphores = SignalSemaphores.data()};
+      if (!Timeline)
+        check(Dispatch.vkResetFences(Device, 1, &Slot.Fence));
+      check(Dispatch.vkQueueSubmit(Queue, 1, &Info, Slot.Fence));
+    }
+    advance();
+  }
+
+  /// Number of frames submitted so far; frame N is the N-th submission.
+  uint64_t getSubmitCount() const noexcept { return SubmitCount; }
+
+  /// True once every frame up to and including \p Serial has completed on
+  /// the GPU. Never blocks; with timeline semaphores a single counter read,
+  /// and none at all for frames already known to be complete.
+  bool isComplete(vk::Device Device, uint64_t Serial) {
+    if (Serial <= Completed)
+      return true;
+    if (Timeline) {
+      uint64_t Value = 0;
+      check(VULKAN_HPP_DEFAULT_DISPATCHER.vkGetSemaphoreCounterValue(
+          Device, Semaphore, &Value));
+      Completed = std::max(Completed, Value);
+      return Serial <= Completed;
+    }
+    for (size_t I = 0; I < Slots.size(); ++I)
+      // A slot reused after Serial was waited on before its reuse
+      if (Serials[I] != 0 && Serials[I] <= Serial &&
+          Device.getFenceStatus(Slots[I].Fence) != vk::Result::eSuccess)
+        return false;
+    return true;
+  }
+
+  /// Blocks until frame \p Serial has completed.
+  void wait(vk::Device Device, uint64_t Serial) {
+    if (Serial <= Completed)
+      return;
+    if (Timeline) {
+      VkSemaphore Semaphores[] = {Semaphore};
+      VkSemaphoreWaitInfoKHR Info = {
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+          .semaphoreCount = 1,
+          .pSemaphores = Semaphores,
+          .pValues = &Serial};
+      check(VULKAN_HPP_DEFAULT_DISPATCHER.vkWaitSemaphores(Device, &Info,
+                                                           UINT64_MAX));
+      Completed = Serial;
+      return;
+    }
+    for (size_t I = 0; I < Slots.size(); ++I)
+      if (Serials[I] != 0 && Serials[I] <= Serial)
+        check(VULKAN_HPP_DEFAULT_DISPATCHER.vkWaitForFences(
+            Device, 1, &Slots[I].Fence, VK_TRUE, UINT64_MAX));
+    Completed = Serial;
+  }
+
+  uint32_t size() const noexcept { return static_cast<uint32_t>(Slots.size()); }
+
+private:
+  static void check(VkResult Result) {
+    if (Result != VK_SUCCESS)
+      throw std::runtime_error(
+          "Frame synchronization failed: " +
+          vk::to_string(static_cast<vk::Result>(Result)));
+  }
+
+  void advance() noexcept {
+    Serials[Index] = ++SubmitCount;
+    Submitted = Index;
+    Index = (Index + 1) % static_cast<uint32_t>(Slots.size());
+  }
+
+  std::vector<FrameSlot> Slots;
+  /// Serial of the frame each slot last carried, 0 if none yet.
+  std::vector<uint64_t> Serials;
+  bool Timeline = false;
+  bool Submit2 = false;
+  /// Signaled with each frame's serial on the timeline path.
+  vk::Semaphore Semaphore;
+  uint32_t Index = 0;
+  uint32_t Submitted = 0;
+  uint64_t SubmitCount = 0;
+  /// Highest serial known to have completed.
+  uint64_t Completed = 0;
+};
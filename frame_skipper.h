@@ -0,0 +1,129 @@
+#pragma once
+
+#include "profiler.h"
+
+#include <imgui.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+/// Word-at-a-time multiplicative hash; only has to tell frames apart, not
+/// resist adversaries.
+inline uint64_t hashBytes(void const *Data, size_t Size,
+                          uint64_t Hash) noexcept {
+  constexpr uint64_t Multiplier = 0x9e3779b97f4a7c15ull;
+  auto const *Bytes = static_cast<unsigned char const *>(Data);
+  size_t I = 0;
+  for (; I + sizeof(uint64_t) <= Size; I += sizeof(uint64_t)) {
+    uint64_t Word;
+    std::memcpy(&Word, Bytes + I, sizeof(Word));
+    Hash = (Hash ^ Word) * Multiplier;
+    Hash ^= Hash >> 32;
+  }
+  for (; I < Size; ++I)
+    Hash = (Hash ^ Bytes[I]) * Multiplier;
+  return Hash;
+}
+
+template <typename T>
+inline uint64_t hashValue(T const &Value, uint64_t Hash) noexcept {
+  return hashBytes(&Value, sizeof(Value), Hash);
+}
+
+/// Hashes everything ImGui_ImplVulkan_RenderDrawData reads: geometry, draw
+/// commands and the display rectangle. Fields are hashed one by one so that
+/// struct padding never makes equal frames differ.
+inline uint64_t hashDrawData(ImDrawData const *DrawData,
+                             uint64_t Hash = 0xcbf29ce484222325ull) noexcept {
+  if (!DrawData || !DrawData->Valid)
+    return Hash;
+  Hash = hashValue(DrawData->DisplayPos, Hash);
+  Hash = hashValue(DrawData->DisplaySize, Hash);
+  Hash = hashValue(DrawData->FramebufferScale, Hash);
+  Hash = hashValue(DrawData->CmdListsCount, Hash);
+  for (int N = 0; N < DrawData->CmdListsCount; ++N) {
+    ImDrawList const *List = DrawData->CmdLists[N];
+    Hash = hashBytes(List->VtxBuffer.Data,
+                     List->VtxBuffer.Size * sizeof(ImDrawVert), Hash);
+    Hash = hashBytes(List->IdxBuffer.Data,
+                     List->IdxBuffer.Size * sizeof(ImDrawIdx), Hash);
+    for (ImDrawCmd const &Cmd : List->CmdBuffer) {
+      Hash = hashValue(Cmd.ClipRect, Hash);
+      Hash = hashValue(Cmd.TextureId, Hash);
+      Hash = hashValue(Cmd.VtxOffset, Hash);
+      Hash = hashValue(Cmd.IdxOffset, Hash);
+      Hash = hashValue(Cmd.ElemCount, Hash);
+      Hash = hashValue(Cmd.UserCallback, Hash);
+    }
+  }
+  return Hash;
+}
+
+/// On-demand rendering. Every built frame is hashed; a frame identical to
+/// the one on screen is neither recorded nor presented, since the
+/// presentation engine keeps showing the last image. Once frames have been
+/// identical for a while the loop may block waiting for input instead of
+/// polling. Counts rendered and skipped frames per second either way.
+class FrameSkipper {
+public:
+  /// Identical frames needed before going idle; ImGui settles hover and
+  /// layout changes over a frame or two after the input that caused them.
+  static constexpr uint32_t SettleFrames = 3;
+  /// Longest the loop blocks for input while idle, so time driven UI such
+  /// as the per-second counters keeps ticking.
+  static constexpr int IdleTimeoutMs = 250;
+
+  void setEnabled(bool Enable) noexcept {
+    Enabled = Enable;
+    Unchanged = 0;
+    Invalid = true;
+  }
+  bool isEnabled() const noexcept { return Enabled; }
+
+  /// Forces the next frame to render, e.g. after a resize or expose event
+  /// or a swapchain rebuild left the screen without the last frame.
+  void invalidate() noexcept { Invalid = true; }
+
+  /// Decides whether the frame ImGui just built has to be rendered.
+  /// \p Extra folds in state outside the draw data, like the clear color.
+  bool shouldRender(ImDrawData const *DrawData, uint64_t Extra = 0) {
+    Clock::time_point Now = Clock::now();
+    if (Now - WindowStart >= std::chrono::seconds(1)) {
+      RenderedPerSecond = Rendered;
+      SkippedPerSecond = Skipped;
+      Rendered = Skipped = 0;
+      WindowStart = Now;
+    }
+
+    uint64_t Hash = hashDrawData(DrawData, Extra);
+    bool Same = Hash == LastHash;
+    LastHash = Hash;
+    Unchanged = Same ? Unchanged + 1 : 0;
+    bool Render = !Enabled || Invalid || !Same;
+    Invalid = false;
+    ++(Render ? Rendered : Skipped);
+    return Render;
+  }
+
+  /// How long the event loop may block for input: 0 to poll while the UI
+  /// is changing or on-demand rendering is off.
+  int getWaitTimeoutMs() const noexcept {
+    return Enabled && Unchanged >= SettleFrames ? IdleTimeoutMs : 0;
+  }
+
+  /// Counts over the last full second.
+  uint32_t getRenderedPerSecond() const noexcept { return RenderedPerSecond; }
+  uint32_t getSkippedPerSecond() const noexcept { return SkippedPerSecond; }
+
+private:
+  bool Enabled = false;
+  bool Invalid = true;
+  uint64_t LastHash = 0;
+  uint32_t Unchanged = 0;
+  Clock::time_point WindowStart = Clock::now();
+  uint32_t Rendered = 0;
+  uint32_t Skipped = 0;
+  uint32_t RenderedPerSecond = 0;
+  uint32_t SkippedPerSecond = 0;
+};
@@ -0,0 +1,328 @@
+#pragma once
+
+#include "format.h"
+
+#include <imgui.h>
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/// Host memory behind VulkanContext::AllocationCallbacks.
+///
+/// Small allocations come from per-size-class pools carved out of 64 KiB
+/// chunks, each class behind its own lock, so driver threads do not contend
+/// on the global heap with the rest of the process. Command-scope
+/// allocations, which the driver frees before the call returns, are bump
+/// allocated from a per-thread arena instead. Every allocation is counted
+/// per VkSystemAllocationScope, which makes host allocation churn in the
+/// frame loop visible.
+class HostAllocator {
+public:
+  static constexpr size_t ScopeCount = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+  static constexpr char const *ScopeNames[ScopeCount] = {
+      "command", "object", "cache", "device", "instance"};
+
+  struct ScopeStats {
+    std::atomic<int64_t> LiveBytes{0};
+    std::atomic<int64_t> PeakBytes{0};
+    std::atomic<uint64_t> Allocations{0};
+    /// Allocations since the last beginFrame().
+    std::atomic<uint64_t> FrameAllocations{0};
+    /// Allocations during the previous frame.
+    std::atomic<uint64_t> LastFrameAllocations{0};
+    /// Driver allocations made outside of these callbacks, as reported by
+    /// pfnInternalAllocation.
+    std::atomic<int64_t> InternalBytes{0};
+  };
+
+  HostAllocator() = default;
+  HostAllocator(HostAllocator const &) = delete;
+  HostAllocator &operator=(HostAllocator const &) = delete;
+
+  ~HostAllocator() {
+    int64_t Live = 0;
+    for (ScopeStats const &S : Stats)
+      Live += S.LiveBytes.load();
+    // Everything allocated through the callbacks should be gone by now.
+    // Chunks that still hold blocks are left to the OS rather than freed
+    // under whoever leaked them.
+    if (Live != 0) {
+      for (size_t I = 0; I < ScopeCount; ++I)
+        if (int64_t Bytes = Stats[I].LiveBytes.load())
+          errsv("Vulkan host memory leaked: {} bytes in {} scope", Bytes,
+                ScopeNames[I]);
+      return;
+    }
+    for (Pool &P : Pools)
+      for (void *Chunk : P.Chunks)
+        ::operator delete(Chunk, std::align_val_t{ChunkAlignment});
+  }
+
+  vk::AllocationCallbacks callbacks() noexcept {
+    return {this,           &allocateCallback,           &reallocateCallback,
+            &freeCallback,  &internalAllocationCallback, &internalFreeCallback};
+  }
+
+  /// Rolls the per-frame allocation counters over.
+  void beginFrame() noexcept {
+    for (ScopeStats &S : Stats)
+      S.LastFrameAllocations = S.FrameAllocations.exchange(0);
+  }
+
+  ScopeStats const &getStats(VkSystemAllocationScope Scope) const noexcept {
+    return Stats[Scope];
+  }
+
+  uint64_t getLastFrameAllocations() const noexcept {
+    uint64_t Total = 0;
+    for (ScopeStats const &S : Stats)
+      Total += S.LastFrameAllocations.load();
+    return Total;
+  }
+
+  void *allocate(size_t Size, size_t Alignment,
+                 VkSystemAllocationScope Scope) {
+    if (Size == 0)
+      return nullptr;
+    Alignment = std::max(Alignment, alignof(std::max_align_t));
+    size_t Prefix = std::max(HeaderSize, Alignment);
+    size_t Total = Prefix + Size;
+
+    void *Block = nullptr;
+    void *Arena = nullptr;
+    uint16_t Class = LargeClass;
+    if (Scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND &&
+        (Block = commandArena().allocate(Total, Alignment))) {
+      Arena = &commandArena();
+      Class = ArenaClass;
+    } else if (Alignment <= ChunkAlignment && Total <= MaxPooledSize) {
+      Class = sizeClass(Total);
+      Block = Pools[Class].allocate(classSize(Class));
+    } else {
+      Block = ::operator new(Total, std::align_val_t{Alignment},
+                             std::nothrow);
+    }
+    if (!Block)
+      return nullptr;
+
+    auto *User = static_cast<std::byte *>(Block) + Prefix;
+    BlockHeader &Header = header(User);
+    Header.Block = Block;
+    Header.Arena = Arena;
+    Header.Size = Size;
+    Header.Alignment = static_cast<uint32_t>(Alignment);
+    Header.Class = Class;
+    Header.Scope = static_cast<uint8_t>(Scope);
+
+    ScopeStats &S = Stats[Scope];
+    int64_t Live = S.LiveBytes += static_cast<int64_t>(Size);
+    int64_t Peak = S.PeakBytes.load(std::memory_order_relaxed);
+    while (Live > Peak && !S.PeakBytes.compare_exchange_weak(Peak, Live))
+      ;
+    ++S.Allocations;
+    ++S.FrameAllocations;
+    return User;
+  }
+
+  void free(void *Memory) noexcept {
+    if (!Memory)
+      return;
+    BlockHeader &Header = header(Memory);
+    Stats[Header.Scope].LiveBytes -= static_cast<int64_t>(Header.Size);
+    if (Header.Class == ArenaClass)
+      static_cast<CommandArena *>(Header.Arena)->release();
+    else if (Header.Class == LargeClass)
+      ::operator delete(Header.Block, std::align_val_t{Header.Alignment});
+    else
+      Pools[Header.Class].release(Header.Block);
+  }
+
+  void *reallocate(void *Original, size_t Size, size_t Alignment,
+                   VkSystemAllocationScope Scope) {
+    if (!Original)
+      return allocate(Size, Alignment, Scope);
+    if (Size == 0) {
+      free(Original);
+      return nullptr;
+    }
+    void *Memory = allocate(Size, Alignment, Scope);
+    if (!Memory)
+      return nullptr; // the original stays valid, as the spec requires
+    std::memcpy(Memory, Original,
+                std::min<size_t>(header(Original).Size, Size));
+    free(Original);
+    return Memory;
+  }
+
+private:
+  struct alignas(16) BlockHeader {
+    void *Block;
+    void *Arena;
+    uint64_t Size;
+    uint32_t Alignment;
+    uint16_t Class;
+    uint8_t Scope;
+  };
+  static constexpr size_t HeaderSize = sizeof(BlockHeader);
+  static_assert(HeaderSize == 32);
+
+  static constexpr size_t MinClassShift = 6; // 64 bytes
+  static constexpr size_t ClassCount = 8;    // up to 8 KiB
+  static constexpr size_t MaxPooledSize = size_t{1}
+                                          << (MinClassShift + ClassCount - 1);
+  static constexpr uint16_t LargeClass = 0xffff;
+  static constexpr uint16_t ArenaClass = 0xfffe;
+  static constexpr size_t ChunkSize = 64 * 1024;
+  static constexpr size_t ChunkAlignment = 4096;
+
+  static constexpr size_t classSize(uint16_t Class) noexcept {
+    return size_t{1} << (MinClassShift + Class);
+  }
+  static uint16_t sizeClass(size_t Total) noexcept {
+    size_t Shift = std::bit_width(std::max(Total, size_t{2}) - 1);
+    return static_cast<uint16_t>(std::max(Shift, MinClassShift) -
+                                 MinClassShift);
+  }
+
+  static BlockHeader &header(void *User) noexcept {
+    return *reinterpret_cast<BlockHeader *>(static_cast<std::byte *>(User) -
+                                            HeaderSize);
+  }
+
+  /// Intrusive free list of equally sized blocks. Blocks are aligned to
+  /// min(block size, ChunkAlignment) because chunks are.
+  struct Pool {
+    std::mutex Mutex;
+    void *FreeList = nullptr;
+    std::vector<void *> Chunks;
+
+    void *allocate(size_t BlockSize) {
+      std::lock_guard Lock(Mutex);
+      if (!FreeList) {
+        void *Chunk = ::operator new(
+            ChunkSize, std::align_val_t{ChunkAlignment}, std::nothrow);
+        if (!Chunk)
+          return nullptr;
+        Chunks.push_back(Chunk);
+        auto *Bytes = static_cast<std::byte *>(Chunk);
+        for (size_t Offset = ChunkSize; Offset >= BlockSize;
+             Offset -= BlockSize) {
+          void *Block = Bytes + Offset - BlockSize;
+          *static_cast<void **>(Block) = FreeList;
+          FreeList = Block;
+        }
+      }
+      void *Block = FreeList;
+      FreeList = *static_cast<void **>(Block);
+      return Block;
+    }
+
+    void release(void *Block) {
+      std::lock_guard Lock(Mutex);
+      *static_cast<void **>(Block) = FreeList;
+      FreeList = Block;
+    }
+  };
+
+  /// Bump allocator for command-scope allocations. All of them are gone once
+  /// the Vulkan command that made them returns, so the arena rewinds as soon
+  /// as nothing is live. Frees may come from any thread, rewinding only
+  /// happens on the owning one.
+  struct CommandArena {
+    static constexpr size_t Capacity = 64 * 1024;
+
+    alignas(ChunkAlignment) std::byte Storage[Capacity];
+    size_t Offset = 0;
+    std::atomic<uint32_t> Live{0};
+
+    void *allocate(size_t Size, size_t Alignment) noexcept {
+      if (Live.load(std::memory_order_acquire) == 0)
+        Offset = 0;
+      size_t Start = (Offset + Alignment - 1) & ~(Alignment - 1);
+      if (Alignment > ChunkAlignment || Start + Size > Capacity)
+        return nullptr;
+      Offset = Start + Size;
+      Live.fetch_add(1, std::memory_order_relaxed);
+      return Storage + Start;
+    }
+
+    void release() noexcept { Live.fetch_sub(1, std::memory_order_release); }
+  };
+
+  static CommandArena &commandArena() {
+    thread_local auto Arena = std::make_unique<CommandArena>();
+    return *Arena;
+  }
+
+  static VKAPI_ATTR void *VKAPI_CALL
+  allocateCallback(void *UserData, size_t Size, size_t Alignment,
+                   VkSystemAllocationScope Scope) {
+    return static_cast<HostAllocator *>(UserData)->allocate(Size, Alignment,
+                                                            Scope);
+  }
+  static VKAPI_ATTR void *VKAPI_CALL
+  reallocateCallback(void *UserData, void *Original, size_t Size,
+                     size_t Alignment, VkSystemAllocationScope Scope) {
+    return static_cast<HostAllocator *>(UserData)->reallocate(
+        Original, Size, Alignment, Scope);
+  }
+  static VKAPI_ATTR void VKAPI_CALL freeCallback(void *UserData,
+                                                 void *Memory) {
+    static_cast<HostAllocator *>(UserData)->free(Memory);
+  }
+  static VKAPI_ATTR void VKAPI_CALL
+  internalAllocationCallback(void *UserData, size_t Size,
+                             VkInternalAllocationType,
+                             VkSystemAllocationScope Scope) {
+    static_cast<HostAllocator *>(UserData)->Stats[Scope].InternalBytes +=
+        static_cast<int64_t>(Size);
+  }
+  static VKAPI_ATTR void VKAPI_CALL
+  internalFreeCallback(void *UserData, size_t Size, VkInternalAllocationType,
+                       VkSystemAllocationScope Scope) {
+    static_cast<HostAllocator *>(UserData)->Stats[Scope].InternalBytes -=
+        static_cast<int64_t>(Size);
+  }
+
+  std::array<Pool, ClassCount> Pools;
+  std::array<ScopeStats, ScopeCount> Stats;
+};
+
+/// Table of the per-scope counters, for the profiler window.
+inline void drawHostAllocatorStats(HostAllocator const &Allocator) {
+  if (!ImGui::BeginTable("host allocations", 6,
+                         ImGuiTableFlags_Borders |
+                             ImGuiTableFlags_SizingFixedFit))
+    return;
+  for (char const *Column : {"scope", "live KiB", "peak KiB", "allocs",
+                             "allocs/frame", "internal KiB"})
+    ImGui::TableSetupColumn(Column);
+  ImGui::TableHeadersRow();
+  for (size_t I = 0; I < HostAllocator::ScopeCount; ++I) {
+    HostAllocator::ScopeStats const &S =
+        Allocator.getStats(static_cast<VkSystemAllocationScope>(I));
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    ImGui::TextUnformatted(HostAllocator::ScopeNames[I]);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", S.LiveBytes.load() / 1024.0);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", S.PeakBytes.load() / 1024.0);
+    ImGui::TableNextColumn();
+    ImGui::Text("%llu", static_cast<unsigned long long>(S.Allocations.load()));
+    ImGui::TableNextColumn();
+    ImGui::Text("%llu", static_cast<unsigned long long>(
+                            S.LastFrameAllocations.load()));
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", S.InternalBytes.load() / 1024.0);
+  }
+  ImGui::EndTable();
+}
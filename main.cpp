@@ -1,300 +1,541 @@
+#include "draw_capture.h"
 #include "format.h"
+#include "frame.h"
+#include "frame_pacer.h"
+#include "frame_skipper.h"
+#include "options.h"
+#include "time_series.h"
 #include "vulkan_context.h"
 
 #include <SDL2pp/SDL2pp.hh>
 #include <SDL_vulkan.h>
 #include <imgui_impl_sdl.h>
 
-static void checkVkResult(VkResult Err) {
-  if (Err == 0)
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+/// Feeds a TimeSeriesPlot from its own thread with about a million samples
+/// per second and channel: a chirp and a noisy square wave with spikes.
+class SignalGenerator {
+public:
+  static constexpr double SampleRate = 1e6;
+
+  explicit SignalGenerator(TimeSeriesPlot &Plot)
+      : Thread([this, &Plot] { run(Plot); }) {}
+  ~SignalGenerator() {
+    Stop = true;
+    Thread.join();
+  }
+
+private:
+  void run(TimeSeriesPlot &Plot) {
+    std::minstd_rand Random(42);
+    std::normal_distribution<float> Noise(0.0f, 0.05f);
+    std::vector<float> Chirp, Square;
+    Clock::time_point Start = Clock::now();
+    uint64_t Produced = 0;
+    while (!Stop) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      std::chrono::duration<double> Elapsed = Clock::now() - Start;
+      auto Due = static_cast<uint64_t>(Elapsed.count() * SampleRate);
+      Chirp.clear();
+      Square.clear();
+      for (; Produced < Due; ++Produced) {
+        double T = Produced / SampleRate;
+        double Phase = std::fmod(T, 10.0);
+        Chirp.push_back(static_cast<float>(
+            std::sin(2 * 3.14159265358979 * Phase * (1 + 20 * Phase))));
+        float Level = std::fmod(T, 0.5) < 0.25 ? 0.5f : -0.5f;
+        float Spike = Produced % 250'000 == 0 ? 2.0f : 0.0f;
+        Square.push_back(Level + Spike + Noise(Random));
+      }
+      Plot.push(0, Chirp);
+      Plot.push(1, Square);
+    }
+  }
+
+  std::atomic<bool> Stop{false};
+  std::thread Thread;
+};
+
+/// UI state that outlives a frame.
+struct DemoState {
+  ImVec4 ClearColor = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
+  bool ShowProfiler = false;
+  FramePacer Pacer;
+  FrameSkipper Skipper;
+  /// Test image streamed through the upload service on request.
+  UploadedImage Streamed;
+  ImTextureID StreamedTexture = nullptr;
+  bool Streaming = false;
+  Clock::time_point StreamStart;
+  double StreamMs = 0;
+  /// Time series window, created with its producer thread when first shown.
+  bool ShowPlot = false;
+  std::unique_ptr<TimeSeriesPlot> Plot;
+  std::unique_ptr<SignalGenerator> Generator;
+};
+
+/// Plots everything the generator produced, reduced to the window width.
+static void buildPlotUi(DemoState &State) {
+  if (!State.ShowPlot)
     return;
-  errsv("[vulkan] Error: VkResult = {}", Err);
-  throw std::runtime_error("Caught vulkan error");
+  if (!State.Plot) {
+    State.Plot = std::make_unique<TimeSeriesPlot>(2);
+    State.Generator = std::make_unique<SignalGenerator>(*State.Plot);
+  }
+  ImGui::SetNextWindowSize(ImVec2(640, 300), ImGuiCond_FirstUseEver);
+  ImGui::Begin("Time series", &State.ShowPlot);
+  ImGui::Text("%.2f M samples per channel, %llu dropped, %d vertices",
+              State.Plot->getSampleCount() / 1e6,
+              static_cast<unsigned long long>(State.Plot->getDropped()),
+              State.Plot->getLastVertexCount());
+  ImGui::TextUnformatted(
+      "wheel: zoom, drag: pan, double-click: follow newest");
+  State.Plot->draw("##samples", ImVec2(-1, -1));
+  ImGui::End();
 }
 
-static void frameRender(VulkanContext &Vulkan, ImDrawData *draw_data) {
-  VkResult Err;
-  auto &Wd = Vulkan.getMainWindowData();
-
-  VkSemaphore ImageAcquiredSemaphore =
-      Wd.FrameSemaphores[Wd.SemaphoreIndex].ImageAcquiredSemaphore;
-  VkSemaphore RenderCompleteSemaphore =
-      Wd.FrameSemaphores[Wd.SemaphoreIndex].RenderCompleteSemaphore;
-  Err = vkAcquireNextImageKHR(Vulkan.getDevice(), Wd.Swapchain, UINT64_MAX,
-                              ImageAcquiredSemaphore, VK_NULL_HANDLE,
-                              &Wd.FrameIndex);
-  if (Err == VK_ERROR_OUT_OF_DATE_KHR || Err == VK_SUBOPTIMAL_KHR) {
-    Vulkan.getSwapChainRebuild() = true;
-    return;
+/// Streams a large generated image in while frames keep rendering.
+static void buildStreamingUi(VulkanContext &Vulkan, DemoState &State) {
+  constexpr uint32_t Size = 2048;
+  if (!State.Streaming && !State.StreamedTexture &&
+      ImGui::Button("Stream 2048x2048 test image")) {
+    std::vector<uint8_t> Pixels(size_t(Size) * Size * 4);
+    for (uint32_t Y = 0; Y < Size; ++Y)
+      for (uint32_t X = 0; X < Size; ++X) {
+        uint8_t *Texel = &Pixels[(size_t(Y) * Size + X) * 4];
+        Texel[0] = static_cast<uint8_t>(X / 8);
+        Texel[1] = static_cast<uint8_t>(Y / 8);
+        Texel[2] = static_cast<uint8_t>((X ^ Y) & 0xff);
+        Texel[3] = 0xff;
+      }
+    State.Streaming = true;
+    State.StreamStart = Clock::now();
+    Vulkan.getUploads().uploadImage(
+        std::move(Pixels), Size, Size, vk::Format::eR8G8B8A8Unorm,
+        [&Vulkan, &State](UploadedImage const &Image) {
+          State.Streamed = Image;
+          State.StreamedTexture =
+              reinterpret_cast<ImTextureID>(ImGui_ImplVulkan_AddTexture(
+                  Vulkan.getUploads().getSampler(), Image.View,
+                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+          State.Streaming = false;
+          State.StreamMs = millisecondsBetween(State.StreamStart, Clock::now());
+        });
+  }
+  if (State.Streaming)
+    ImGui::Text("streaming...");
+  if (State.StreamedTexture) {
+    ImGui::Text("streamed in %.2f ms (%s)", State.StreamMs,
+                Vulkan.getUploads().hasDedicatedTransferQueue()
+                    ? "transfer queue"
+                    : "graphics queue");
+    ImGui::Image(State.StreamedTexture, ImVec2(256, 256));
   }
-  checkVkResult(Err);
+}
 
-  ImGui_ImplVulkanH_Frame *Fd = &Wd.Frames[Wd.FrameIndex];
-  {
-    Err = vkWaitForFences(
-        Vulkan.getDevice(), 1, &Fd->Fence, VK_TRUE,
-        UINT64_MAX); // wait indefinitely instead of periodically checking
-    checkVkResult(Err);
+/// Present mode and pacing controls, only meaningful with a swapchain.
+static void buildDisplayUi(VulkanContext &Vulkan, DemoState &State) {
+  static constexpr std::pair<vk::PresentModeKHR, char const *> Modes[] = {
+      {vk::PresentModeKHR::eFifo, "FIFO (vsync)"},
+      {vk::PresentModeKHR::eMailbox, "MAILBOX"},
+      {vk::PresentModeKHR::eImmediate, "IMMEDIATE"}};
+
+  vk::PresentModeKHR Current = Vulkan.getPresentMode();
+  char const *Preview = "?";
+  for (auto &&[Mode, Name] : Modes)
+    if (Mode == Current)
+      Preview = Name;
+
+  if (ImGui::BeginCombo("present mode", Preview)) {
+    for (auto &&[Mode, Name] : Modes) {
+      ImGuiSelectableFlags Flags = Vulkan.isPresentModeSupported(Mode)
+                                       ? ImGuiSelectableFlags_None
+                                       : ImGuiSelectableFlags_Disabled;
+      if (ImGui::Selectable(Name, Mode == Current, Flags))
+        Vulkan.setPresentMode(Mode);
+    }
+    ImGui::EndCombo();
+  }
+
+  bool LowLatency = State.Pacer.isEnabled();
+  if (ImGui::Checkbox("low-latency pacing", &LowLatency))
+    State.Pacer.setEnabled(LowLatency);
+  if (LowLatency)
+    ImGui::Text("slept %.2f ms, predicted slack %.2f ms",
+                State.Pacer.getLastSleepMs(),
+                State.Pacer.getPredictedSlackMs());
+}
 
-    Err = vkResetFences(Vulkan.getDevice(), 1, &Fd->Fence);
-    checkVkResult(Err);
+/// GPU wave simulation stepped on the compute queue, shown as a texture.
+static void buildSimulationUi(VulkanContext &Vulkan) {
+  ComputeStage &Simulation = Vulkan.getSimulation();
+  if (!Simulation.isSupported()) {
+    ImGui::TextUnformatted("simulation needs timeline semaphores");
+    return;
+  }
+  ImGui::Checkbox("run simulation", &Simulation.getRunning());
+  ImGui::SameLine();
+  ImGui::Checkbox("overlap with rendering", &Simulation.getOverlap());
+  ImGui::Text("%ux%u cells, %u steps/s on the %s queue", Simulation.getSize(),
+              Simulation.getSize(), Simulation.getStepsPerSecond(),
+              Simulation.hasAsyncQueue() ? "async compute" : "graphics");
+  if (ImTextureID Texture = Simulation.getTexture())
+    ImGui::Image(Texture, ImVec2(256, 256));
+}
+
+static void buildUi(VulkanContext &Vulkan, DemoState &State) {
+  ImVec4 &ClearColor = State.ClearColor;
+  // Show a simple window that we create ourselves. We use a Begin/End
+  // pair to created a named window.
+  static float F = 0.0f;
+  static int Counter = 0;
+
+  ImGui::Begin("Hello, world!"); // Create a window called "Hello, world!"
+                                 // and append into it.
+
+  ImGui::Text("This is some useful text."); // Display some text (you can
+                                            // use a format strings too)
+  ImGui::SliderFloat("float", &F, 0.0f,
+                     1.0f); // Edit 1 float using a slider from 0.0f to 1.0f
+  ImGui::ColorEdit3("clear color",
+                    (float *)&ClearColor); // Edit 3 floats representing a color
+
+  if (ImGui::Button("Button")) // Buttons return true when clicked (most widgets
+                               // return true when edited/activated)
+    Counter++;
+  ImGui::SameLine();
+  ImGui::Text("counter = %d", Counter);
+
+  // The running frame rate changes every frame and would defeat frame
+  // skipping, so on-demand mode shows the per-second counts instead
+  bool OnDemand = State.Skipper.isEnabled();
+  if (ImGui::Checkbox("on-demand rendering", &OnDemand))
+    State.Skipper.setEnabled(OnDemand);
+  if (OnDemand)
+    ImGui::Text("%u frames rendered, %u skipped per second",
+                State.Skipper.getRenderedPerSecond(),
+                State.Skipper.getSkippedPerSecond());
+  else
+    ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
+                1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+  ImGui::Checkbox("Profiler", &State.ShowProfiler);
+  ImGui::SameLine();
+  ImGui::Checkbox("Time series", &State.ShowPlot);
+  ImGui::Separator();
+  buildSimulationUi(Vulkan);
+  if (!Vulkan.isHeadless()) {
+    ImGui::Separator();
+    buildDisplayUi(Vulkan, State);
+    ImGui::Separator();
+    buildStreamingUi(Vulkan, State);
   }
+  ImGui::End();
+}
+
+/// Builds the demo UI plus the profiler overlay, as CPU zones of the frame.
+static void buildFrame(VulkanContext &Vulkan, DemoState &State) {
+  auto &Profiler = Vulkan.getProfiler();
   {
-    Err = vkResetCommandPool(Vulkan.getDevice(), Fd->CommandPool, 0);
-    checkVkResult(Err);
-    VkCommandBufferBeginInfo Info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
-    Err = vkBeginCommandBuffer(Fd->CommandBuffer, &Info);
-    checkVkResult(Err);
+    auto Zone = Profiler.zone("ImGui::NewFrame");
+    ImGui::NewFrame();
   }
   {
-    VkRenderPassBeginInfo Info = {.sType =
-                                      VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-                                  .renderPass = Wd.RenderPass,
-                                  .framebuffer = Fd->Framebuffer,
-                                  .clearValueCount = 1,
-                                  .pClearValues = &Wd.ClearValue};
-    Info.renderArea.extent.width = Wd.Width;
-    Info.renderArea.extent.height = Wd.Height;
-    vkCmdBeginRenderPass(Fd->CommandBuffer, &Info, VK_SUBPASS_CONTENTS_INLINE);
+    auto Zone = Profiler.zone("build ui");
+    buildUi(Vulkan, State);
+    buildPlotUi(State);
+    if (State.ShowProfiler) {
+      Profiler.drawOverlay(&State.ShowProfiler);
+      ImGui::Begin("Memory");
+      ImGui::TextUnformatted("Host");
+      drawHostAllocatorStats(Vulkan.getHostAllocator());
+      ImGui::Separator();
+      ImGui::TextUnformatted("Device");
+      drawDeviceMemoryStats(Vulkan.getDeviceMemory());
+      ImGui::End();
+    }
   }
-
-  // Record dear imgui primitives into command buffer
-  ImGui_ImplVulkan_RenderDrawData(draw_data, Fd->CommandBuffer);
-
-  // Submit command buffer
-  vkCmdEndRenderPass(Fd->CommandBuffer);
   {
-    VkPipelineStageFlags WaitStage =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    VkSubmitInfo Info = {.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                         .waitSemaphoreCount = 1,
-                         .pWaitSemaphores = &ImageAcquiredSemaphore,
-                         .pWaitDstStageMask = &WaitStage,
-                         .commandBufferCount = 1,
-                         .pCommandBuffers = &Fd->CommandBuffer,
-                         .signalSemaphoreCount = 1,
-                         .pSignalSemaphores = &RenderCompleteSemaphore};
-
-
-    Err = vkEndCommandBuffer(Fd->CommandBuffer);
-    checkVkResult(Err);
-    Err = vkQueueSubmit(Vulkan.getQueue(), 1, &Info, Fd->Fence);
-    checkVkResult(Err);
+    auto Zone = Profiler.zone("ImGui::Render");
+    ImGui::Render();
   }
 }
 
-static void framePresent(VulkanContext &Vulkan) {
-  if (Vulkan.getSwapChainRebuild())
-    return;
-  auto &Wd = Vulkan.getMainWindowData();
-  VkSemaphore RenderCompleteSemaphore =
-      Wd.FrameSemaphores[Wd.SemaphoreIndex].RenderCompleteSemaphore;
-
-  VkPresentInfoKHR Info = {.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-                           .waitSemaphoreCount = 1,
-                           .pWaitSemaphores = &RenderCompleteSemaphore,
-                           .swapchainCount = 1,
-                           .pSwapchains = &Wd.Swapchain,
-                           .pImageIndices = &Wd.FrameIndex};
-
-  VkResult Err = vkQueuePresentKHR(Vulkan.getQueue(), &Info);
-  if (Err == VK_ERROR_OUT_OF_DATE_KHR || Err == VK_SUBOPTIMAL_KHR) {
-    Vulkan.getSwapChainRebuild() = true;
+static void startSimulation(VulkanContext &Vulkan,
+                            DemoOptions const &Options) {
+  if (Options.SimulationSize == 0)
     return;
-  }
-
-  checkVkResult(Err);
-
-  // Now we can use the next set of semaphores
-  Wd.SemaphoreIndex = (Wd.SemaphoreIndex + 1) % Wd.ImageCount;
+  Vulkan.getSimulation().getSize() = Options.SimulationSize;
+  Vulkan.getSimulation().getRunning() = true;
 }
 
-int main(int, char **) {
-  try {
-    SDL2pp::SDL SDL(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER);
-    SDL2pp::Window Window(
-        "Dear ImGui SDL2+Vulkan example", SDL_WINDOWPOS_CENTERED,
-        SDL_WINDOWPOS_CENTERED, 1280, 720,
-        SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
-
-    // Setup Vulkan
-    uint32_t ExtensionsCount = 0;
-    SDL_Vulkan_GetInstanceExtensions(Window.Get(), &ExtensionsCount, nullptr);
-    std::vector<char const *> Extensions(ExtensionsCount);
-    SDL_Vulkan_GetInstanceExtensions(Window.Get(), &ExtensionsCount,
-                                     Extensions.data());
-
-    VulkanContext Vulkan("AppName", "EngineName", Extensions, {});
-
-    vk::SurfaceKHR Surface;
-    { // Create Window Surface
-      VkSurfaceKHR LSurface;
-      if (SDL_Vulkan_CreateSurface(Window.Get(), Vulkan.getInstance(),
-                                   &LSurface) == 0) {
-        errsv("Failed to create Vulkan surface.");
-        return 1;
-      }
-      Surface = LSurface;
+/// Adds the fonts from the command line before the atlas is built. Loading
+/// the files is cheap; rasterizing them is what the atlas cache saves.
+static void addFonts(DemoOptions const &Options) {
+  ImFontAtlas &Atlas = *ImGui::GetIO().Fonts;
+  for (std::string const &Path : Options.Fonts) {
+    // ImGui asserts on missing files
+    if (!std::filesystem::is_regular_file(Path)) {
+      errsv("Font <{}> not found", Path);
+      continue;
     }
+    for (float Size : {13.0f, 18.0f, 24.0f})
+      Atlas.AddFontFromFileTTF(Path.c_str(), Size, nullptr,
+                               Atlas.GetGlyphRangesChineseSimplifiedCommon());
+  }
+}
 
-    auto WindowW = Window.GetWidth();
-    auto WindowH = Window.GetHeight();
-
-    Vulkan.setupWindow(Surface, WindowW, WindowH);
-
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO &Io = ImGui::GetIO();
-
-    ImGui::StyleColorsDark();
-
-    ImGui_ImplSDL2_InitForVulkan(Window.Get());
+/// Starts recording rendered frames if asked to. After the font atlas is
+/// uploaded, so that its texture ID is known.
+static std::unique_ptr<DrawCaptureWriter>
+startCapture(DemoOptions const &Options) {
+  if (Options.CapturePath.empty())
+    return nullptr;
+  return std::make_unique<DrawCaptureWriter>(Options.CapturePath,
+                                             ImGui::GetIO().Fonts->TexID);
+}
 
-    ImGui_ImplVulkan_InitInfo InitInfo = {
-        .Instance = Vulkan.getInstance(),
-        .PhysicalDevice = Vulkan.getPhysicalDevice(),
-        .Device = Vulkan.getDevice(),
-        .QueueFamily = Vulkan.getQueueFamilyIndex(),
-        .Queue = Vulkan.getQueue(),
-        .PipelineCache = Vulkan.getPipelineCache(),
-        .DescriptorPool = Vulkan.getDescriptorPool(),
-        .Subpass = 0,
-        .MinImageCount = Vulkan.getMinImageCount(),
-        .ImageCount = Vulkan.getMinImageCount(),
-        .MSAASamples = VK_SAMPLE_COUNT_1_BIT,
-        .Allocator = reinterpret_cast<VkAllocationCallbacks const *>(
-            &Vulkan.getAllocationCallbacks()),
-        .CheckVkResultFn = checkVkResult};
+static void finishTrace(VulkanContext &Vulkan, DemoOptions const &Options) {
+  if (Options.TracePath.empty())
+    return;
+  Vulkan.getProfiler().flush();
+  Vulkan.getProfiler().writeChromeTrace(Options.TracePath);
+}
 
-    ImGui_ImplVulkan_Init(&InitInfo, Vulkan.getMainWindowData().RenderPass);
+static int runWindowed(DemoOptions const &Options) {
+  SDL2pp::SDL SDL(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER);
+  SDL2pp::Window Window(
+      "Dear ImGui SDL2+Vulkan example", SDL_WINDOWPOS_CENTERED,
+      SDL_WINDOWPOS_CENTERED, static_cast<int>(Options.Width),
+      static_cast<int>(Options.Height),
+      SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
+
+  // Setup Vulkan
+  uint32_t ExtensionsCount = 0;
+  SDL_Vulkan_GetInstanceExtensions(Window.Get(), &ExtensionsCount, nullptr);
+  std::vector<char const *> Extensions(ExtensionsCount);
+  SDL_Vulkan_GetInstanceExtensions(Window.Get(), &ExtensionsCount,
+                                   Extensions.data());
+
+  VulkanContext Vulkan("AppName", "EngineName", Extensions, {},
+                       Options.Device);
+
+  vk::SurfaceKHR Surface;
+  { // Create Window Surface
+    VkSurfaceKHR LSurface;
+    if (SDL_Vulkan_CreateSurface(Window.Get(), Vulkan.getInstance(),
+                                 &LSurface) == 0) {
+      errsv("Failed to create Vulkan surface.");
+      return 1;
+    }
+    Surface = LSurface;
+  }
 
-    // Upload Fonts
+  auto WindowW = Window.GetWidth();
+  auto WindowH = Window.GetHeight();
+
+  Vulkan.getFramesInFlight() = Options.FramesInFlight;
+  Vulkan.getMinImageCount() = Options.SwapchainImages;
+  if (Options.PresentMode)
+    Vulkan.setPresentMode(*Options.PresentMode);
+  Vulkan.setupWindow(Surface, WindowW, WindowH);
+
+  IMGUI_CHECKVERSION();
+  ImGui::CreateContext();
+#ifdef IMGUI_HAS_VIEWPORT
+  // ImGui windows dragged out of the main window get OS windows of their
+  // own, rendered and presented in one batch with it
+  ImGui::GetIO().ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;
+#endif
+
+  ImGui::StyleColorsDark();
+
+  ImGui_ImplSDL2_InitForVulkan(Window.Get());
+  addFonts(Options);
+  initImGuiVulkan(Vulkan, Options.FontCachePath);
+#ifdef IMGUI_HAS_VIEWPORT
+  installViewportRenderer(Vulkan);
+#endif
+  std::unique_ptr<DrawCaptureWriter> Capture = startCapture(Options);
+
+  DemoState State;
+  State.ShowProfiler = Options.ShowProfiler;
+  State.Pacer.setEnabled(Options.LowLatency);
+  State.Skipper.setEnabled(Options.OnDemand);
+  startSimulation(Vulkan, Options);
+  auto &Profiler = Vulkan.getProfiler();
+  Profiler.setTracing(!Options.TracePath.empty());
+
+  bool Done = false;
+  for (uint32_t Frame = 0; !Done; ++Frame) {
+    if (Options.Frames != 0 && Frame == Options.Frames)
+      break;
+    Profiler.beginFrame();
+    Vulkan.getHostAllocator().beginFrame();
     {
-      auto &Wd = Vulkan.getMainWindowData();
-      // Use any command queue
-      vk::CommandPool CommandPool = Wd.Frames[Wd.FrameIndex].CommandPool;
-      vk::CommandBuffer CommandBuffer = Wd.Frames[Wd.FrameIndex].CommandBuffer;
-
-      Vulkan.getDevice().resetCommandPool(CommandPool);
-
-      vk::CommandBufferBeginInfo BeginInfo{
-          vk::CommandBufferUsageFlagBits::eOneTimeSubmit};
-
-      CommandBuffer.begin(BeginInfo);
-
-      ImGui_ImplVulkan_CreateFontsTexture(CommandBuffer);
-
-      vk::SubmitInfo EndInfo{VkSubmitInfo{
-          .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-          .commandBufferCount = 1,
-          .pCommandBuffers =
-              reinterpret_cast<VkCommandBuffer const *>(&CommandBuffer)}};
-      CommandBuffer.end();
-      Vulkan.getQueue().submit(1, &EndInfo, VK_NULL_HANDLE);
-      Vulkan.getDevice().waitIdle();
-      ImGui_ImplVulkan_DestroyFontUploadObjects();
+      auto Zone = Profiler.zone("pacer sleep");
+      State.Pacer.sleep();
     }
 
-    ImVec4 ClearColor = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
-
-    bool Done = false;
-    while (!Done) {
-      // Poll and handle events (inputs, window resize, etc.)
-      // You can read the io.WantCaptureMouse, io.WantCaptureKeyboard flags to
-      // tell if dear imgui wants to use your inputs.
-      // - When io.WantCaptureMouse is true, do not dispatch mouse input data to
-      // your main application, or clear/overwrite your copy of the mouse data.
-      // - When io.WantCaptureKeyboard is true, do not dispatch keyboard input
-      // data to your main application, or clear/overwrite your copy of the
-      // keyboard data. Generally you may always pass all inputs to dear imgui,
-      // and hide them from your application based on those two flags.
+    // Poll and handle events (inputs, window resize, etc.)
+    // You can read the io.WantCaptureMouse, io.WantCaptureKeyboard flags to
+    // tell if dear imgui wants to use your inputs.
+    // - When io.WantCaptureMouse is true, do not dispatch mouse input data to
+    // your main application, or clear/overwrite your copy of the mouse data.
+    // - When io.WantCaptureKeyboard is true, do not dispatch keyboard input
+    // data to your main application, or clear/overwrite your copy of the
+    // keyboard data. Generally you may always pass all inputs to dear imgui,
+    // and hide them from your application based on those two flags.
+    // While idle, block until input arrives or the idle timeout expires
+    // instead of spinning
+    {
+      auto Zone = Profiler.zone("poll events");
       SDL_Event Event;
-      while (SDL_PollEvent(&Event)) {
+      int Timeout = State.Skipper.getWaitTimeoutMs();
+      bool HasEvent = Timeout > 0 ? SDL_WaitEventTimeout(&Event, Timeout)
+                                  : SDL_PollEvent(&Event);
+      for (; HasEvent; HasEvent = SDL_PollEvent(&Event)) {
         ImGui_ImplSDL2_ProcessEvent(&Event);
         if (Event.type == SDL_QUIT)
           Done = true;
-        if (Event.type == SDL_WINDOWEVENT &&
-            Event.window.event == SDL_WINDOWEVENT_CLOSE &&
-            Event.window.windowID == SDL_GetWindowID(Window.Get()))
+        if (Event.type != SDL_WINDOWEVENT ||
+            Event.window.windowID != SDL_GetWindowID(Window.Get()))
+          continue;
+        if (Event.window.event == SDL_WINDOWEVENT_CLOSE)
           Done = true;
+        // The window contents may be gone, so draw the next frame anyway
+        if (Event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+            Event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED ||
+            Event.window.event == SDL_WINDOWEVENT_RESTORED)
+          State.Skipper.invalidate();
       }
+    }
 
-      // Resize swap chain?
-      if (Vulkan.getSwapChainRebuild()) {
-        int Width = Window.GetWidth();
-        int Height = Window.GetHeight();
-        if (Width > 0 && Height > 0) {
-          ImGui_ImplVulkan_SetMinImageCount(Vulkan.getMinImageCount());
-          ImGui_ImplVulkanH_CreateOrResizeWindow(
-              Vulkan.getInstance(), Vulkan.getPhysicalDevice(),
-              Vulkan.getDevice(), &Vulkan.getMainWindowData(),
-              Vulkan.getQueueFamilyIndex(),
-              reinterpret_cast<VkAllocationCallbacks const *>(
-                  &Vulkan.getAllocationCallbacks()),
-              Width, Height, Vulkan.getMinImageCount());
-          Vulkan.getMainWindowData().FrameIndex = 0;
-          Vulkan.getSwapChainRebuild() = false;
-        }
+    // Resize swap chain?
+    if (Vulkan.getSwapChainRebuild())
+      State.Skipper.invalidate();
+    rebuildSwapChain(Vulkan, Window.GetWidth(), Window.GetHeight());
+
+    // Start the Dear ImGui frame
+    ImGui_ImplVulkan_NewFrame();
+    ImGui_ImplSDL2_NewFrame();
+    buildFrame(Vulkan, State);
+
+    // Rendering
+#ifdef IMGUI_HAS_VIEWPORT
+    ImGui::UpdatePlatformWindows();
+    std::vector<ImDrawData *> DrawData = viewportDrawData(Vulkan);
+#else
+    std::vector<ImDrawData *> DrawData = {ImGui::GetDrawData()};
+#endif
+    const bool IsMinimized = std::none_of(
+        DrawData.begin(), DrawData.end(), [](ImDrawData const *Data) {
+          return Data && Data->DisplaySize.x > 0.0f &&
+                 Data->DisplaySize.y > 0.0f;
+        });
+    // The other viewports count as part of the frame
+    uint64_t Extra = hashValue(Vulkan.getSimulation().getStep(),
+                               hashValue(State.ClearColor, 0));
+    for (size_t I = 1; I < DrawData.size(); ++I)
+      Extra = hashDrawData(DrawData[I], Extra);
+    bool Changed = State.Skipper.shouldRender(DrawData.front(), Extra);
+    if (!IsMinimized && Changed) {
+      FrameTimings Timings;
+      if (Capture && DrawData.front()) {
+        // Only the main viewport, replay renders a single window
+        auto Zone = Profiler.zone("capture");
+        Capture->add(*DrawData.front());
       }
+      setClearColor(Vulkan, State.ClearColor);
+      frameRender(Vulkan, DrawData, &Timings);
+      framePresent(Vulkan, &Timings);
+      State.Pacer.update(Timings.Wait);
+    } else {
+      // frameRender normally drives the uploads
+      Vulkan.getUploads().submit();
+    }
+  }
 
-      // Start the Dear ImGui frame
-      ImGui_ImplVulkan_NewFrame();
-      ImGui_ImplSDL2_NewFrame();
-      ImGui::NewFrame();
-
-      // Show a simple window that we create ourselves. We use a Begin/End
-      // pair to created a named window.
-      {
-        static float F = 0.0f;
-        static int Counter = 0;
-
-        ImGui::Begin("Hello, world!"); // Create a window called "Hello, world!"
-                                       // and append into it.
-
-        ImGui::Text("This is some useful text."); // Display some text (you can
-                                                  // use a format strings too)
-        ImGui::SliderFloat(
-            "float", &F, 0.0f,
-            1.0f); // Edit 1 float using a slider from 0.0f to 1.0f
-        ImGui::ColorEdit3(
-            "clear color",
-            (float *)&ClearColor); // Edit 3 floats representing a color
-
-        if (ImGui::Button(
-                "Button")) // Buttons return true when clicked (most widgets
-                           // return true when edited/activated)
-          Counter++;
-        ImGui::SameLine();
-        ImGui::Text("counter = %d", Counter);
-
-        ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
-                    1000.0f / ImGui::GetIO().Framerate,
-                    ImGui::GetIO().Framerate);
-        ImGui::End();
-      }
+  Vulkan.getDevice().waitIdle();
+  if (State.Streamed.Image)
+    Vulkan.getUploads().destroyImage(State.Streamed);
+  finishTrace(Vulkan, Options);
+  return 0;
+}
 
-      // Rendering
-      ImGui::Render();
-      ImDrawData *DrawData = ImGui::GetDrawData();
-      const bool IsMinimized =
-          (DrawData->DisplaySize.x <= 0.0f || DrawData->DisplaySize.y <= 0.0f);
-      if (!IsMinimized) {
-        Vulkan.getMainWindowData().ClearValue.color.float32[0] =
-            ClearColor.x * ClearColor.w;
-        Vulkan.getMainWindowData().ClearValue.color.float32[1] =
-            ClearColor.y * ClearColor.w;
-        Vulkan.getMainWindowData().ClearValue.color.float32[2] =
-            ClearColor.z * ClearColor.w;
-        Vulkan.getMainWindowData().ClearValue.color.float32[3] = ClearColor.w;
-        frameRender(Vulkan, DrawData);
-        framePresent(Vulkan);
-      }
-    }
+static int runHeadless(DemoOptions const &Options) {
+  // No surface extensions: VulkanContext skips VK_KHR_swapchain as well
+  VulkanContext Vulkan("AppName", "EngineName", {}, {}, Options.Device);
+  Vulkan.getFramesInFlight() = Options.FramesInFlight;
+  Vulkan.setupOffscreen(Options.Width, Options.Height);
+  Vulkan.getOffscreenTarget()->ReadbackEnabled =
+      Options.HashFrames || !Options.DumpPath.empty();
+
+  IMGUI_CHECKVERSION();
+  ImGui::CreateContext();
+  ImGuiIO &Io = ImGui::GetIO();
+  Io.IniFilename = nullptr; // keep runs reproducible
+  Io.DisplaySize = ImVec2(static_cast<float>(Options.Width),
+                          static_cast<float>(Options.Height));
+
+  ImGui::StyleColorsDark();
+
+  addFonts(Options);
+  initImGuiVulkan(Vulkan, Options.FontCachePath);
+  std::unique_ptr<DrawCaptureWriter> Capture = startCapture(Options);
+
+  DemoState State;
+  State.ShowProfiler = Options.ShowProfiler;
+  startSimulation(Vulkan, Options);
+  auto &Profiler = Vulkan.getProfiler();
+  Profiler.setTracing(!Options.TracePath.empty());
+
+  for (uint32_t Frame = 0; Options.Frames == 0 || Frame < Options.Frames;
+       ++Frame) {
+    Profiler.beginFrame();
+    Vulkan.getHostAllocator().beginFrame();
+    // Fixed time step so that every run produces the same frames
+    Io.DeltaTime = 1.0f / 60.0f;
+
+    ImGui_ImplVulkan_NewFrame();
+    buildFrame(Vulkan, State);
+
+    if (Capture)
+      Capture->add(*ImGui::GetDrawData());
+    setClearColor(Vulkan, State.ClearColor);
+    frameRender(Vulkan, ImGui::GetDrawData());
+    framePresent(Vulkan);
+
+    if (Options.HashFrames)
+      errsv("frame {} hash {:016x}", Frame,
+            hashPixels(Vulkan.readbackOffscreen()));
+  }
 
+  if (!Options.DumpPath.empty())
+    writePpm(Options.DumpPath, Vulkan.readbackOffscreen(), Options.Width,
+             Options.Height);
+
+  Vulkan.getDevice().waitIdle();
+  finishTrace(Vulkan, Options);
+  return 0;
+}
+
+int main(int Argc, char **Argv) {
+  AsyncLog::installCrashHandlers();
+  try {
+    DemoOptions Options = parseDemoOptions(Argc, Argv);
+    return Options.Headless ? runHeadless(Options) : runWindowed(Options);
   } catch (std::exception &E) {
     errsv("Exception occurred: {}", E.what());
     return -1;
   }
-}
\ No newline at end of file
+}
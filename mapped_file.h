@@ -0,0 +1,61 @@
+#pragma once
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <vector>
+
+/// Read-only view of a whole file, memory mapped where the platform allows.
+class MappedFile {
+public:
+  explicit MappedFile(std::filesystem::path const &Path) {
+#if defined(_WIN32)
+    std::ifstream In(Path, std::ios::binary);
+    if (In)
+      Fallback.assign(std::istreambuf_iterator<char>(In),
+                      std::istreambuf_iterator<char>());
+    Data = reinterpret_cast<uint8_t const *>(Fallback.data());
+    Size = Fallback.size();
+#else
+    int Fd = ::open(Path.c_str(), O_RDONLY);
+    if (Fd < 0)
+      return;
+    struct stat Stat;
+    if (::fstat(Fd, &Stat) == 0 && Stat.st_size > 0) {
+      void *Mapped = ::mmap(nullptr, static_cast<size_t>(Stat.st_size),
+                            PROT_READ, MAP_PRIVATE, Fd, 0);
+      if (Mapped != MAP_FAILED) {
+        Data = static_cast<uint8_t const *>(Mapped);
+        Size = static_cast<size_t>(Stat.st_size);
+      }
+    }
+    ::close(Fd);
+#endif
+  }
+  MappedFile(MappedFile const &) = delete;
+  MappedFile &operator=(MappedFile const &) = delete;
+  ~MappedFile() {
+#if !defined(_WIN32)
+    if (Data)
+      ::munmap(const_cast<uint8_t *>(Data), Size);
+#endif
+  }
+
+  std::span<uint8_t const> bytes() const noexcept { return {Data, Size}; }
+
+private:
+  uint8_t const *Data = nullptr;
+  size_t Size = 0;
+#if defined(_WIN32)
+  std::vector<char> Fallback;
+#endif
+};
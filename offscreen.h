@@ -0,0 +1,189 @@
+#pragma once
+
+#include "device_memory.h"
+#include "format.h"
+
+#include <imgui_impl_vulkan.h>
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <tuple>
+
+/// Color image plus the render pass and framebuffer frameRender needs to draw
+/// into it without a swapchain. The image is left in TRANSFER_SRC_OPTIMAL
+/// after the render pass so it can be copied into the host visible readback
+/// buffer.
+struct OffscreenTarget {
+  static constexpr vk::Format Format = vk::Format::eR8G8B8A8Unorm;
+
+  uint32_t Width = 0;
+  uint32_t Height = 0;
+
+  vk::Image Image;
+  DeviceAllocation ImageAllocation;
+  vk::ImageView ImageView;
+  vk::RenderPass RenderPass;
+  vk::Framebuffer Framebuffer;
+
+  vk::Buffer ReadbackBuffer;
+  /// Persistently mapped through the allocator.
+  DeviceAllocation ReadbackAllocation;
+  bool ReadbackEnabled = false;
+
+  vk::DeviceSize getReadbackSize() const noexcept {
+    return vk::DeviceSize{Width} * Height * 4;
+  }
+};
+
+inline OffscreenTarget
+createOffscreenTarget(vk::Device Device, DeviceMemoryAllocator &DeviceMemory,
+                      vk::AllocationCallbacks const &AllocationCallbacks,
+                      uint32_t Width, uint32_t Height) {
+  OffscreenTarget Target;
+  Target.Width = Width;
+  Target.Height = Height;
+
+  { // Color image
+    vk::ImageCreateInfo ImageCreateInfo(
+        {}, vk::ImageType::e2D, OffscreenTarget::Format, {Width, Height, 1}, 1,
+        1, vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+        vk::ImageUsageFlagBits::eColorAttachment |
+            vk::ImageUsageFlagBits::eTransferSrc);
+    std::tie(Target.Image, Target.ImageAllocation) = DeviceMemory.createImage(
+        ImageCreateInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    vk::ImageViewCreateInfo ViewCreateInfo(
+        {}, Target.Image, vk::ImageViewType::e2D, OffscreenTarget::Format, {},
+        {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+    Target.ImageView =
+        Device.createImageView(ViewCreateInfo, AllocationCallbacks);
+  }
+
+  { // Render pass, compatible with the one ImGui builds for a swapchain
+    vk::AttachmentDescription Attachment(
+        {}, OffscreenTarget::Format, vk::SampleCountFlagBits::e1,
+        vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
+        vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferSrcOptimal);
+    vk::AttachmentReference ColorAttachment(
+        0, vk::ImageLayout::eColorAttachmentOptimal);
+    vk::SubpassDescription Subpass({}, vk::PipelineBindPoint::eGraphics, {},
+                                   ColorAttachment);
+    std::array<vk::SubpassDependency, 2> Dependencies = {
+        vk::SubpassDependency(
+            VK_SUBPASS_EXTERNAL, 0,
+            vk::PipelineStageFlagBits::eTransfer |
+                vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            vk::AccessFlagBits::eColorAttachmentWrite,
+            vk::AccessFlagBits::eColorAttachmentWrite),
+        vk::SubpassDependency(
+            0, VK_SUBPASS_EXTERNAL,
+            vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::AccessFlagBits::eColorAttachmentWrite,
+            vk::AccessFlagBits::eTransferRead)};
+    vk::RenderPassCreateInfo RenderPassCreateInfo({}, Attachment, Subpass,
+                                                  Dependencies);
+    Target.RenderPass =
+        Device.createRenderPass(RenderPassCreateInfo, AllocationCallbacks);
+
+    vk::FramebufferCreateInfo FramebufferCreateInfo(
+        {}, Target.RenderPass, Target.ImageView, Width, Height, 1);
+    Target.Framebuffer =
+        Device.createFramebuffer(FramebufferCreateInfo, AllocationCallbacks);
+  }
+
+  { // Host visible readback buffer
+    vk::BufferCreateInfo BufferCreateInfo(
+        {}, Target.getReadbackSize(), vk::BufferUsageFlagBits::eTransferDst);
+    std::tie(Target.ReadbackBuffer, Target.ReadbackAllocation) =
+        DeviceMemory.createBuffer(
+            BufferCreateInfo, vk::MemoryPropertyFlagBits::eHostVisible,
+            vk::MemoryPropertyFlagBits::eHostCached |
+                vk::MemoryPropertyFlagBits::eHostCoherent);
+  }
+
+  return Target;
+}
+
+inline void
+destroyOffscreenTarget(vk::Device Device, DeviceMemoryAllocator &DeviceMemory,
+                       vk::AllocationCallbacks const &AllocationCallbacks,
+                       OffscreenTarget &Target) {
+  DeviceMemory.destroyBuffer(Target.ReadbackBuffer, Target.ReadbackAllocation);
+  Device.destroyFramebuffer(Target.Framebuffer, AllocationCallbacks);
+  Device.destroyRenderPass(Target.RenderPass, AllocationCallbacks);
+  Device.destroyImageView(Target.ImageView, AllocationCallbacks);
+  DeviceMemory.destroyImage(Target.Image, Target.ImageAllocation);
+}
+
+/// Records the copy of the rendered image into the readback buffer. Must be
+/// recorded after the render pass ends.
+inline void recordOffscreenReadback(OffscreenTarget const &Target,
+                                    VkCommandBuffer CommandBuffer) {
+  auto const &Dispatch = VULKAN_HPP_DEFAULT_DISPATCHER;
+  // Frames in flight share the buffer: order against the previous copy
+  VkBufferMemoryBarrier PreviousCopy = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .buffer = Target.ReadbackBuffer,
+      .offset = 0,
+      .size = VK_WHOLE_SIZE};
+  Dispatch.vkCmdPipelineBarrier(CommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                                1, &PreviousCopy, 0, nullptr);
+
+  VkBufferImageCopy Region = {
+      .bufferOffset = 0,
+      .bufferRowLength = 0,
+      .bufferImageHeight = 0,
+      .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+      .imageOffset = {0, 0, 0},
+      .imageExtent = {Target.Width, Target.Height, 1}};
+  Dispatch.vkCmdCopyImageToBuffer(CommandBuffer, Target.Image,
+                                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                  Target.ReadbackBuffer, 1, &Region);
+
+  VkBufferMemoryBarrier Barrier = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .buffer = Target.ReadbackBuffer,
+      .offset = 0,
+      .size = VK_WHOLE_SIZE};
+  Dispatch.vkCmdPipelineBarrier(CommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                                &Barrier, 0, nullptr);
+}
+
+/// 64-bit FNV-1a, good enough to spot a changed frame between runs.
+inline uint64_t hashPixels(std::span<uint8_t const> Pixels) noexcept {
+  uint64_t Hash = 0xcbf29ce484222325ull;
+  for (uint8_t Byte : Pixels) {
+    Hash ^= Byte;
+    Hash *= 0x100000001b3ull;
+  }
+  return Hash;
+}
+
+/// Dumps tightly packed RGBA8 pixels as a binary PPM, dropping alpha.
+inline void writePpm(std::filesystem::path const &Path,
+                     std::span<uint8_t const> Pixels, uint32_t Width,
+                     uint32_t Height) {
+  std::ofstream Out(Path, std::ios::binary | std::ios::trunc);
+  Out << "P6\n" << Width << ' ' << Height << "\n255\n";
+  for (size_t I = 0; I + 3 < Pixels.size(); I += 4)
+    Out.write(reinterpret_cast<char const *>(&Pixels[I]), 3);
+  if (!Out)
+    throw std::runtime_error(
+        fmt::format("Failed to write <{}>", Path.string()));
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "format.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/// Command line switches of the demo.
+struct DemoOptions {
+  /// Render into an offscreen image instead of an SDL window. Needs no WSI,
+  /// so it runs on build machines with a software ICD such as lavapipe.
+  bool Headless = false;
+  /// Physical device by index or name substring, overrides VULKAN_DEVICE
+  /// and the scoring (see selectPhysicalDevice).
+  std::string Device;
+  uint32_t Width = 1280;
+  uint32_t Height = 720;
+  /// Number of frames to render before exiting, 0 means run until closed.
+  /// Headless runs default to a single frame.
+  uint32_t Frames = 0;
+  /// Print a hash of every rendered frame (headless only).
+  bool HashFrames = false;
+  /// Write the last rendered frame to this PPM file (headless only).
+  std::string DumpPath;
+  /// Frames the CPU may record ahead of the GPU. Lower is less latency,
+  /// higher gives more CPU/GPU overlap.
+  uint32_t FramesInFlight = 2;
+  /// Minimum number of swapchain images requested from the surface.
+  uint32_t SwapchainImages = 2;
+  /// Present mode to start with, can be changed from the UI later.
+  std::optional<vk::PresentModeKHR> PresentMode;
+  /// Sleep before polling input so the UI is built close to the vsync
+  /// deadline (see FramePacer).
+  bool LowLatency = false;
+  /// Skip unchanged frames and block for input while idle.
+  bool OnDemand = false;
+  /// Start the compute simulation with this many cells per side, 0 to
+  /// leave it stopped.
+  uint32_t SimulationSize = 0;
+  /// TrueType fonts to load, each at several sizes with the Chinese glyph
+  /// ranges. The default font is used when there are none.
+  std::vector<std::string> Fonts;
+  /// Font atlas cache, rebuilt when the fonts, sizes or ranges change.
+  std::string FontCachePath = "font_atlas.bin";
+  /// Open the profiler overlay at startup.
+  bool ShowProfiler = false;
+  /// Record CPU zones and GPU timestamps and write them here as Chrome
+  /// trace-event JSON on exit.
+  std::string TracePath;
+  /// Record the draw data of every rendered frame here, for replay by the
+  /// bench (see DrawCaptureWriter).
+  std::string CapturePath;
+};
+
+inline void printDemoUsage(char const *Argv0) {
+  errsv("Usage: {} [options]\n"
+        "  --headless         render offscreen, without a window\n"
+        "  --device <N|name>  use this GPU (also VULKAN_DEVICE)\n"
+        "  --size <W>x<H>     framebuffer size (default 1280x720)\n"
+        "  --frames <N>       exit after N frames\n"
+        "  --hash             print a hash of every headless frame\n"
+        "  --dump <file.ppm>  write the last headless frame to a file\n"
+        "  --frames-in-flight <N>  frames recorded ahead of the GPU (1-4)\n"
+        "  --swapchain-images <N>  minimum swapchain image count\n"
+        "  --present-mode <fifo|mailbox|immediate>\n"
+        "  --low-latency      pace frames to sample input late (FIFO)\n"
+        "  --on-demand        only render frames that changed, idle otherwise\n"
+        "  --simulation <N>   run the NxN compute simulation from the start\n"
+        "  --font <file.ttf>  load a font, may be repeated\n"
+        "  --font-cache <file>  font atlas cache (default font_atlas.bin)\n"
+        "  --profiler         show the profiler overlay\n"
+        "  --trace <file>     write a Chrome trace of the run on exit\n"
+        "  --capture <file>   record every rendered frame for bench --replay",
+        Argv0);
+}
+
+inline uint32_t parseUnsigned(std::string_view Flag, std::string_view Value) {
+  uint32_t Result = 0;
+  auto [Ptr, Ec] =
+      std::from_chars(Value.data(), Value.data() + Value.size(), Result);
+  if (Ec != std::errc() || Ptr != Value.data() + Value.size())
+    throw std::invalid_argument(
+        fmt::format("Invalid value <{}> for {}", Value, Flag));
+  return Result;
+}
+
+inline vk::PresentModeKHR parsePresentMode(std::string_view Flag,
+                                           std::string_view Value) {
+  if (Value == "fifo")
+    return vk::PresentModeKHR::eFifo;
+  if (Value == "mailbox")
+    return vk::PresentModeKHR::eMailbox;
+  if (Value == "immediate")
+    return vk::PresentModeKHR::eImmediate;
+  throw std::invalid_argument(
+      fmt::format("Invalid value <{}> for {}", Value, Flag));
+}
+
+/// Parses a "<W>x<H>" pair with both dimensions non-zero.
+inline std::pair<uint32_t, uint32_t> parseSize(std::string_view Flag,
+                                               std::string_view Value) {
+  size_t X = Value.find('x');
+  if (X == std::string_view::npos)
+    throw std::invalid_argument(
+        fmt::format("Invalid value <{}> for {}", Value, Flag));
+  uint32_t Width = parseUnsigned(Flag, Value.substr(0, X));
+  uint32_t Height = parseUnsigned(Flag, Value.substr(X + 1));
+  if (Width == 0 || Height == 0)
+    throw std::invalid_argument("Framebuffer size must be non-zero");
+  return {Width, Height};
+}
+
+/// Parses \p Argv into DemoOptions. Throws std::invalid_argument on malformed
+/// input after printing the usage.
+inline DemoOptions parseDemoOptions(int Argc, char **Argv) {
+  DemoOptions Options;
+  bool FramesGiven = false;
+
+  for (int I = 1; I < Argc; ++I) {
+    std::string_view Arg = Argv[I];
+    auto NextValue = [&]() -> std::string_view {
+      if (I + 1 >= Argc) {
+        printDemoUsage(Argv[0]);
+        throw std::invalid_argument(fmt::format("Missing value for {}", Arg));
+      }
+      return Argv[++I];
+    };
+
+    if (Arg == "--headless") {
+      Options.Headless = true;
+    } else if (Arg == "--device") {
+      Options.Device = NextValue();
+    } else if (Arg == "--size") {
+      std::tie(Options.Width, Options.Height) = parseSize(Arg, NextValue());
+    } else if (Arg == "--frames") {
+      Options.Frames = parseUnsigned(Arg, NextValue());
+      FramesGiven = true;
+    } else if (Arg == "--hash") {
+      Options.HashFrames = true;
+    } else if (Arg == "--dump") {
+      Options.DumpPath = NextValue();
+    } else if (Arg == "--frames-in-flight") {
+      Options.FramesInFlight = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--swapchain-images") {
+      Options.SwapchainImages = parseUnsigned(Arg, NextValue());
+      if (Options.SwapchainImages < 2)
+        throw std::invalid_argument("--swapchain-images must be at least 2");
+    } else if (Arg == "--present-mode") {
+      Options.PresentMode = parsePresentMode(Arg, NextValue());
+    } else if (Arg == "--low-latency") {
+      Options.LowLatency = true;
+    } else if (Arg == "--on-demand") {
+      Options.OnDemand = true;
+    } else if (Arg == "--simulation") {
+      Options.SimulationSize = parseUnsigned(Arg, NextValue());
+    } else if (Arg == "--font") {
+      Options.Fonts.emplace_back(NextValue());
+    } else if (Arg == "--font-cache") {
+      Options.FontCachePath = NextValue();
+    } else if (Arg == "--profiler") {
+      Options.ShowProfiler = true;
+    } else if (Arg == "--trace") {
+      Options.TracePath = NextValue();
+    } else if (Arg == "--capture") {
+      Options.CapturePath = NextValue();
+    } else {
+      printDemoUsage(Argv[0]);
+      throw std::invalid_argument(fmt::format("Unknown option {}", Arg));
+    }
+  }
+
+  if (Options.Headless && !FramesGiven)
+    Options.Frames = 1;
+  return Options;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "format.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+/// Reads a pipeline cache blob previously written by savePipelineCacheData.
+/// The blob is dropped (an empty vector is returned) if its header was
+/// produced by a different driver, device or cache layout, in which case the
+/// driver would ignore it anyway.
+inline std::vector<char>
+loadPipelineCacheData(std::filesystem::path const &Path,
+                      vk::PhysicalDeviceProperties const &Properties) {
+  std::ifstream In(Path, std::ios::binary);
+  if (!In)
+    return {};
+
+  std::vector<char> Data((std::istreambuf_iterator<char>(In)),
+                         std::istreambuf_iterator<char>());
+
+  VkPipelineCacheHeaderVersionOne Header;
+  if (Data.size() < sizeof(Header)) {
+    errsv("Pipeline cache <{}> is truncated, ignoring", Path.string());
+    return {};
+  }
+  std::memcpy(&Header, Data.data(), sizeof(Header));
+
+  if (Header.headerSize < sizeof(Header) || Header.headerSize > Data.size() ||
+      Header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+    errsv("Pipeline cache <{}> has an unknown header, ignoring",
+          Path.string());
+    return {};
+  }
+
+  if (Header.vendorID != Properties.vendorID ||
+      Header.deviceID != Properties.deviceID ||
+      std::memcmp(Header.pipelineCacheUUID, Properties.pipelineCacheUUID.data(),
+                  VK_UUID_SIZE) != 0) {
+    errsv("Pipeline cache <{}> was built for another device or driver, "
+          "ignoring",
+          Path.string());
+    return {};
+  }
+
+  return Data;
+}
+
+/// Writes \p Data next to \p Path and renames it over \p Path, so a crash
+/// mid-write never leaves a torn cache behind for the next launch.
+inline void savePipelineCacheData(std::filesystem::path const &Path,
+                                  std::vector<uint8_t> const &Data) {
+  std::filesystem::path TmpPath = Path;
+  TmpPath += ".tmp";
+
+  {
+    std::ofstream Out(TmpPath, std::ios::binary | std::ios::trunc);
+    Out.write(reinterpret_cast<char const *>(Data.data()),
+              static_cast<std::streamsize>(Data.size()));
+    Out.flush();
+    if (!Out) {
+      errsv("Failed to write pipeline cache <{}>", TmpPath.string());
+      std::error_code Ignored;
+      std::filesystem::remove(TmpPath, Ignored);
+      return;
+    }
+  }
+
+  std::error_code Err;
+  std::filesystem::rename(TmpPath, Path, Err);
+  if (Err)
+    errsv("Failed to replace pipeline cache <{}>: {}", Path.string(),
+          Err.message());
+}
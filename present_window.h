@@ -0,0 +1,33 @@
+#pragma once
+
+#include <imgui_impl_vulkan.h>
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+
+/// A surface the context presents to: its swapchain, the per-image
+/// framebuffers ImGui's window struct points at, and the semaphores that
+/// order acquire, rendering and present. The main window
+/// is one; VulkanContext::addWindow creates more. All of them share the main
+/// window's render pass, are recorded into the same command buffer, go out
+/// in one submit and are presented by one vkQueuePresentKHR.
+struct PresentWindow {
+  ImGui_ImplVulkanH_Window Data;
+  /// Per swapchain image, Data.Frames points in here.
+  std::vector<ImGui_ImplVulkanH_Frame> SwapchainFrames;
+  /// Per frame slot; the image index is unknown until the acquire.
+  std::vector<vk::Semaphore> ImageAcquired;
+  /// Per swapchain image, rebuilt with the swapchain. A present only waits
+  /// on its semaphore, so it is free again once that image is reacquired.
+  std::vector<vk::Semaphore> RenderComplete;
+  /// Size the swapchain is rebuilt at once Rebuild is set. The main window
+  /// gets its size from rebuildSwapChain instead.
+  int RequestedWidth = 0;
+  int RequestedHeight = 0;
+  bool Rebuild = false;
+  /// Set by frameRender for windows it acquired an image of, cleared by
+  /// framePresent.
+  bool PendingPresent = false;
+  /// For the owner, the ImGuiViewport of a viewport window.
+  void *UserData = nullptr;
+};
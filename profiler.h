@@ -0,0 +1,384 @@
+#pragma once
+
+#include "format.h"
+
+#include <imgui.h>
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+inline double millisecondsBetween(Clock::time_point Start,
+                                  Clock::time_point End) noexcept {
+  return std::chrono::duration<double, std::milli>(End - Start).count();
+}
+
+/// GPU timestamps written by frameRender, in command buffer order.
+enum class GpuMark : uint32_t {
+  RenderPassBegin,
+  ImGuiBegin,
+  ImGuiEnd,
+  RenderPassEnd,
+  Count
+};
+
+/// Everything measured for one frame. GPU durations become valid once the
+/// frame has been resolved, FrameProfiler::FramesBehind frames later.
+struct FrameRecord {
+  struct CpuZone {
+    char const *Name;
+    Clock::time_point Start;
+    Clock::time_point End;
+  };
+
+  uint64_t Frame = 0;
+  Clock::time_point Begin;
+  Clock::time_point Submit;
+  std::vector<CpuZone> CpuZones;
+  bool GpuValid = false;
+  double GpuRenderPassMs = 0;
+  double GpuImGuiMs = 0;
+  /// Offset of the first GPU timestamp from Submit, in CPU milliseconds.
+  /// Without calibrated timestamps the GPU track is anchored at submit time.
+  double GpuImGuiOffsetMs = 0;
+
+  double cpuMs() const noexcept {
+    return CpuZones.empty() ? 0.0
+                            : millisecondsBetween(Begin, CpuZones.back().End);
+  }
+};
+
+/// CPU scoped zones plus per-frame GPU timestamp queries. GPU results are
+/// read back FramesBehind frames late without VK_QUERY_RESULT_WAIT_BIT, so
+/// profiling never stalls the frame; a frame whose queries are still pending
+/// at that point simply has no GPU data.
+class FrameProfiler {
+public:
+  static constexpr uint32_t FramesBehind = 4;
+  static constexpr size_t HistorySize = 240;
+  /// Trace events kept while tracing, about half an hour of frames at 60
+  /// fps; older events are dropped first and counted.
+  static constexpr size_t MaxTraceEvents = size_t(1) << 20;
+
+  class Zone {
+  public:
+    Zone(FrameProfiler &Profiler, char const *Name)
+        : Profiler(Profiler), Name(Name), Start(Clock::now()) {}
+    Zone(Zone const &) = delete;
+    Zone &operator=(Zone const &) = delete;
+    ~Zone() { Profiler.addCpuZone(Name, Start, Clock::now()); }
+
+  private:
+    FrameProfiler &Profiler;
+    char const *Name;
+    Clock::time_point Start;
+  };
+
+  void init(vk::PhysicalDevice PhysicalDevice, vk::Device Device,
+            uint32_t QueueFamilyIndex,
+            vk::AllocationCallbacks const &AllocationCallbacks) {
+    this->Device = Device;
+    TimeOrigin = Clock::now();
+
+    uint32_t ValidBits =
+        PhysicalDevice.getQueueFamilyProperties()[QueueFamilyIndex]
+            .timestampValidBits;
+    if (ValidBits == 0) {
+      errsv("Queue family {} has no timestamp support, GPU profiling is off",
+            QueueFamilyIndex);
+      return;
+    }
+    TimestampMask = ValidBits >= 64 ? ~0ull : (1ull << ValidBits) - 1;
+    TimestampPeriodNs = PhysicalDevice.getProperties().limits.timestampPeriod;
+
+    vk::QueryPoolCreateInfo QueryPoolCreateInfo(
+        {}, vk::QueryType::eTimestamp, Slots * MarksPerFrame);
+    QueryPool =
+        Device.createQueryPool(QueryPoolCreateInfo, AllocationCallbacks);
+    SlotFrame.fill(NoFrame);
+  }
+
+  /// Releases the query pool; the device must be idle. Frames recorded
+  /// afterwards get CPU zones only.
+  void destroy(vk::Device Device,
+               vk::AllocationCallbacks const &AllocationCallbacks) {
+    if (!QueryPool)
+      return;
+    Device.destroyQueryPool(QueryPool, AllocationCallbacks);
+    QueryPool = VK_NULL_HANDLE;
+  }
+
+  /// Starts a new frame and resolves the one recorded FramesBehind frames ago.
+  void beginFrame() {
+    ++Frame;
+    resolve(Frame - FramesBehind);
+    FrameRecord &Record = current();
+    Record.Frame = Frame;
+    Record.Begin = Clock::now();
+    Record.Submit = Record.Begin;
+    Record.CpuZones.clear();
+    Record.GpuValid = false;
+  }
+
+  Zone zone(char const *Name) { return Zone(*this, Name); }
+
+  void addCpuZone(char const *Name, Clock::time_point Start,
+                  Clock::time_point End) {
+    current().CpuZones.push_back({Name, Start, End});
+  }
+
+  /// Must be recorded outside of a render pass, before any other mark.
+  void beginGpuFrame(VkCommandBuffer CommandBuffer) {
+    if (!QueryPool)
+      return;
+    uint32_t Slot = Frame % Slots;
+    VULKAN_HPP_DEFAULT_DISPATCHER.vkCmdResetQueryPool(
+        CommandBuffer, QueryPool, Slot * MarksPerFrame, MarksPerFrame);
+    SlotFrame[Slot] = Frame;
+    mark(CommandBuffer, GpuMark::RenderPassBegin);
+  }
+
+  void mark(VkCommandBuffer CommandBuffer, GpuMark Mark) {
+    if (!QueryPool)
+      return;
+    bool const IsBegin =
+        Mark == GpuMark::RenderPassBegin || Mark == GpuMark::ImGuiBegin;
+    VULKAN_HPP_DEFAULT_DISPATCHER.vkCmdWriteTimestamp(
+        CommandBuffer,
+        IsBegin ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+                : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        QueryPool,
+        (Frame % Slots) * MarksPerFrame + static_cast<uint32_t>(Mark));
+  }
+
+  void markSubmit() { current().Submit = Clock::now(); }
+
+  /// Resolves every frame that is still pending. Only call once the GPU is
+  /// idle, e.g. before exporting a trace at exit.
+  void flush() {
+    for (uint64_t F = Frame >= FramesBehind ? Frame + 1 - FramesBehind : 1;
+         F <= Frame; ++F)
+      resolve(F);
+    // Keep the next beginFrame from resolving these again
+    Frame += FramesBehind;
+  }
+
+  /// Called with every frame once its GPU results are in.
+  void setFrameCallback(std::function<void(FrameRecord const &)> Callback) {
+    FrameCallback = std::move(Callback);
+  }
+
+  void setTracing(bool Enable) { Tracing = Enable; }
+  bool isTracing() const noexcept { return Tracing; }
+
+  /// Writes the frames resolved while tracing was enabled, up to the last
+  /// MaxTraceEvents events, as Chrome trace-event JSON (chrome://tracing,
+  /// Perfetto).
+  void writeChromeTrace(std::filesystem::path const &Path) const {
+    std::ofstream Out(Path, std::ios::trunc);
+    Out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+           "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+           "\"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n"
+           "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+           "\"tid\": 2, \"args\": {\"name\": \"GPU\"}}";
+    for (TraceEvent const &Event : Trace)
+      Out << fmt::format(",\n{{\"name\": \"{}\", \"ph\": \"X\", \"pid\": 1, "
+                         "\"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}, "
+                         "\"args\": {{\"frame\": {}}}}}",
+                         jsonEscape(Event.Name), Event.Gpu ? 2 : 1,
+                         Event.StartUs, Event.DurationUs, Event.Frame);
+    Out << "\n]}\n";
+    if (!Out)
+      throw std::runtime_error(
+          fmt::format("Failed to write <{}>", Path.string()));
+    errsv("Wrote {} trace events to <{}>, {} older ones dropped",
+          Trace.size(), Path.string(), TraceDropped);
+  }
+
+  /// Live panel with averages over the last HistorySize frames.
+  void drawOverlay(bool *Open = nullptr) {
+    if (!ImGui::Begin("Profiler", Open)) {
+      ImGui::End();
+      return;
+    }
+
+    struct ZoneStats {
+      char const *Name;
+      double TotalMs;
+      uint32_t Count;
+    };
+    std::vector<ZoneStats> Zones;
+    std::array<float, HistorySize> CpuFrameMs{};
+    std::array<float, HistorySize> GpuFrameMs{};
+    double GpuRenderPassMs = 0;
+    double GpuImGuiMs = 0;
+    uint32_t GpuFrames = 0;
+
+    // Only frames that are fully resolved, oldest first
+    size_t Count = 0;
+    for (uint64_t F = Frame > HistorySize ? Frame - HistorySize + 1 : 1;
+         F + FramesBehind <= Frame; ++F) {
+      FrameRecord const &Record = History[F % HistorySize];
+      if (Record.Frame != F)
+        continue;
+      for (FrameRecord::CpuZone const &Z : Record.CpuZones) {
+        auto It = std::find_if(Zones.begin(), Zones.end(),
+                               [&](ZoneStats const &S) {
+                                 return S.Name == Z.Name;
+                               });
+        if (It == Zones.end()) {
+          Zones.push_back({Z.Name, 0.0, 0});
+          It = Zones.end() - 1;
+        }
+        It->TotalMs += millisecondsBetween(Z.Start, Z.End);
+        ++It->Count;
+      }
+      CpuFrameMs[Count] = static_cast<float>(Record.cpuMs());
+      if (Record.GpuValid) {
+        GpuRenderPassMs += Record.GpuRenderPassMs;
+        GpuImGuiMs += Record.GpuImGuiMs;
+        ++GpuFrames;
+        GpuFrameMs[Count] = static_cast<float>(Record.GpuRenderPassMs);
+      }
+      ++Count;
+    }
+
+    ImGui::Text("CPU (avg of %zu frames)", Count);
+    for (ZoneStats const &S : Zones)
+      ImGui::BulletText("%-16s %.3f ms", S.Name,
+                        S.TotalMs / std::max(Count, size_t{1}));
+    ImGui::PlotLines("##cpu", CpuFrameMs.data(), static_cast<int>(Count), 0,
+                     "CPU frame ms", 0.0f, FLT_MAX, ImVec2(0, 40));
+
+    if (!QueryPool) {
+      ImGui::TextUnformatted("GPU timestamps unsupported");
+    } else {
+      ImGui::Text("GPU (%u frames resolved)", GpuFrames);
+      ImGui::BulletText("%-16s %.3f ms", "render pass",
+                        GpuRenderPassMs / std::max(GpuFrames, 1u));
+      ImGui::BulletText("%-16s %.3f ms", "imgui draw",
+                        GpuImGuiMs / std::max(GpuFrames, 1u));
+      ImGui::PlotLines("##gpu", GpuFrameMs.data(), static_cast<int>(Count), 0,
+                       "GPU render pass ms", 0.0f, FLT_MAX, ImVec2(0, 40));
+    }
+
+    ImGui::Checkbox("Record trace", &Tracing);
+    ImGui::SameLine();
+    ImGui::Text("%zu events, %llu dropped", Trace.size(),
+                static_cast<unsigned long long>(TraceDropped));
+    if (ImGui::Button("Save trace.json"))
+      writeChromeTrace("trace.json");
+    ImGui::SameLine();
+    if (ImGui::Button("Clear")) {
+      Trace.clear();
+      TraceDropped = 0;
+    }
+    ImGui::End();
+  }
+
+private:
+  static constexpr uint32_t MarksPerFrame =
+      static_cast<uint32_t>(GpuMark::Count);
+  /// Query slots in the pool; one more than FramesBehind so the slot being
+  /// resolved is never the one being recorded.
+  static constexpr uint32_t Slots = FramesBehind + 1;
+  static constexpr uint64_t NoFrame = ~0ull;
+
+  struct TraceEvent {
+    char const *Name;
+    uint64_t Frame;
+    bool Gpu;
+    double StartUs;
+    double DurationUs;
+  };
+
+  FrameRecord &current() noexcept { return History[Frame % HistorySize]; }
+
+  void resolve(uint64_t F) {
+    if (F == 0 || F > Frame || Frame - F >= HistorySize)
+      return;
+    FrameRecord &Record = History[F % HistorySize];
+    if (Record.Frame != F)
+      return;
+
+    uint32_t Slot = F % Slots;
+    if (QueryPool && SlotFrame[Slot] == F) {
+      // Value and availability word per query
+      std::array<uint64_t, MarksPerFrame * 2> Results{};
+      VkResult Err = VULKAN_HPP_DEFAULT_DISPATCHER.vkGetQueryPoolResults(
+          Device, QueryPool, Slot * MarksPerFrame, MarksPerFrame,
+          sizeof(Results), Results.data(), 2 * sizeof(uint64_t),
+          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+      bool Available = Err == VK_SUCCESS || Err == VK_NOT_READY;
+      for (uint32_t I = 0; I < MarksPerFrame; ++I)
+        Available = Available && Results[I * 2 + 1] != 0;
+      if (Available) {
+        auto Ticks = [&](GpuMark Mark) {
+          return Results[static_cast<uint32_t>(Mark) * 2] & TimestampMask;
+        };
+        auto Ms = [&](GpuMark From, GpuMark To) {
+          return static_cast<double>((Ticks(To) - Ticks(From)) &
+                                     TimestampMask) *
+                 TimestampPeriodNs / 1e6;
+        };
+        Record.GpuValid = true;
+        Record.GpuRenderPassMs =
+            Ms(GpuMark::RenderPassBegin, GpuMark::RenderPassEnd);
+        Record.GpuImGuiMs = Ms(GpuMark::ImGuiBegin, GpuMark::ImGuiEnd);
+        Record.GpuImGuiOffsetMs =
+            Ms(GpuMark::RenderPassBegin, GpuMark::ImGuiBegin);
+      }
+      SlotFrame[Slot] = NoFrame;
+    }
+
+    if (Tracing)
+      appendTrace(Record);
+    if (FrameCallback)
+      FrameCallback(Record);
+  }
+
+  void appendTrace(FrameRecord const &Record) {
+    auto Us = [&](Clock::time_point T) {
+      return std::chrono::duration<double, std::micro>(T - TimeOrigin).count();
+    };
+    for (FrameRecord::CpuZone const &Z : Record.CpuZones)
+      Trace.push_back({Z.Name, Record.Frame, false, Us(Z.Start),
+                       Us(Z.End) - Us(Z.Start)});
+    if (Record.GpuValid) {
+      double Base = Us(Record.Submit);
+      Trace.push_back({"render pass", Record.Frame, true, Base,
+                       Record.GpuRenderPassMs * 1e3});
+      Trace.push_back({"imgui draw", Record.Frame, true,
+                       Base + Record.GpuImGuiOffsetMs * 1e3,
+                       Record.GpuImGuiMs * 1e3});
+    }
+    while (Trace.size() > MaxTraceEvents) {
+      Trace.pop_front();
+      ++TraceDropped;
+    }
+  }
+
+  vk::Device Device;
+  VkQueryPool QueryPool = VK_NULL_HANDLE;
+  uint64_t TimestampMask = ~0ull;
+  float TimestampPeriodNs = 1.0f;
+  std::array<uint64_t, Slots> SlotFrame{};
+
+  uint64_t Frame = 0;
+  std::array<FrameRecord, HistorySize> History;
+  Clock::time_point TimeOrigin;
+
+  bool Tracing = false;
+  std::deque<TraceEvent> Trace;
+  uint64_t TraceDropped = 0;
+  std::function<void(FrameRecord const &)> FrameCallback;
+};
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+/// Records draw commands for one layer of the frame into a secondary command
+/// buffer that continues the frame's render pass. Layers may be recorded on
+/// any thread, concurrently with each other, so they must not share mutable
+/// state.
+using RenderLayer =
+    std::function<void(vk::CommandBuffer CommandBuffer, vk::Extent2D Extent)>;
+
+/// Worker threads that record RenderLayers into secondary command buffers.
+/// Each thread owns one command pool per frame in flight, reset when the
+/// frame comes around again, so recording never takes a lock. The calling
+/// thread records its own layer while the workers run and then executes all
+/// of them in a fixed order.
+class RecordPool {
+public:
+  /// Hard limit, the useful count is well below this on most hosts.
+  static constexpr uint32_t MaxThreads = 16;
+
+  RecordPool() = default;
+  RecordPool(RecordPool const &) = delete;
+  RecordPool &operator=(RecordPool const &) = delete;
+
+  /// \p Threads workers plus the calling thread; with none, record() runs
+  /// every layer on the caller.
+  void create(vk::Device Device, uint32_t QueueFamilyIndex,
+              vk::AllocationCallbacks const &AllocationCallbacks,
+              uint32_t Frames, uint32_t Threads) {
+    destroy(Device, AllocationCallbacks);
+    this->Device = Device;
+    Threads = std::min(Threads, MaxThreads);
+    // The caller gets the last set of pools
+    Pools.resize(Threads + 1);
+    for (auto &ThreadPools : Pools) {
+      ThreadPools.resize(Frames);
+      for (PerFrame &P : ThreadPools)
+        P.Pool = Device.createCommandPool(
+            {vk::CommandPoolCreateFlagBits::eTransient, QueueFamilyIndex},
+            AllocationCallbacks);
+    }
+    Stop = false;
+    for (uint32_t I = 0; I < Threads; ++I)
+      Workers.emplace_back([this, I] { workerMain(I); });
+  }
+
+  void destroy(vk::Device Device,
+               vk::AllocationCallbacks const &AllocationCallbacks) {
+    {
+      std::lock_guard Lock(Mutex);
+      Stop = true;
+    }
+    WorkCv.notify_all();
+    for (std::thread &Worker : Workers)
+      Worker.join();
+    Workers.clear();
+    for (auto &ThreadPools : Pools)
+      for (PerFrame &P : ThreadPools)
+        Device.destroyCommandPool(P.Pool, AllocationCallbacks);
+    Pools.clear();
+  }
+
+  uint32_t threadCount() const noexcept {
+    return static_cast<uint32_t>(Workers.size());
+  }
+
+  /// Records \p Layers on the workers and \p Last on the calling thread, for
+  /// frame slot \p Frame whose previous submission must have completed.
+  /// Returns the secondary buffers in layer order, Last at the end.
+  std::vector<vk::CommandBuffer>
+  record(uint32_t Frame, vk::CommandBufferInheritanceInfo const &Inheritance,
+         vk::Extent2D Extent, std::span<RenderLayer const> Layers,
+         RenderLayer const &Last) {
+    for (auto &ThreadPools : Pools) {
+      PerFrame &P = ThreadPools[Frame];
+      Device.resetCommandPool(P.Pool);
+      P.Used = 0;
+    }
+
+    std::vector<vk::CommandBuffer> Buffers(Layers.size() + 1);
+    uint32_t Caller = static_cast<uint32_t>(Pools.size()) - 1;
+    if (Workers.empty() || Layers.empty()) {
+      for (size_t I = 0; I < Layers.size(); ++I)
+        Buffers[I] = recordLayer(Caller, Frame, Inheritance, Extent, Layers[I]);
+    } else {
+      {
+        std::lock_guard Lock(Mutex);
+        Job = {Frame, &Inheritance, Extent, Layers, Buffers.data()};
+        Next = 0;
+        Pending = static_cast<uint32_t>(Workers.size());
+        ++Generation;
+      }
+      WorkCv.notify_all();
+    }
+
+    Buffers.back() = recordLayer(Caller, Frame, Inheritance, Extent, Last);
+
+    if (!Workers.empty() && !Layers.empty()) {
+      std::unique_lock Lock(Mutex);
+      DoneCv.wait(Lock, [this] { return Pending == 0; });
+    }
+    return Buffers;
+  }
+
+private:
+  struct PerFrame {
+    vk::CommandPool Pool;
+    std::vector<vk::CommandBuffer> Buffers;
+    /// Buffers handed out since the last reset.
+    size_t Used = 0;
+  };
+
+  struct Work {
+    uint32_t Frame = 0;
+    vk::CommandBufferInheritanceInfo const *Inheritance = nullptr;
+    vk::Extent2D Extent;
+    std::span<RenderLayer const> Layers;
+    vk::CommandBuffer *Buffers = nullptr;
+  };
+
+  vk::CommandBuffer
+  recordLayer(uint32_t Thread, uint32_t Frame,
+              vk::CommandBufferInheritanceInfo const &Inheritance,
+              vk::Extent2D Extent, RenderLayer const &Layer) {
+    PerFrame &P = Pools[Thread][Frame];
+    if (P.Used == P.Buffers.size())
+      P.Buffers.push_back(
+          Device
+              .allocateCommandBuffers(
+                  {P.Pool, vk::CommandBufferLevel::eSecondary, 1})
+              .front());
+    vk::CommandBuffer Buffer = P.Buffers[P.Used++];
+    Buffer.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+                      vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+                  &Inheritance});
+    Layer(Buffer, Extent);
+    Buffer.end();
+    return Buffer;
+  }
+
+  void workerMain(uint32_t Thread) {
+    uint64_t Seen = 0;
+    while (true) {
+      Work W;
+      {
+        std::unique_lock Lock(Mutex);
+        WorkCv.wait(Lock, [&] { return Stop || Generation != Seen; });
+        if (Stop)
+          return;
+        Seen = Generation;
+        W = Job;
+      }
+      // Layers are taken dynamically, so one slow layer does not hold up
+      // the ones behind it
+      for (size_t I = Next++; I < W.Layers.size(); I = Next++)
+        W.Buffers[I] = recordLayer(Thread, W.Frame, *W.Inheritance, W.Extent,
+                                   W.Layers[I]);
+      {
+        std::lock_guard Lock(Mutex);
+        if (--Pending != 0)
+          continue;
+      }
+      DoneCv.notify_one();
+    }
+  }
+
+  vk::Device Device;
+  /// Pools[Thread][Frame], the calling thread last.
+  std::vector<std::vector<PerFrame>> Pools;
+  std::vector<std::thread> Workers;
+
+  std::mutex Mutex;
+  std::condition_variable WorkCv;
+  std::condition_variable DoneCv;
+  Work Job;
+  uint64_t Generation = 0;
+  uint32_t Pending = 0;
+  bool Stop = false;
+  std::atomic<size_t> Next{0};
+};
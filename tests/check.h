@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+/// Assertion for the test executables that stays on in release builds and
+/// names the failing line, so ctest output is enough to find it.
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    if (!(Condition)) {                                                        \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,    \
+                   #Condition);                                                \
+      std::exit(1);                                                            \
+    }                                                                          \
+  } while (false)
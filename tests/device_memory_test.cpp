@@ -0,0 +1,109 @@
+#include "check.h"
+#include "device_memory.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <optional>
+
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+namespace {
+
+constexpr vk::DeviceSize BlockSize = vk::DeviceSize{64} << 10;
+
+void testBuddySplitAndCoalesce() {
+  MemoryBlockRanges Ranges(BlockSize, AllocationStrategy::Buddy);
+  CHECK(Ranges.largestFree() == BlockSize);
+
+  // The smallest range is MinBuddySize, larger requests round up to a power
+  // of two and are aligned to it
+  CHECK(Ranges.allocate(1, 1) == 0);
+  CHECK(Ranges.allocate(256, 1) == 256);
+  CHECK(Ranges.allocate(1000, 1) == 1024);
+  CHECK(Ranges.allocate(300, 4096) == 4096);
+  CHECK(Ranges.getUsed() == 256 + 256 + 1024 + 4096);
+  CHECK(Ranges.getAllocations() == 4);
+  CHECK(Ranges.largestFree() == BlockSize / 2);
+
+  // Freed out of order, buddies only merge once both halves are free
+  Ranges.release(1024);
+  Ranges.release(0);
+  CHECK(Ranges.largestFree() == BlockSize / 2);
+  Ranges.release(4096);
+  Ranges.release(256);
+  CHECK(Ranges.getUsed() == 0);
+  CHECK(Ranges.getAllocations() == 0);
+  CHECK(Ranges.largestFree() == BlockSize);
+
+  CHECK(Ranges.allocate(BlockSize, 1) == 0);
+  CHECK(!Ranges.allocate(1, 1));
+  Ranges.release(0);
+  CHECK(!Ranges.allocate(BlockSize + 1, 1));
+  CHECK(Ranges.allocate(1, BlockSize) == 0);
+}
+
+void testBuddyChurn() {
+  MemoryBlockRanges Ranges(BlockSize, AllocationStrategy::Buddy);
+  // Offset -> end of every live range, to catch overlaps
+  std::map<vk::DeviceSize, vk::DeviceSize> Live;
+  uint32_t Seed = 12345;
+  auto Next = [&Seed] {
+    Seed = Seed * 1664525u + 1013904223u;
+    return Seed >> 8;
+  };
+  for (int Step = 0; Step < 20000; ++Step) {
+    if (!Live.empty() && Next() % 3 == 0) {
+      auto It = Live.begin();
+      std::advance(It, Next() % Live.size());
+      Ranges.release(It->first);
+      Live.erase(It);
+      continue;
+    }
+    vk::DeviceSize Size = 1 + Next() % 3000;
+    vk::DeviceSize Alignment = vk::DeviceSize{1} << (Next() % 12);
+    std::optional<vk::DeviceSize> Offset = Ranges.allocate(Size, Alignment);
+    if (!Offset)
+      continue;
+    vk::DeviceSize Span = std::bit_ceil(
+        std::max({Size, Alignment, MemoryBlockRanges::MinBuddySize}));
+    CHECK(*Offset % Span == 0);
+    CHECK(*Offset + Span <= BlockSize);
+    auto After = Live.lower_bound(*Offset);
+    CHECK(After == Live.end() || After->first >= *Offset + Span);
+    CHECK(After == Live.begin() || std::prev(After)->second <= *Offset);
+    Live.emplace(*Offset, *Offset + Span);
+  }
+  CHECK(Ranges.getAllocations() == Live.size());
+  for (auto [Offset, End] : Live)
+    Ranges.release(Offset);
+  CHECK(Ranges.getUsed() == 0);
+  CHECK(Ranges.largestFree() == BlockSize);
+}
+
+void testLinear() {
+  MemoryBlockRanges Ranges(4096, AllocationStrategy::Linear);
+  CHECK(Ranges.allocate(100, 1) == 0);
+  CHECK(Ranges.allocate(10, 64) == 128);
+  CHECK(Ranges.getUsed() == 138);
+  CHECK(Ranges.largestFree() == 4096 - 138);
+  CHECK(!Ranges.allocate(4000, 1));
+
+  // Space only comes back once the whole batch is freed
+  Ranges.release(0);
+  CHECK(Ranges.getUsed() == 138);
+  Ranges.release(128);
+  CHECK(Ranges.getUsed() == 0);
+  CHECK(Ranges.allocate(4096, 1) == 0);
+}
+
+} // namespace
+
+int main() {
+  testBuddySplitAndCoalesce();
+  testBuddyChurn();
+  testLinear();
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include "check.h"
+#include "device_select.h"
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+namespace {
+
+using F = vk::QueueFlagBits;
+
+std::optional<QueueTopology>
+select(std::vector<std::pair<vk::QueueFlags, uint32_t>> const &Families) {
+  std::vector<vk::QueueFamilyProperties> Queues;
+  for (auto [Flags, Count] : Families)
+    Queues.push_back(vk::QueueFamilyProperties(Flags, Count));
+  return selectQueueTopology(Queues);
+}
+
+void testDiscreteLayout() {
+  // Graphics, async compute and DMA families, as on most discrete GPUs
+  std::optional<QueueTopology> Topology =
+      select({{F::eGraphics | F::eCompute | F::eTransfer, 16},
+              {F::eCompute | F::eTransfer, 8},
+              {F::eTransfer, 2}});
+  CHECK(Topology);
+  CHECK(Topology->Graphics == 0);
+  CHECK(Topology->Compute == 1);
+  CHECK(Topology->Transfer == 2);
+  CHECK(Topology->hasAsyncCompute());
+  CHECK(Topology->hasDedicatedTransfer());
+}
+
+void testSingleFamily() {
+  std::optional<QueueTopology> Topology =
+      select({{F::eGraphics | F::eCompute | F::eTransfer, 1}});
+  CHECK(Topology);
+  CHECK(Topology->Graphics == 0 && Topology->Compute == 0 &&
+        Topology->Transfer == 0);
+  CHECK(!Topology->hasAsyncCompute());
+  CHECK(!Topology->hasDedicatedTransfer());
+}
+
+void testTransferFallsBackToCompute() {
+  // No transfer-only family: copies share the async compute family
+  std::optional<QueueTopology> Topology =
+      select({{F::eGraphics | F::eCompute | F::eTransfer, 1},
+              {F::eCompute | F::eTransfer, 1}});
+  CHECK(Topology);
+  CHECK(Topology->Compute == 1);
+  CHECK(Topology->Transfer == 1);
+}
+
+void testGraphicsPreference() {
+  // A graphics family that also computes wins over one that does not, and
+  // families without queues do not count
+  std::optional<QueueTopology> Topology =
+      select({{F::eGraphics, 1},
+              {F::eGraphics | F::eCompute, 0},
+              {F::eGraphics | F::eCompute, 1},
+              {F::eTransfer, 1}});
+  CHECK(Topology);
+  CHECK(Topology->Graphics == 2);
+  CHECK(Topology->Compute == 2);
+  CHECK(Topology->Transfer == 3);
+
+  Topology = select({{F::eGraphics, 1}});
+  CHECK(Topology && Topology->Graphics == 0);
+}
+
+void testNoGraphics() {
+  CHECK(!select({{F::eCompute | F::eTransfer, 4}, {F::eTransfer, 1}}));
+  CHECK(!select({{F::eGraphics | F::eCompute, 0}}));
+  CHECK(!select({}));
+}
+
+} // namespace
+
+int main() {
+  testDiscreteLayout();
+  testSingleFamily();
+  testTransferFallsBackToCompute();
+  testGraphicsPreference();
+  testNoGraphics();
+  return 0;
+}
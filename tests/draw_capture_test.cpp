@@ -0,0 +1,219 @@
+#include "check.h"
+#include "draw_capture.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+/// Two lists, the first with a font draw, a draw of another texture, a
+/// state reset and a user callback.
+struct TestFrame {
+  ImDrawList A{nullptr};
+  ImDrawList B{nullptr};
+  ImDrawList *Lists[2] = {&A, &B};
+  ImDrawData Data;
+
+  static void userCallback(ImDrawList const *, ImDrawCmd const *) {}
+
+  TestFrame() {
+    for (int I = 0; I < 7; ++I)
+      A.VtxBuffer.push_back({ImVec2(float(I), 1), ImVec2(0, 0), 0xffu});
+    for (int I = 0; I < 9; ++I)
+      A.IdxBuffer.push_back(ImDrawIdx(I % 7));
+    ImDrawCmd Cmd;
+    Cmd.ElemCount = 6;
+    Cmd.TextureId = Font;
+    A.CmdBuffer.push_back(Cmd);
+    Cmd.IdxOffset = 6;
+    Cmd.ElemCount = 3;
+    Cmd.TextureId = Other;
+    A.CmdBuffer.push_back(Cmd);
+    Cmd = ImDrawCmd();
+    Cmd.UserCallback = ImDrawCallback_ResetRenderState;
+    A.CmdBuffer.push_back(Cmd);
+    Cmd.UserCallback = userCallback;
+    A.CmdBuffer.push_back(Cmd);
+
+    for (int I = 0; I < 3; ++I) {
+      B.VtxBuffer.push_back({ImVec2(2, 2), ImVec2(1, 1), 7});
+      B.IdxBuffer.push_back(ImDrawIdx(I));
+    }
+    Cmd = ImDrawCmd();
+    Cmd.ElemCount = 3;
+    Cmd.TextureId = Font;
+    B.CmdBuffer.push_back(Cmd);
+
+    Data.Valid = true;
+    Data.CmdListsCount = 2;
+    Data.CmdLists = Lists;
+    Data.TotalVtxCount = A.VtxBuffer.Size + B.VtxBuffer.Size;
+    Data.TotalIdxCount = A.IdxBuffer.Size + B.IdxBuffer.Size;
+    Data.DisplaySize = ImVec2(640, 480);
+    Data.FramebufferScale = ImVec2(2, 2);
+  }
+
+  static inline ImTextureID const Font = reinterpret_cast<ImTextureID>(0x1234);
+  static inline ImTextureID const Other = reinterpret_cast<ImTextureID>(0x99);
+};
+
+constexpr size_t FrameCount = 100;
+
+std::filesystem::path const &capturePath() {
+  static std::filesystem::path const Path =
+      std::filesystem::temp_directory_path() / "draw_capture_test.imdraw";
+  return Path;
+}
+
+/// Captures FrameCount frames, the first vertex moving by one per frame.
+/// Returns the size of one frame in the file.
+size_t writeCapture() {
+  TestFrame Frame;
+  std::vector<uint8_t> Bytes;
+  draw_capture::serialize(Frame.Data, Bytes);
+  DrawCaptureWriter Writer(capturePath(), TestFrame::Font);
+  for (size_t I = 0; I < FrameCount; ++I) {
+    Frame.A.VtxBuffer[0].pos.x = float(I);
+    Writer.add(Frame.Data);
+  }
+  return Bytes.size();
+}
+
+void testSerialize() {
+  TestFrame Frame;
+  std::vector<uint8_t> Bytes;
+  CHECK(draw_capture::serialize(Frame.Data, Bytes) == 1);
+
+  draw_capture::FrameHeader Header;
+  std::memcpy(&Header, Bytes.data(), sizeof(Header));
+  CHECK(Header.Size == Bytes.size());
+  CHECK(Header.ListCount == 2);
+  CHECK(Header.TotalVtxCount == 10 && Header.TotalIdxCount == 12);
+
+  // The user callback is left out, and the indices start 8-byte aligned
+  // after the vertices
+  size_t Offset = sizeof(Header);
+  draw_capture::ListHeader List;
+  std::memcpy(&List, Bytes.data() + Offset, sizeof(List));
+  CHECK(List.CmdCount == 3 && List.VtxCount == 7 && List.IdxCount == 9);
+  Offset += sizeof(List) + List.CmdCount * sizeof(draw_capture::Command) +
+            List.VtxCount * sizeof(ImDrawVert);
+  size_t IdxStart = draw_capture::alignUp(Offset);
+  CHECK(IdxStart % 8 == 0);
+  CHECK(std::memcmp(Bytes.data() + IdxStart, Frame.A.IdxBuffer.Data,
+                    Frame.A.IdxBuffer.size_in_bytes()) == 0);
+  CHECK(Bytes.size() % 8 == 0);
+
+  // Reused buffers start over
+  CHECK(draw_capture::serialize(Frame.Data, Bytes) == 1);
+  CHECK(Bytes.size() == Header.Size);
+}
+
+void testRoundTrip() {
+  writeCapture();
+  DrawReplay Replay(capturePath());
+  CHECK(Replay.size() == FrameCount);
+  CHECK(Replay.getFramebufferSize().x == 1280);
+  CHECK(Replay.getFramebufferSize().y == 960);
+  CHECK(Replay.getTextures().size() == 1);
+  CHECK(Replay.getTextures()[0] == draw_capture::textureBits(TestFrame::Other));
+
+  auto const Font = reinterpret_cast<ImTextureID>(0x42);
+  auto const Placeholder = reinterpret_cast<ImTextureID>(0x77);
+  ImDrawData *Data = Replay.frame(0, Font, {&Placeholder, 1});
+  CHECK(Data->CmdLists[0]->CmdBuffer[0].TextureId == Font);
+  CHECK(Data->CmdLists[0]->CmdBuffer[1].TextureId == Placeholder);
+
+  for (size_t I = 0; I < FrameCount; ++I) {
+    Data = Replay.frame(I, Font);
+    CHECK(Data->Valid);
+    CHECK(Data->CmdListsCount == 2);
+    CHECK(Data->TotalVtxCount == 10 && Data->TotalIdxCount == 12);
+    ImDrawList const &A = *Data->CmdLists[0];
+    CHECK(A.CmdBuffer.Size == 3);
+    CHECK(A.CmdBuffer[1].IdxOffset == 6 && A.CmdBuffer[1].ElemCount == 3);
+    // Without a placeholder the other texture falls back to the font
+    CHECK(A.CmdBuffer[1].TextureId == Font);
+    CHECK(A.CmdBuffer[2].UserCallback == ImDrawCallback_ResetRenderState);
+    CHECK(A.VtxBuffer.Size == 7 && A.VtxBuffer[0].pos.x == float(I));
+    CHECK(A.IdxBuffer.Size == 9 && A.IdxBuffer[8] == 1);
+    ImDrawList const &B = *Data->CmdLists[1];
+    CHECK(B.IdxBuffer.Size == 3 && B.IdxBuffer[2] == 2);
+    CHECK(B.CmdBuffer.Size == 1 && B.CmdBuffer[0].TextureId == Font);
+  }
+}
+
+void testTruncated() {
+  writeCapture();
+  // As left by a crash in the middle of writing the last frame
+  std::filesystem::resize_file(capturePath(),
+                               std::filesystem::file_size(capturePath()) - 10);
+  DrawReplay Replay(capturePath());
+  CHECK(Replay.size() == FrameCount - 1);
+  ImDrawData *Last = Replay.frame(FrameCount - 2, nullptr);
+  CHECK(Last->CmdLists[0]->VtxBuffer[0].pos.x == float(FrameCount - 2));
+}
+
+void testDamagedIndex() {
+  size_t FrameSize = writeCapture();
+  // Point the first index of frame 40 past the end of its vertices
+  constexpr size_t Damaged = 40;
+  size_t Offset = sizeof(draw_capture::FileHeader) + Damaged * FrameSize +
+                  sizeof(draw_capture::FrameHeader) +
+                  sizeof(draw_capture::ListHeader) +
+                  3 * sizeof(draw_capture::Command);
+  Offset = draw_capture::alignUp(Offset + 7 * sizeof(ImDrawVert));
+  {
+    std::fstream File(capturePath(),
+                      std::ios::binary | std::ios::in | std::ios::out);
+    ImDrawIdx Index = 7;
+    File.seekp(static_cast<std::streamoff>(Offset));
+    File.write(reinterpret_cast<char const *>(&Index), sizeof(Index));
+    CHECK(File.good());
+  }
+  DrawReplay Replay(capturePath());
+  CHECK(Replay.size() == Damaged);
+}
+
+void testNotACapture() {
+  auto Throws = [] {
+    try {
+      DrawReplay Replay(capturePath());
+    } catch (std::runtime_error const &) {
+      return true;
+    }
+    return false;
+  };
+
+  {
+    std::ofstream File(capturePath(), std::ios::binary | std::ios::trunc);
+    File << "definitely not a draw capture, but longer than the header";
+  }
+  CHECK(Throws());
+
+  // A header and no frames
+  { DrawCaptureWriter Writer(capturePath(), TestFrame::Font); }
+  CHECK(Throws());
+
+  std::filesystem::resize_file(capturePath(), 4);
+  CHECK(Throws());
+}
+
+} // namespace
+
+int main() {
+  // Replay hands out draw data owned by the main viewport
+  ImGui::CreateContext();
+  testSerialize();
+  testRoundTrip();
+  testTruncated();
+  testDamagedIndex();
+  testNotACapture();
+  std::filesystem::remove(capturePath());
+  ImGui::DestroyContext();
+  return 0;
+}
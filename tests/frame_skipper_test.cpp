@@ -0,0 +1,105 @@
+#include "check.h"
+#include "frame_skipper.h"
+
+#include <cstdint>
+
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+namespace {
+
+/// One list with a quad, built from scratch each time so that equal frames
+/// share no storage.
+struct TestFrame {
+  ImDrawList List{nullptr};
+  ImDrawList *Lists[1] = {&List};
+  ImDrawData Data;
+
+  TestFrame() {
+    for (int I = 0; I < 4; ++I)
+      List.VtxBuffer.push_back(
+          {ImVec2(float(I & 1), float(I >> 1)), ImVec2(0, 0), 0xffffffffu});
+    for (int I : {0, 1, 2, 2, 1, 3})
+      List.IdxBuffer.push_back(ImDrawIdx(I));
+    ImDrawCmd Cmd;
+    Cmd.ClipRect = ImVec4(0, 0, 100, 100);
+    Cmd.TextureId = reinterpret_cast<ImTextureID>(0x10);
+    Cmd.ElemCount = 6;
+    List.CmdBuffer.push_back(Cmd);
+
+    Data.Valid = true;
+    Data.CmdListsCount = 1;
+    Data.CmdLists = Lists;
+    Data.TotalVtxCount = List.VtxBuffer.Size;
+    Data.TotalIdxCount = List.IdxBuffer.Size;
+    Data.DisplaySize = ImVec2(100, 100);
+    Data.FramebufferScale = ImVec2(1, 1);
+  }
+};
+
+void testHash() {
+  TestFrame A, B;
+  uint64_t Hash = hashDrawData(&A.Data);
+  CHECK(hashDrawData(&B.Data) == Hash);
+  // The seed carries state outside the draw data
+  CHECK(hashDrawData(&A.Data, 1) != Hash);
+
+  B.List.VtxBuffer[3].col = 0xfffffffeu;
+  CHECK(hashDrawData(&B.Data) != Hash);
+  B.List.VtxBuffer[3].col = 0xffffffffu;
+  CHECK(hashDrawData(&B.Data) == Hash);
+
+  B.List.CmdBuffer[0].TextureId = reinterpret_cast<ImTextureID>(0x11);
+  CHECK(hashDrawData(&B.Data) != Hash);
+  B.List.CmdBuffer[0].TextureId = A.List.CmdBuffer[0].TextureId;
+
+  B.List.CmdBuffer[0].ClipRect.z = 99;
+  CHECK(hashDrawData(&B.Data) != Hash);
+  B.List.CmdBuffer[0].ClipRect.z = 100;
+
+  B.Data.DisplayPos = ImVec2(1, 0);
+  CHECK(hashDrawData(&B.Data) != Hash);
+  B.Data.DisplayPos = ImVec2(0, 0);
+  CHECK(hashDrawData(&B.Data) == Hash);
+
+  // Nothing to draw hashes to the seed
+  CHECK(hashDrawData(nullptr) == 0xcbf29ce484222325ull);
+  CHECK(hashDrawData(nullptr, 7) == 7);
+  B.Data.Valid = false;
+  CHECK(hashDrawData(&B.Data, 7) == 7);
+}
+
+void testSkipper() {
+  TestFrame Frame;
+  FrameSkipper Skipper;
+  // Off by default: every frame renders and the loop never blocks
+  CHECK(Skipper.shouldRender(&Frame.Data));
+  CHECK(Skipper.shouldRender(&Frame.Data));
+  CHECK(Skipper.getWaitTimeoutMs() == 0);
+
+  Skipper.setEnabled(true);
+  // The first frame after enabling renders and counts towards settling
+  CHECK(Skipper.shouldRender(&Frame.Data));
+  for (uint32_t I = 1; I < FrameSkipper::SettleFrames; ++I) {
+    CHECK(Skipper.getWaitTimeoutMs() == 0);
+    CHECK(!Skipper.shouldRender(&Frame.Data));
+  }
+  CHECK(Skipper.getWaitTimeoutMs() == FrameSkipper::IdleTimeoutMs);
+
+  Skipper.invalidate();
+  CHECK(Skipper.shouldRender(&Frame.Data));
+  CHECK(!Skipper.shouldRender(&Frame.Data));
+
+  Frame.List.VtxBuffer[0].pos.x = 0.5f;
+  CHECK(Skipper.shouldRender(&Frame.Data));
+  CHECK(Skipper.getWaitTimeoutMs() == 0);
+  CHECK(!Skipper.shouldRender(&Frame.Data));
+  CHECK(Skipper.shouldRender(&Frame.Data, 1));
+}
+
+} // namespace
+
+int main() {
+  testHash();
+  testSkipper();
+  return 0;
+}
@@ -0,0 +1,126 @@
+#include "check.h"
+#include "time_series.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+struct Random {
+  uint32_t Seed;
+  uint32_t next() {
+    Seed = Seed * 1664525u + 1013904223u;
+    return Seed >> 8;
+  }
+};
+
+/// Compares rangeMinMax with a scan of \p All over random ranges within the
+/// kept history, plus the whole of it.
+void checkRanges(SampleHistory const &History, std::vector<float> const &All,
+                 Random &R) {
+  uint64_t Kept = History.end() - History.begin();
+  for (int I = 0; I < 200; ++I) {
+    uint64_t Begin = History.begin() + R.next() % (Kept + 1);
+    uint64_t End = Begin + R.next() % (History.end() - Begin + 1);
+    if (I == 0) {
+      Begin = History.begin();
+      End = History.end();
+    }
+    float Min = FLT_MAX, Max = -FLT_MAX;
+    History.rangeMinMax(Begin, End, Min, Max);
+    float ExpectedMin = FLT_MAX, ExpectedMax = -FLT_MAX;
+    for (uint64_t S = Begin; S < End; ++S) {
+      ExpectedMin = std::min(ExpectedMin, All[S]);
+      ExpectedMax = std::max(ExpectedMax, All[S]);
+    }
+    CHECK(Min == ExpectedMin);
+    CHECK(Max == ExpectedMax);
+  }
+}
+
+void testRangeMinMax() {
+  SampleHistory History(10000);
+  std::vector<float> All;
+  Random R{7};
+  // Uneven appends so buckets fill across calls
+  while (All.size() < 9000) {
+    std::vector<float> Chunk(1 + R.next() % 300);
+    for (float &Sample : Chunk)
+      Sample = static_cast<float>(R.next() % 100000) / 100.0f - 500.0f;
+    History.append(Chunk);
+    All.insert(All.end(), Chunk.begin(), Chunk.end());
+    CHECK(History.begin() == 0);
+    CHECK(History.end() == All.size());
+    checkRanges(History, All, R);
+  }
+}
+
+void testTrim() {
+  constexpr size_t Capacity = 5000;
+  SampleHistory History(Capacity);
+  std::vector<float> All;
+  Random R{42};
+  bool Trimmed = false;
+  while (All.size() < 8 * Capacity) {
+    std::vector<float> Chunk(1 + R.next() % 700);
+    for (float &Sample : Chunk)
+      Sample = static_cast<float>(R.next() % 1000);
+    History.append(Chunk);
+    All.insert(All.end(), Chunk.begin(), Chunk.end());
+    uint64_t Kept = History.end() - History.begin();
+    CHECK(History.end() == All.size());
+    CHECK(Kept <= Capacity);
+    CHECK(Kept >= std::min<uint64_t>(All.size(), Capacity * 3 / 4));
+    Trimmed |= History.begin() != 0;
+    checkRanges(History, All, R);
+  }
+  CHECK(Trimmed);
+}
+
+void testSmallCapacity() {
+  // Rounded up to four base buckets, so a trim always drops something
+  SampleHistory History(1);
+  std::vector<float> Samples(1000);
+  for (size_t I = 0; I < Samples.size(); ++I)
+    Samples[I] = static_cast<float>(I);
+  for (float Sample : Samples) {
+    History.append({&Sample, 1});
+    CHECK(History.end() - History.begin() <= 4 * SampleHistory::BaseBucket);
+  }
+  float Min = FLT_MAX, Max = -FLT_MAX;
+  History.rangeMinMax(History.begin(), History.end(), Min, Max);
+  CHECK(Min == static_cast<float>(History.begin()));
+  CHECK(Max == 999.0f);
+}
+
+void testSampleRing() {
+  SampleRing Ring(5);
+  std::vector<float> Samples = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  // Rounded up to eight, the rest is dropped and counted
+  CHECK(Ring.push(Samples) == 8);
+  CHECK(Ring.getDropped() == 2);
+  std::vector<float> Out;
+  Ring.drain(Out);
+  CHECK(Out == std::vector<float>(Samples.begin(), Samples.begin() + 8));
+
+  // Wraps around the end of the storage
+  Out.clear();
+  CHECK(Ring.push({Samples.data(), 6}) == 6);
+  Ring.drain(Out);
+  CHECK(Out == std::vector<float>(Samples.begin(), Samples.begin() + 6));
+  Out.clear();
+  Ring.drain(Out);
+  CHECK(Out.empty());
+}
+
+} // namespace
+
+int main() {
+  testRangeMinMax();
+  testTrim();
+  testSmallCapacity();
+  testSampleRing();
+  return 0;
+}
@@ -0,0 +1,386 @@
+#pragma once
+
+#include <imgui.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <vector>
+
+/// Folds \p Count entries of \p MinData into \p Min and of \p MaxData into
+/// \p Max; pass the same array twice to reduce raw samples. Eight lanes with
+/// AVX, four with SSE2, scalar elsewhere.
+inline void reduceMinMax(float const *MinData, float const *MaxData,
+                         size_t Count, float &Min, float &Max) noexcept {
+  size_t I = 0;
+#if defined(__AVX__)
+  if (Count >= 8) {
+    __m256 VMin = _mm256_set1_ps(Min);
+    __m256 VMax = _mm256_set1_ps(Max);
+    for (; I + 8 <= Count; I += 8) {
+      VMin = _mm256_min_ps(VMin, _mm256_loadu_ps(MinData + I));
+      VMax = _mm256_max_ps(VMax, _mm256_loadu_ps(MaxData + I));
+    }
+    alignas(32) float Mins[8], Maxs[8];
+    _mm256_store_ps(Mins, VMin);
+    _mm256_store_ps(Maxs, VMax);
+    Min = *std::min_element(Mins, Mins + 8);
+    Max = *std::max_element(Maxs, Maxs + 8);
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  if (Count >= 4) {
+    __m128 VMin = _mm_set1_ps(Min);
+    __m128 VMax = _mm_set1_ps(Max);
+    for (; I + 4 <= Count; I += 4) {
+      VMin = _mm_min_ps(VMin, _mm_loadu_ps(MinData + I));
+      VMax = _mm_max_ps(VMax, _mm_loadu_ps(MaxData + I));
+    }
+    alignas(16) float Mins[4], Maxs[4];
+    _mm_store_ps(Mins, VMin);
+    _mm_store_ps(Maxs, VMax);
+    Min = *std::min_element(Mins, Mins + 4);
+    Max = *std::max_element(Maxs, Maxs + 4);
+  }
+#endif
+  for (; I < Count; ++I) {
+    Min = std::min(Min, MinData[I]);
+    Max = std::max(Max, MaxData[I]);
+  }
+}
+
+/// Lock-free single producer, single consumer queue of samples. The
+/// producer never blocks: what does not fit is dropped and counted.
+class SampleRing {
+public:
+  /// \p Capacity is rounded up to a power of two.
+  explicit SampleRing(size_t Capacity)
+      : Mask(std::bit_ceil(std::max<size_t>(Capacity, 2)) - 1),
+        Data(std::make_unique<float[]>(Mask + 1)) {}
+
+  /// Producer side. Returns how many samples were queued.
+  size_t push(std::span<float const> Samples) noexcept {
+    uint64_t Head = this->Head.load(std::memory_order_relaxed);
+    uint64_t Tail = this->Tail.load(std::memory_order_acquire);
+    size_t Count = std::min<size_t>(Samples.size(), Mask + 1 - (Head - Tail));
+    for (size_t I = 0; I < Count; ++I)
+      Data[(Head + I) & Mask] = Samples[I];
+    this->Head.store(Head + Count, std::memory_order_release);
+    if (Count < Samples.size())
+      Dropped.fetch_add(Samples.size() - Count, std::memory_order_relaxed);
+    return Count;
+  }
+
+  /// Consumer side. Appends everything queued to \p Out.
+  void drain(std::vector<float> &Out) {
+    uint64_t Tail = this->Tail.load(std::memory_order_relaxed);
+    uint64_t Head = this->Head.load(std::memory_order_acquire);
+    for (uint64_t I = Tail; I != Head;) {
+      // At most two contiguous runs
+      size_t Begin = I & Mask;
+      size_t Run = std::min<uint64_t>(Head - I, Mask + 1 - Begin);
+      Out.insert(Out.end(), Data.get() + Begin, Data.get() + Begin + Run);
+      I += Run;
+    }
+    this->Tail.store(Head, std::memory_order_release);
+  }
+
+  uint64_t getDropped() const noexcept {
+    return Dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  size_t Mask;
+  std::unique_ptr<float[]> Data;
+  alignas(64) std::atomic<uint64_t> Head{0};
+  alignas(64) std::atomic<uint64_t> Tail{0};
+  std::atomic<uint64_t> Dropped{0};
+};
+
+/// Sample history of one channel with a min/max pyramid over it. Level L
+/// summarizes buckets of BaseBucket << L samples; each level is built
+/// incrementally from the one below as samples arrive, so the min/max of any
+/// range costs a SIMD run over the coarsest level that fits plus a few
+/// buckets at the edges.
+class SampleHistory {
+public:
+  static constexpr size_t BaseBucket = 16;
+
+  /// Keeps between 3/4 and all of \p Capacity samples. Capacities below
+  /// 4 * BaseBucket are rounded up, a trim could drop nothing otherwise.
+  explicit SampleHistory(size_t Capacity)
+      : Capacity(std::max(Capacity, 4 * BaseBucket)) {
+    // The oldest samples are dropped in multiples of the top bucket, which
+    // keeps every level aligned
+    while ((BaseBucket << (MaxLevels + 1)) <= this->Capacity / 8)
+      ++MaxLevels;
+  }
+
+  void append(std::span<float const> Samples) {
+    Raw.insert(Raw.end(), Samples.begin(), Samples.end());
+    if (Levels.empty())
+      Levels.emplace_back();
+    for (size_t B = Levels[0].Min.size(); (B + 1) * BaseBucket <= Raw.size();
+         ++B) {
+      float Min = FLT_MAX, Max = -FLT_MAX;
+      float const *Bucket = Raw.data() + B * BaseBucket;
+      reduceMinMax(Bucket, Bucket, BaseBucket, Min, Max);
+      Levels[0].Min.push_back(Min);
+      Levels[0].Max.push_back(Max);
+    }
+    for (size_t L = 1; L <= MaxLevels; ++L) {
+      if (Levels.size() == L) {
+        if (Levels[L - 1].Min.size() < 2)
+          break;
+        Levels.emplace_back();
+      }
+      Level const &Below = Levels[L - 1];
+      Level &Current = Levels[L];
+      for (size_t B = Current.Min.size(); (B + 1) * 2 <= Below.Min.size();
+           ++B) {
+        Current.Min.push_back(std::min(Below.Min[2 * B], Below.Min[2 * B + 1]));
+        Current.Max.push_back(std::max(Below.Max[2 * B], Below.Max[2 * B + 1]));
+      }
+    }
+
+    if (Raw.size() <= Capacity)
+      return;
+    size_t Top = BaseBucket << MaxLevels;
+    size_t Drop = (Raw.size() - Capacity * 3 / 4) / Top * Top;
+    Raw.erase(Raw.begin(), Raw.begin() + Drop);
+    for (size_t L = 0; L < Levels.size(); ++L) {
+      size_t Buckets = Drop / (BaseBucket << L);
+      Levels[L].Min.erase(Levels[L].Min.begin(),
+                          Levels[L].Min.begin() + Buckets);
+      Levels[L].Max.erase(Levels[L].Max.begin(),
+                          Levels[L].Max.begin() + Buckets);
+    }
+    First += Drop;
+  }
+
+  /// Absolute index of the oldest sample kept and one past the newest.
+  uint64_t begin() const noexcept { return First; }
+  uint64_t end() const noexcept { return First + Raw.size(); }
+
+  /// Folds the samples in [Begin, End), absolute and within the history,
+  /// into \p Min and \p Max.
+  void rangeMinMax(uint64_t Begin, uint64_t End, float &Min,
+                   float &Max) const noexcept {
+    reduce(static_cast<size_t>(Begin - First), static_cast<size_t>(End - First),
+           static_cast<int>(Levels.size()) - 1, Min, Max);
+  }
+
+private:
+  struct Level {
+    std::vector<float> Min;
+    std::vector<float> Max;
+  };
+
+  void reduce(size_t Begin, size_t End, int Top, float &Min,
+              float &Max) const noexcept {
+    if (Begin >= End)
+      return;
+    for (int L = Top; L >= 0; --L) {
+      size_t Bucket = BaseBucket << L;
+      size_t Aligned = (Begin + Bucket - 1) / Bucket * Bucket;
+      size_t Last = std::min(End / Bucket, Levels[L].Min.size()) * Bucket;
+      if (Aligned >= Last)
+        continue;
+      reduceMinMax(Levels[L].Min.data() + Aligned / Bucket,
+                   Levels[L].Max.data() + Aligned / Bucket,
+                   (Last - Aligned) / Bucket, Min, Max);
+      // The edges are shorter than a bucket of this level
+      reduce(Begin, Aligned, L - 1, Min, Max);
+      reduce(Last, End, L - 1, Min, Max);
+      return;
+    }
+    reduceMinMax(Raw.data() + Begin, Raw.data() + Begin, End - Begin, Min,
+                 Max);
+  }
+
+  size_t Capacity;
+  size_t MaxLevels = 0;
+  uint64_t First = 0;
+  std::vector<float> Raw;
+  std::vector<Level> Levels;
+};
+
+/// Streaming plot of several channels. Producers push samples from any
+/// thread, one thread per channel; draw() moves them into the histories on
+/// the render thread and reduces each visible pixel column to its min/max,
+/// so the vertex count depends on the plot width, never on the number of
+/// samples. The mouse wheel zooms around the cursor, dragging pans, and
+/// double-clicking returns to following the newest samples.
+class TimeSeriesPlot {
+public:
+  static constexpr size_t DefaultHistory = size_t{1} << 23;
+  static constexpr size_t DefaultRing = size_t{1} << 20;
+
+  explicit TimeSeriesPlot(size_t Channels, size_t History = DefaultHistory,
+                          size_t Ring = DefaultRing) {
+    for (size_t I = 0; I < Channels; ++I)
+      this->Channels.push_back(std::make_unique<Channel>(History, Ring));
+  }
+
+  /// Producer side, see SampleRing::push.
+  size_t push(size_t Channel, std::span<float const> Samples) noexcept {
+    return Channels[Channel]->Ring.push(Samples);
+  }
+
+  uint64_t getDropped() const noexcept {
+    uint64_t Dropped = 0;
+    for (auto const &C : Channels)
+      Dropped += C->Ring.getDropped();
+    return Dropped;
+  }
+  uint64_t getSampleCount() const noexcept {
+    return Channels.empty() ? 0 : Channels.front()->History.end();
+  }
+  /// Vertices the last draw() emitted.
+  int getLastVertexCount() const noexcept { return LastVertexCount; }
+
+  void draw(char const *Label, ImVec2 Size = ImVec2(-1, 200)) {
+    for (auto &C : Channels) {
+      Incoming.clear();
+      C->Ring.drain(Incoming);
+      C->History.append(Incoming);
+    }
+
+    ImVec2 Avail = ImGui::GetContentRegionAvail();
+    if (Size.x <= 0)
+      Size.x = std::max(Avail.x, 64.0f);
+    if (Size.y <= 0)
+      Size.y = std::max(Avail.y, 64.0f);
+    ImVec2 Origin = ImGui::GetCursorScreenPos();
+    ImVec2 Corner(Origin.x + Size.x, Origin.y + Size.y);
+    ImGui::InvisibleButton(Label, Size);
+    ImDrawList *DrawList = ImGui::GetWindowDrawList();
+    DrawList->AddRectFilled(Origin, Corner, IM_COL32(20, 20, 24, 255));
+    if (Channels.empty() || getSampleCount() == 0)
+      return;
+
+    uint64_t Newest = getSampleCount();
+    uint64_t Oldest = Channels.front()->History.begin();
+    for (auto const &C : Channels) {
+      Newest = std::min(Newest, C->History.end());
+      Oldest = std::max(Oldest, C->History.begin());
+    }
+    handleInput(Origin, Size, Oldest, Newest);
+    double End = Follow ? static_cast<double>(Newest) : ViewEnd;
+    double Begin = End - Span;
+
+    int Columns = static_cast<int>(Size.x);
+    double PerColumn = Span / Columns;
+    ColumnMin.assign(Channels.size() * Columns, FLT_MAX);
+    ColumnMax.assign(Channels.size() * Columns, -FLT_MAX);
+    float Low = FLT_MAX, High = -FLT_MAX;
+    for (size_t C = 0; C < Channels.size(); ++C) {
+      SampleHistory const &History = Channels[C]->History;
+      for (int X = 0; X < Columns; ++X) {
+        auto From = static_cast<uint64_t>(
+            std::clamp(Begin + X * PerColumn, double(Oldest), double(Newest)));
+        auto To = static_cast<uint64_t>(std::clamp(
+            Begin + (X + 1) * PerColumn, double(Oldest), double(Newest)));
+        // Zoomed in past one sample per column: the nearest sample
+        if (To <= From && From < Newest)
+          To = From + 1;
+        float &Min = ColumnMin[C * Columns + X];
+        float &Max = ColumnMax[C * Columns + X];
+        History.rangeMinMax(From, To, Min, Max);
+        Low = std::min(Low, Min);
+        High = std::max(High, Max);
+      }
+    }
+    if (Low > High)
+      return;
+    if (High - Low < 1e-6f)
+      High = Low + 1e-6f;
+
+    int Vertices = DrawList->VtxBuffer.Size;
+    DrawList->PushClipRect(Origin, Corner, true);
+    auto ToY = [&](float Value) {
+      return Corner.y - 2 - (Value - Low) / (High - Low) * (Size.y - 4);
+    };
+    static constexpr ImU32 Colors[] = {
+        IM_COL32(90, 200, 250, 255), IM_COL32(250, 170, 60, 255),
+        IM_COL32(120, 230, 120, 255), IM_COL32(230, 110, 200, 255)};
+    for (size_t C = 0; C < Channels.size(); ++C) {
+      ImU32 Color = Colors[C % std::size(Colors)];
+      float PrevMin = 0, PrevMax = 0;
+      bool HasPrev = false;
+      for (int X = 0; X < Columns; ++X) {
+        float Min = ColumnMin[C * Columns + X];
+        float Max = ColumnMax[C * Columns + X];
+        if (Min > Max) {
+          HasPrev = false;
+          continue;
+        }
+        // Reach over to the previous column so the trace stays connected
+        float Lo = HasPrev ? std::min(Min, PrevMax) : Min;
+        float Hi = HasPrev ? std::max(Max, PrevMin) : Max;
+        float PixelX = Origin.x + X + 0.5f;
+        DrawList->AddLine(ImVec2(PixelX, ToY(Hi) - 0.5f),
+                          ImVec2(PixelX, ToY(Lo) + 0.5f), Color);
+        PrevMin = Min;
+        PrevMax = Max;
+        HasPrev = true;
+      }
+    }
+    DrawList->PopClipRect();
+    LastVertexCount = DrawList->VtxBuffer.Size - Vertices;
+  }
+
+private:
+  struct Channel {
+    Channel(size_t History, size_t Ring) : Ring(Ring), History(History) {}
+    SampleRing Ring;
+    SampleHistory History;
+  };
+
+  void handleInput(ImVec2 Origin, ImVec2 Size, uint64_t Oldest,
+                   uint64_t Newest) {
+    ImGuiIO &Io = ImGui::GetIO();
+    double End = Follow ? static_cast<double>(Newest) : ViewEnd;
+    if (ImGui::IsItemHovered() && Io.MouseWheel != 0) {
+      // Keep the sample under the cursor in place
+      double Anchor = (Io.MousePos.x - Origin.x) / Size.x;
+      double Cursor = End - Span + Anchor * Span;
+      Span = std::clamp(Span * std::pow(0.8, Io.MouseWheel), 16.0,
+                        std::max(16.0, double(Newest - Oldest)));
+      End = Cursor + (1 - Anchor) * Span;
+      Follow = false;
+    }
+    if (ImGui::IsItemActive() && Io.MouseDelta.x != 0) {
+      End -= Io.MouseDelta.x / Size.x * Span;
+      Follow = false;
+    }
+    if (ImGui::IsItemHovered() && ImGui::IsMouseDoubleClicked(0))
+      Follow = true;
+    // A history shorter than the span puts the lower bound past Newest,
+    // which leaves the view following
+    ViewEnd = std::max(std::min(End, double(Newest)), double(Oldest) + Span);
+    if (ViewEnd >= double(Newest))
+      Follow = true;
+  }
+
+  std::vector<std::unique_ptr<Channel>> Channels;
+  std::vector<float> Incoming;
+  std::vector<float> ColumnMin;
+  std::vector<float> ColumnMax;
+  /// Visible samples and the right edge, unless following the newest.
+  double Span = 1 << 20;
+  double ViewEnd = 0;
+  bool Follow = true;
+  int LastVertexCount = 0;
+};
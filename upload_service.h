@@ -0,0 +1,569 @@
+#pragma once
+
+#include "device_memory.h"
+#include "format.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+/// Sampled image created by UploadService, in SHADER_READ_ONLY_OPTIMAL and
+/// owned by the graphics queue family once its upload completed.
+struct UploadedImage {
+  vk::Image Image;
+  DeviceAllocation Allocation;
+  vk::ImageView View;
+  vk::Extent2D Extent;
+  vk::Format Format = vk::Format::eUndefined;
+};
+
+/// Streams images to the device without stalling rendering. A worker thread
+/// copies pixels into a persistently mapped staging ring and records the
+/// copy on the transfer queue family; submit(), called once per frame on the
+/// render thread, submits the recorded copies, hands ownership over to the
+/// graphics family and retires finished uploads. Completion is reported
+/// through the returned future and the optional callback, both on the render
+/// thread.
+class UploadService {
+public:
+  using Callback = std::function<void(UploadedImage const &)>;
+
+  static constexpr vk::DeviceSize DefaultStagingSize = vk::DeviceSize{32}
+                                                       << 20;
+  /// Staging offsets are kept aligned to this, which satisfies the copy
+  /// offset rules of every texel size and optimalBufferCopyOffsetAlignment
+  /// on common hardware.
+  static constexpr vk::DeviceSize StagingAlignment = 256;
+
+  UploadService() = default;
+  UploadService(UploadService const &) = delete;
+  UploadService &operator=(UploadService const &) = delete;
+
+  void init(vk::Device Device, DeviceMemoryAllocator &DeviceMemory,
+            vk::AllocationCallbacks const &AllocationCallbacks,
+            uint32_t GraphicsQueueFamilyIndex, vk::Queue GraphicsQueue,
+            uint32_t TransferQueueFamilyIndex, vk::Queue TransferQueue,
+            vk::DeviceSize StagingSize = DefaultStagingSize) {
+    this->Device = Device;
+    this->DeviceMemory = &DeviceMemory;
+    this->AllocationCallbacks = AllocationCallbacks;
+    this->GraphicsQueueFamilyIndex = GraphicsQueueFamilyIndex;
+    this->GraphicsQueue = GraphicsQueue;
+    this->TransferQueueFamilyIndex = TransferQueueFamilyIndex;
+    this->TransferQueue = TransferQueue;
+
+    StagingCapacity = StagingSize / StagingAlignment * StagingAlignment;
+    std::tie(Staging, StagingAllocation) = DeviceMemory.createBuffer(
+        {{}, StagingCapacity, vk::BufferUsageFlagBits::eTransferSrc},
+        vk::MemoryPropertyFlagBits::eHostVisible,
+        vk::MemoryPropertyFlagBits::eHostCoherent);
+
+    // The transfer pool belongs to the worker, the graphics pool to the
+    // render thread
+    TransferPool = Device.createCommandPool(
+        {vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+         TransferQueueFamilyIndex},
+        AllocationCallbacks);
+    GraphicsPool = Device.createCommandPool(
+        {vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+         GraphicsQueueFamilyIndex},
+        AllocationCallbacks);
+    Sampler = Device.createSampler(
+        {{},
+         vk::Filter::eLinear,
+         vk::Filter::eLinear,
+         vk::SamplerMipmapMode::eLinear,
+         vk::SamplerAddressMode::eClampToEdge,
+         vk::SamplerAddressMode::eClampToEdge,
+         vk::SamplerAddressMode::eClampToEdge,
+         0.0f,
+         VK_FALSE,
+         1.0f,
+         VK_FALSE,
+         vk::CompareOp::eAlways,
+         -1000.0f,
+         1000.0f},
+        AllocationCallbacks);
+
+    Stop = false;
+    Worker = std::thread([this] { workerMain(); });
+  }
+
+  /// Waits for the worker and the queues, then releases everything but the
+  /// images handed out.
+  void destroy() {
+    if (!Worker.joinable())
+      return;
+    {
+      std::lock_guard Lock(Mutex);
+      Stop = true;
+    }
+    RequestCv.notify_all();
+    {
+      // The worker may be between its Stop check and the wait
+      std::lock_guard Lock(StagingMutex);
+    }
+    StagingCv.notify_all();
+    Worker.join();
+    Device.waitIdle();
+    for (Batch &B : InFlight) {
+      for (Pending &P : B.Items)
+        destroyImage(P.Image);
+      recycle(B);
+    }
+    InFlight.clear();
+    for (Pending &P : Ready)
+      destroyImage(P.Image);
+    Ready.clear();
+    for (vk::Fence Fence : FreeFences)
+      Device.destroyFence(Fence, AllocationCallbacks);
+    for (vk::Semaphore Semaphore : FreeSemaphores)
+      Device.destroySemaphore(Semaphore, AllocationCallbacks);
+    FreeFences.clear();
+    FreeSemaphores.clear();
+    FreeTransferBuffers.clear();
+    FreeGraphicsBuffers.clear();
+    Device.destroySampler(Sampler, AllocationCallbacks);
+    Device.destroyCommandPool(GraphicsPool, AllocationCallbacks);
+    Device.destroyCommandPool(TransferPool, AllocationCallbacks);
+    DeviceMemory->destroyBuffer(Staging, StagingAllocation);
+  }
+
+  /// True when copies run on a queue family of their own and images change
+  /// family ownership on completion.
+  bool hasDedicatedTransferQueue() const noexcept {
+    return TransferQueueFamilyIndex != GraphicsQueueFamilyIndex;
+  }
+
+  /// Linear clamp-to-edge sampler for drawing uploaded images.
+  vk::Sampler getSampler() const noexcept { return Sampler; }
+
+  /// Queues tightly packed \p Pixels for upload into a new sampled 2D image.
+  /// The copy into staging memory happens on the worker thread; images
+  /// larger than the staging ring fail the future.
+  std::future<UploadedImage>
+  uploadImage(std::vector<uint8_t> Pixels, uint32_t Width, uint32_t Height,
+              vk::Format Format = vk::Format::eR8G8B8A8Unorm,
+              Callback OnComplete = {}) {
+    Request R{std::move(Pixels), {Width, Height}, Format,
+              std::move(OnComplete), {}};
+    std::future<UploadedImage> Future = R.Promise.get_future();
+    ++Outstanding;
+    {
+      std::lock_guard Lock(Mutex);
+      Requests.push_back(std::move(R));
+    }
+    RequestCv.notify_one();
+    return Future;
+  }
+
+  void destroyImage(UploadedImage &Image) {
+    Device.destroyImageView(Image.View, AllocationCallbacks);
+    DeviceMemory->destroyImage(Image.Image, Image.Allocation);
+    Image = {};
+  }
+
+  /// Retires finished uploads and submits the ones the worker has recorded
+  /// since the last call. Render thread only.
+  void submit() {
+    while (!InFlight.empty() && Device.getFenceStatus(InFlight.front().Fence) ==
+                                    vk::Result::eSuccess) {
+      retire(InFlight.front());
+      InFlight.pop_front();
+    }
+
+    std::vector<Pending> Recorded;
+    {
+      std::lock_guard Lock(Mutex);
+      Recorded.swap(Ready);
+    }
+    if (Recorded.empty())
+      return;
+
+    Batch B;
+    B.Fence = takeFence();
+    std::vector<vk::CommandBuffer> Copies;
+    for (Pending const &P : Recorded)
+      if (P.CommandBuffer)
+        Copies.push_back(P.CommandBuffer);
+
+    if (!hasDedicatedTransferQueue() || Copies.empty()) {
+      // Same family: the copies already end in a barrier to shader reads.
+      // A batch of failed uploads only needs the fence to retire in order
+      GraphicsQueue.submit(vk::SubmitInfo({}, {}, Copies), B.Fence);
+    } else {
+      // The acquire half of the ownership transfer has to run on the
+      // graphics queue, after the release recorded with each copy
+      B.Semaphore = takeSemaphore();
+      TransferQueue.submit(vk::SubmitInfo({}, {}, Copies, B.Semaphore));
+
+      B.Acquire = takeGraphicsBuffer();
+      B.Acquire.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+      std::vector<vk::ImageMemoryBarrier> Barriers;
+      for (Pending const &P : Recorded)
+        if (P.Image.Image)
+          Barriers.push_back(ownershipBarrier(
+              P.Image.Image, {}, vk::AccessFlagBits::eShaderRead));
+      B.Acquire.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands,
+                                vk::PipelineStageFlagBits::eFragmentShader, {},
+                                {}, {}, Barriers);
+      B.Acquire.end();
+      vk::PipelineStageFlags WaitStage =
+          vk::PipelineStageFlagBits::eAllCommands;
+      GraphicsQueue.submit(
+          vk::SubmitInfo(B.Semaphore, WaitStage, B.Acquire), B.Fence);
+    }
+    B.Items = std::move(Recorded);
+    InFlight.push_back(std::move(B));
+  }
+
+  /// Blocks until everything queued so far has completed. Waits on the
+  /// uploads' own fences, never on the whole device. Render thread only.
+  void finish() {
+    while (Outstanding > 0) {
+      submit();
+      if (!InFlight.empty()) {
+        vk::Result Result = Device.waitForFences(InFlight.front().Fence,
+                                                 VK_TRUE, UINT64_MAX);
+        if (Result != vk::Result::eSuccess)
+          throw std::runtime_error("Failed to wait for an upload");
+        continue;
+      }
+      std::unique_lock Lock(Mutex);
+      ReadyCv.wait(Lock, [this] { return !Ready.empty() || Outstanding == 0; });
+    }
+  }
+
+private:
+  struct Request {
+    std::vector<uint8_t> Pixels;
+    vk::Extent2D Extent;
+    vk::Format Format;
+    Callback OnComplete;
+    std::promise<UploadedImage> Promise;
+  };
+
+  /// Recorded by the worker, waiting for submit(). A failed upload that
+  /// already holds staging memory keeps its place in line with no command
+  /// buffer, so its bytes are released in reservation order.
+  struct Pending {
+    UploadedImage Image;
+    vk::CommandBuffer CommandBuffer;
+    vk::DeviceSize StagingBytes = 0;
+    Callback OnComplete;
+    std::promise<UploadedImage> Promise;
+    std::exception_ptr Error;
+  };
+
+  /// One submit() worth of uploads.
+  struct Batch {
+    std::vector<Pending> Items;
+    vk::Fence Fence;
+    vk::Semaphore Semaphore;
+    vk::CommandBuffer Acquire;
+  };
+
+  vk::ImageMemoryBarrier ownershipBarrier(vk::Image Image,
+                                          vk::AccessFlags SrcAccess,
+                                          vk::AccessFlags DstAccess) const {
+    return {SrcAccess,
+            DstAccess,
+            vk::ImageLayout::eTransferDstOptimal,
+            vk::ImageLayout::eShaderReadOnlyOptimal,
+            TransferQueueFamilyIndex,
+            GraphicsQueueFamilyIndex,
+            Image,
+            {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}};
+  }
+
+  /// Reserves \p Size bytes of the staging ring, blocking until earlier
+  /// uploads have retired enough of it. Reservations are released in the
+  /// order they are made, so the ring only needs a head and a tail; bytes
+  /// skipped when wrapping around are charged to the reservation.
+  std::optional<std::pair<vk::DeviceSize, vk::DeviceSize>>
+  reserveStaging(vk::DeviceSize Size) {
+    Size = (Size + StagingAlignment - 1) / StagingAlignment * StagingAlignment;
+    std::unique_lock Lock(StagingMutex);
+    while (true) {
+      if (Stop)
+        return std::nullopt;
+      if (StagingUsed == 0)
+        StagingHead = StagingTail = 0;
+      if (StagingUsed < StagingCapacity) {
+        vk::DeviceSize Offset = StagingHead;
+        vk::DeviceSize Charged = Size;
+        bool Fits = false;
+        if (StagingHead >= StagingTail) {
+          if (StagingHead + Size <= StagingCapacity) {
+            Fits = true;
+          } else if (Size <= StagingTail) {
+            Charged += StagingCapacity - StagingHead;
+            Offset = 0;
+            Fits = true;
+          }
+        } else {
+          Fits = StagingHead + Size <= StagingTail;
+        }
+        if (Fits) {
+          StagingHead = (Offset + Size) % StagingCapacity;
+          StagingUsed += Charged;
+          return std::pair{Offset, Charged};
+        }
+      }
+      StagingCv.wait(Lock);
+    }
+  }
+
+  void releaseStaging(vk::DeviceSize Charged) {
+    {
+      std::lock_guard Lock(StagingMutex);
+      StagingUsed -= Charged;
+      StagingTail = (StagingTail + Charged) % StagingCapacity;
+    }
+    StagingCv.notify_one();
+  }
+
+  void workerMain() {
+    while (true) {
+      Request R;
+      {
+        std::unique_lock Lock(Mutex);
+        RequestCv.wait(Lock, [this] { return Stop || !Requests.empty(); });
+        if (Stop)
+          return;
+        R = std::move(Requests.front());
+        Requests.pop_front();
+      }
+      try {
+        Pending P = record(R);
+        {
+          std::lock_guard Lock(Mutex);
+          Ready.push_back(std::move(P));
+        }
+        ReadyCv.notify_all();
+      } catch (...) {
+        R.Promise.set_exception(std::current_exception());
+        {
+          std::lock_guard Lock(Mutex);
+          --Outstanding;
+        }
+        ReadyCv.notify_all();
+      }
+    }
+  }
+
+  /// Worker side of an upload: staging copy, image creation and recording.
+  Pending record(Request &R) {
+    vk::DeviceSize Bytes = R.Pixels.size();
+    if (Bytes == 0 || Bytes > StagingCapacity)
+      throw std::invalid_argument(fmt::format(
+          "Upload of {} bytes does not fit the {} byte staging ring", Bytes,
+          StagingCapacity));
+    std::optional<std::pair<vk::DeviceSize, vk::DeviceSize>> Reservation =
+        reserveStaging(Bytes);
+    if (!Reservation)
+      throw std::runtime_error("Upload service stopped");
+    auto [Offset, Charged] = *Reservation;
+    std::memcpy(static_cast<std::byte *>(StagingAllocation.Mapped) + Offset,
+                R.Pixels.data(), Bytes);
+    DeviceMemory->flush(StagingAllocation, Offset, Bytes);
+
+    Pending P;
+    P.StagingBytes = Charged;
+    P.OnComplete = std::move(R.OnComplete);
+    P.Promise = std::move(R.Promise);
+    P.Image.Extent = R.Extent;
+    P.Image.Format = R.Format;
+    try {
+      std::tie(P.Image.Image, P.Image.Allocation) = DeviceMemory->createImage(
+          {{},
+           vk::ImageType::e2D,
+           R.Format,
+           {R.Extent.width, R.Extent.height, 1},
+           1,
+           1,
+           vk::SampleCountFlagBits::e1,
+           vk::ImageTiling::eOptimal,
+           vk::ImageUsageFlagBits::eTransferDst |
+               vk::ImageUsageFlagBits::eSampled},
+          vk::MemoryPropertyFlagBits::eDeviceLocal);
+      P.Image.View = Device.createImageView(
+          {{},
+           P.Image.Image,
+           vk::ImageViewType::e2D,
+           R.Format,
+           {},
+           {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}},
+          AllocationCallbacks);
+    } catch (...) {
+      // Earlier reservations may still be in flight, releasing the bytes
+      // here would move the tail over them
+      if (P.Image.Image)
+        DeviceMemory->destroyImage(P.Image.Image, P.Image.Allocation);
+      P.Image = {};
+      P.Error = std::current_exception();
+      return P;
+    }
+
+    P.CommandBuffer = takeTransferBuffer();
+    vk::CommandBuffer Cmd = P.CommandBuffer;
+    Cmd.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    vk::ImageSubresourceRange Range(vk::ImageAspectFlagBits::eColor, 0, 1, 0,
+                                    1);
+    Cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTopOfPipe,
+        vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
+        vk::ImageMemoryBarrier({}, vk::AccessFlagBits::eTransferWrite,
+                               vk::ImageLayout::eUndefined,
+                               vk::ImageLayout::eTransferDstOptimal,
+                               VK_QUEUE_FAMILY_IGNORED,
+                               VK_QUEUE_FAMILY_IGNORED, P.Image.Image, Range));
+    Cmd.copyBufferToImage(
+        Staging, P.Image.Image, vk::ImageLayout::eTransferDstOptimal,
+        vk::BufferImageCopy(Offset, 0, 0,
+                            {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+                            {0, 0, 0}, {R.Extent.width, R.Extent.height, 1}));
+    if (hasDedicatedTransferQueue()) {
+      // Release half of the ownership transfer; the stage and access on
+      // the destination side are ignored
+      Cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                          vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {},
+                          ownershipBarrier(P.Image.Image,
+                                           vk::AccessFlagBits::eTransferWrite,
+                                           {}));
+    } else {
+      Cmd.pipelineBarrier(
+          vk::PipelineStageFlagBits::eTransfer,
+          vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {},
+          vk::ImageMemoryBarrier(
+              vk::AccessFlagBits::eTransferWrite,
+              vk::AccessFlagBits::eShaderRead,
+              vk::ImageLayout::eTransferDstOptimal,
+              vk::ImageLayout::eShaderReadOnlyOptimal, VK_QUEUE_FAMILY_IGNORED,
+              VK_QUEUE_FAMILY_IGNORED, P.Image.Image, Range));
+    }
+    Cmd.end();
+    return P;
+  }
+
+  void retire(Batch &B) {
+    for (Pending &P : B.Items) {
+      releaseStaging(P.StagingBytes);
+      if (P.Error) {
+        P.Promise.set_exception(P.Error);
+        --Outstanding;
+        continue;
+      }
+      if (P.OnComplete)
+        P.OnComplete(P.Image);
+      P.Promise.set_value(P.Image);
+      --Outstanding;
+    }
+    recycle(B);
+  }
+
+  void recycle(Batch &B) {
+    Device.resetFences(B.Fence);
+    FreeFences.push_back(B.Fence);
+    if (B.Semaphore)
+      FreeSemaphores.push_back(B.Semaphore);
+    if (B.Acquire)
+      FreeGraphicsBuffers.push_back(B.Acquire);
+    std::lock_guard Lock(Mutex);
+    for (Pending const &P : B.Items)
+      if (P.CommandBuffer)
+        FreeTransferBuffers.push_back(P.CommandBuffer);
+  }
+
+  vk::Fence takeFence() {
+    if (FreeFences.empty())
+      return Device.createFence({}, AllocationCallbacks);
+    vk::Fence Fence = FreeFences.back();
+    FreeFences.pop_back();
+    return Fence;
+  }
+
+  vk::Semaphore takeSemaphore() {
+    if (FreeSemaphores.empty())
+      return Device.createSemaphore({}, AllocationCallbacks);
+    vk::Semaphore Semaphore = FreeSemaphores.back();
+    FreeSemaphores.pop_back();
+    return Semaphore;
+  }
+
+  vk::CommandBuffer takeGraphicsBuffer() {
+    if (FreeGraphicsBuffers.empty())
+      return Device
+          .allocateCommandBuffers(
+              {GraphicsPool, vk::CommandBufferLevel::ePrimary, 1})
+          .front();
+    vk::CommandBuffer Buffer = FreeGraphicsBuffers.back();
+    FreeGraphicsBuffers.pop_back();
+    return Buffer;
+  }
+
+  /// Worker only; buffers come back from the render thread once retired.
+  vk::CommandBuffer takeTransferBuffer() {
+    {
+      std::lock_guard Lock(Mutex);
+      if (!FreeTransferBuffers.empty()) {
+        vk::CommandBuffer Buffer = FreeTransferBuffers.back();
+        FreeTransferBuffers.pop_back();
+        return Buffer;
+      }
+    }
+    return Device
+        .allocateCommandBuffers(
+            {TransferPool, vk::CommandBufferLevel::ePrimary, 1})
+        .front();
+  }
+
+  vk::Device Device;
+  DeviceMemoryAllocator *DeviceMemory = nullptr;
+  vk::AllocationCallbacks AllocationCallbacks;
+  uint32_t GraphicsQueueFamilyIndex = 0;
+  vk::Queue GraphicsQueue;
+  uint32_t TransferQueueFamilyIndex = 0;
+  vk::Queue TransferQueue;
+  vk::CommandPool TransferPool;
+  vk::CommandPool GraphicsPool;
+  vk::Sampler Sampler;
+
+  vk::Buffer Staging;
+  DeviceAllocation StagingAllocation;
+  vk::DeviceSize StagingCapacity = 0;
+  std::mutex StagingMutex;
+  std::condition_variable StagingCv;
+  vk::DeviceSize StagingHead = 0;
+  vk::DeviceSize StagingTail = 0;
+  vk::DeviceSize StagingUsed = 0;
+
+  // Guards Requests, Ready, FreeTransferBuffers and Stop
+  std::mutex Mutex;
+  std::condition_variable RequestCv;
+  std::condition_variable ReadyCv;
+  std::deque<Request> Requests;
+  std::vector<Pending> Ready;
+  std::vector<vk::CommandBuffer> FreeTransferBuffers;
+  std::atomic<bool> Stop{false};
+  /// Uploads queued and not yet retired or failed.
+  std::atomic<uint32_t> Outstanding{0};
+  std::thread Worker;
+
+  // Render thread only
+  std::deque<Batch> InFlight;
+  std::vector<vk::Fence> FreeFences;
+  std::vector<vk::Semaphore> FreeSemaphores;
+  std::vector<vk::CommandBuffer> FreeGraphicsBuffers;
+};
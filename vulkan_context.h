@@ -3,9 +3,34 @@
 
 #pragma once
 
+#include "compute_stage.h"
+#include "device_memory.h"
+#include "device_select.h"
+#include "frame_ring.h"
+#include "host_allocator.h"
+#include "offscreen.h"
+#include "pipeline_cache.h"
+#include "present_window.h"
+#include "profiler.h"
+#include "record_pool.h"
+#include "upload_service.h"
+
 #include <imgui_impl_vulkan.h>
 #include <vulkan/vulkan.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+
+// Every vulkan.hpp call and every raw call goes through the dispatcher the
+// context fills from vkGetDeviceProcAddr, see VulkanContext
+#if !VULKAN_HPP_DISPATCH_LOADER_DYNAMIC
+#error "Build with VULKAN_HPP_DISPATCH_LOADER_DYNAMIC=1"
+#endif
+
 namespace {
 
 VKAPI_ATTR VkBool32 VKAPI_CALL debugUtilsMessengerCallback(
@@ -99,46 +124,172 @@ makeInstanceCreateInfoChain(vk::ApplicationInfo const &ApplicationInfo,
 struct VulkanContext {
   VulkanContext(std::string const &AppName, std::string const &EngineName,
                 std::vector<char const *> const &Extensions = {},
-                std::vector<char const *> const &Layers = {}) {
+                std::vector<char const *> const &Layers = {},
+                std::string const &DeviceOverride = {},
+                std::filesystem::path PipelineCachePath = "pipeline_cache.bin")
+      : PipelineCachePath(std::move(PipelineCachePath)) {
+    // Without a surface extension there is nothing to present to, so the
+    // context runs headless and renders through setupOffscreen instead.
+    Headless = std::none_of(
+        Extensions.begin(), Extensions.end(), [](char const *Extension) {
+          return std::strcmp(Extension, VK_KHR_SURFACE_EXTENSION_NAME) == 0;
+        });
 
+    // Global functions first, instance functions once there is an instance
+    // and device functions straight from the driver once there is a device
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(vkGetInstanceProcAddr);
+
+    // 1.1 where the loader has it, for vkGetPhysicalDeviceMemoryProperties2,
+    // and 1.2 for core timeline semaphores. A 1.0 loader does not export
+    // vkEnumerateInstanceVersion at all.
+    uint32_t ApiVersion = VK_API_VERSION_1_0;
+    if (VULKAN_HPP_DEFAULT_DISPATCHER.vkEnumerateInstanceVersion)
+      ApiVersion = std::min(vk::enumerateInstanceVersion(),
+                            static_cast<uint32_t>(VK_API_VERSION_1_2));
     vk::ApplicationInfo ApplicationInfo(AppName.data(), 1, EngineName.data(), 1,
-                                        VK_API_VERSION_1_0);
+                                        ApiVersion);
     Instance = vk::createInstance(
         makeInstanceCreateInfoChain(ApplicationInfo, Layers, Extensions)
-            .get<vk::InstanceCreateInfo>());
-
-    std::vector<vk::PhysicalDevice> PhysicalDevices =
-        Instance.enumeratePhysicalDevices();
-    PhysicalDevice = PhysicalDevices.front();
-    for (auto &&D : PhysicalDevices) {
-      VkPhysicalDeviceProperties Properties;
-      vkGetPhysicalDeviceProperties(D, &Properties);
-      if (Properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-        errsv("Selected device: <{}>", Properties.deviceName);
-        PhysicalDevice = D;
-        break;
-      }
-    }
+            .get<vk::InstanceCreateInfo>(),
+        AllocationCallbacks);
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(Instance);
 
-    std::vector<vk::QueueFamilyProperties> Queues =
-        PhysicalDevice.getQueueFamilyProperties();
-    for (size_t I = 0; I < Queues.size(); ++I) {
-      auto &&QueueFamilyProperties = Queues[I];
-      if (QueueFamilyProperties.queueFlags & vk::QueueFlagBits::eGraphics) {
-        QueueFamilyIndex = I;
-        break;
-      }
-    }
+    PhysicalDevice = selectPhysicalDevice(Instance, DeviceOverride, !Headless);
+    QueueTopology Topology =
+        *selectQueueTopology(PhysicalDevice.getQueueFamilyProperties());
+    QueueFamilyIndex = Topology.Graphics;
+    ComputeQueueFamilyIndex = Topology.Compute;
+    TransferQueueFamilyIndex = Topology.Transfer;
+
+    { // Create Logical Device (graphics, compute and transfer queues)
+      std::vector<char const *> DeviceExtensions;
+      if (!Headless)
+        DeviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+      std::vector<vk::ExtensionProperties> Available =
+          PhysicalDevice.enumerateDeviceExtensionProperties();
+      auto IsAvailable = [&](char const *Name) {
+        return std::any_of(Available.begin(), Available.end(),
+                           [Name](vk::ExtensionProperties const &Extension) {
+                             return std::strcmp(Extension.extensionName,
+                                                Name) == 0;
+                           });
+      };
+      MemoryBudget =
+          ApiVersion >= VK_API_VERSION_1_1 &&
+          PhysicalDevice.getProperties().apiVersion >= VK_API_VERSION_1_1 &&
+          IsAvailable(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+      if (MemoryBudget)
+        DeviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+      // One queue per role, roles sharing a family get separate queues of
+      // it while it has enough, and share its last queue otherwise
+      std::vector<vk::QueueFamilyProperties> Families =
+          PhysicalDevice.getQueueFamilyProperties();
+      std::vector<uint32_t> QueueCounts(Families.size(), 0);
+      auto TakeQueue = [&](uint32_t Family) {
+        uint32_t Index = std::min(QueueCounts[Family],
+                                  Families[Family].queueCount - 1);
+        QueueCounts[Family] = Index + 1;
+        return Index;
+      };
+      uint32_t ComputeQueueIndex = 0;
+      uint32_t TransferQueueIndex = 0;
+      TakeQueue(QueueFamilyIndex);
+      if (ComputeQueueFamilyIndex != QueueFamilyIndex)
+        ComputeQueueIndex = TakeQueue(ComputeQueueFamilyIndex);
+      if (TransferQueueFamilyIndex != QueueFamilyIndex)
+        TransferQueueIndex = TakeQueue(TransferQueueFamilyIndex);
 
-    { // Create Logical Device (with 1 queue)
-      float QueuePriority = 1.0f;
-      std::vector<char const *> DeviceExtensions{"VK_KHR_swapchain"};
-      vk::DeviceQueueCreateInfo DeviceQueueCreateInfo({}, QueueFamilyIndex, 1,
-                                                      &QueuePriority);
-      vk::DeviceCreateInfo DeviceCreateInfo({}, DeviceQueueCreateInfo, {},
+      std::vector<float> QueuePriorities(2, 1.0f);
+      std::vector<vk::DeviceQueueCreateInfo> QueueCreateInfos;
+      for (uint32_t Family = 0; Family < QueueCounts.size(); ++Family)
+        if (QueueCounts[Family] != 0)
+          QueueCreateInfos.push_back({{}, Family, QueueCounts[Family],
+                                      QueuePriorities.data()});
+      // Timeline semaphores for the compute stage: core in 1.2, an
+      // extension before
+      bool Core12 =
+          ApiVersion >= VK_API_VERSION_1_2 &&
+          PhysicalDevice.getProperties().apiVersion >= VK_API_VERSION_1_2;
+      bool TimelineExtension =
+          !Core12 && ApiVersion >= VK_API_VERSION_1_1 &&
+          IsAvailable(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+      if (Core12 || TimelineExtension)
+        TimelineSemaphores =
+            PhysicalDevice
+                .getFeatures2<vk::PhysicalDeviceFeatures2,
+                              vk::PhysicalDeviceTimelineSemaphoreFeatures>()
+                .get<vk::PhysicalDeviceTimelineSemaphoreFeatures>()
+                .timelineSemaphore;
+      if (TimelineSemaphores && TimelineExtension)
+        DeviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+      vk::PhysicalDeviceTimelineSemaphoreFeatures TimelineFeatures(VK_TRUE);
+      // vkQueueSubmit2 for the frame submit, only worth it on top of
+      // timeline semaphores
+      Synchronization2 =
+          TimelineSemaphores &&
+          IsAvailable(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) &&
+          PhysicalDevice
+              .getFeatures2<vk::PhysicalDeviceFeatures2,
+                            vk::PhysicalDeviceSynchronization2FeaturesKHR>()
+              .get<vk::PhysicalDeviceSynchronization2FeaturesKHR>()
+              .synchronization2;
+      if (Synchronization2)
+        DeviceExtensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+      vk::PhysicalDeviceSynchronization2FeaturesKHR Synchronization2Features(
+          VK_TRUE);
+
+      vk::DeviceCreateInfo DeviceCreateInfo({}, QueueCreateInfos, {},
                                             DeviceExtensions, nullptr);
-      Device = PhysicalDevice.createDevice(DeviceCreateInfo);
+      if (TimelineSemaphores)
+        DeviceCreateInfo.setPNext(&TimelineFeatures);
+      if (Synchronization2)
+        TimelineFeatures.setPNext(&Synchronization2Features);
+      Device = PhysicalDevice.createDevice(DeviceCreateInfo,
+                                           AllocationCallbacks);
+      // From here on the hot calls (acquire, submit, present, command
+      // recording) skip the loader's per-call trampolines
+      VULKAN_HPP_DEFAULT_DISPATCHER.init(Device);
+      errsv("Frame scheduling: {}",
+            !TimelineSemaphores ? "fences"
+            : Synchronization2 ? "timeline semaphore, vkQueueSubmit2"
+                               : "timeline semaphore");
       Queue = Device.getQueue(QueueFamilyIndex, 0);
+      ComputeQueue =
+          Device.getQueue(ComputeQueueFamilyIndex, ComputeQueueIndex);
+      TransferQueue =
+          Device.getQueue(TransferQueueFamilyIndex, TransferQueueIndex);
+      errsv("Queue families: graphics = {}, compute = {}{}, transfer = {}{}",
+            QueueFamilyIndex, ComputeQueueFamilyIndex,
+            Topology.hasAsyncCompute() ? "" : " (shared)",
+            TransferQueueFamilyIndex,
+            Topology.hasDedicatedTransfer() ? "" : " (shared)");
+    }
+
+    DeviceMemory.init(PhysicalDevice, Device, AllocationCallbacks,
+                      MemoryBudget);
+    errsv("Device memory budget: {}",
+          MemoryBudget ? VK_EXT_MEMORY_BUDGET_EXTENSION_NAME : "estimated");
+
+    Uploads.init(Device, DeviceMemory, AllocationCallbacks, QueueFamilyIndex,
+                 Queue, TransferQueueFamilyIndex, TransferQueue);
+
+    Profiler.init(PhysicalDevice, Device, QueueFamilyIndex,
+                  AllocationCallbacks);
+
+    { // Create Pipeline Cache, seeded from the previous run if it matches
+      auto Start = std::chrono::steady_clock::now();
+      std::vector<char> InitialData = loadPipelineCacheData(
+          this->PipelineCachePath, PhysicalDevice.getProperties());
+      vk::PipelineCacheCreateInfo PipelineCacheCreateInfo(
+          {}, InitialData.size(), InitialData.data());
+      PipelineCache = Device.createPipelineCache(PipelineCacheCreateInfo,
+                                                 AllocationCallbacks);
+      std::chrono::duration<double, std::milli> Elapsed =
+          std::chrono::steady_clock::now() - Start;
+      errsv("Pipeline cache {} <{}>: {} bytes loaded in {:.3f} ms",
+            InitialData.empty() ? "miss" : "hit",
+            this->PipelineCachePath.string(), InitialData.size(),
+            Elapsed.count());
     }
 
     { // Create Descriptor Pool
@@ -160,15 +311,73 @@ struct VulkanContext {
       DescriptorPool = Device.createDescriptorPool(DescriptorPoolCreateInfo,
                                                    AllocationCallbacks);
     }
+
+    if (TimelineSemaphores)
+      Simulation.init(Device, DeviceMemory, AllocationCallbacks, PipelineCache,
+                      DescriptorPool, Uploads.getSampler(), QueueFamilyIndex,
+                      ComputeQueueFamilyIndex, ComputeQueue);
+    else
+      errsv("No timeline semaphores, the compute stage is disabled");
+  }
+
+  VulkanContext(VulkanContext const &) = delete;
+  VulkanContext &operator=(VulkanContext const &) = delete;
+
+  ~VulkanContext() {
+    // Retired swapchains ask the frame ring whether their frames have
+    // completed, so the windows go before the ring and its semaphore
+    Device.waitIdle();
+    // The backend's pipelines belong to the device; with viewports, its
+    // shutdown also removes the viewport windows
+    if (ImGui::GetCurrentContext() && ImGui::GetIO().BackendRendererUserData)
+      ImGui_ImplVulkan_Shutdown();
+    while (Windows.size() > 1)
+      removeWindow(*Windows.back());
+    if (MainWindow.Data.Swapchain) {
+      collectRetiredSwapchains();
+      destroyWindowResources(MainWindow);
+      Device.destroyRenderPass(MainWindow.Data.RenderPass,
+                               AllocationCallbacks);
+    }
+    if (MainWindow.Data.Surface)
+      Instance.destroySurfaceKHR(MainWindow.Data.Surface);
+    Frames.destroy(Device, AllocationCallbacks);
+    Recorders.destroy(Device, AllocationCallbacks);
+    Profiler.destroy(Device, AllocationCallbacks);
+    Simulation.destroy();
+    if (FontImage.Image)
+      Uploads.destroyImage(FontImage);
+    Uploads.destroy();
+    if (Offscreen)
+      destroyOffscreenTarget(Device, DeviceMemory, AllocationCallbacks,
+                             *Offscreen);
+    DeviceMemory.destroy();
+    Device.destroyDescriptorPool(DescriptorPool, AllocationCallbacks);
+    if (PipelineCache) {
+      savePipelineCache();
+      Device.destroyPipelineCache(PipelineCache, AllocationCallbacks);
+    }
+    // Both were created with AllocationCallbacks, so HostAllocations only
+    // reports leaks once they are gone
+    Device.destroy(AllocationCallbacks);
+    Instance.destroy(AllocationCallbacks);
+  }
+
+  /// Serializes the pipeline cache to disk so the next launch can skip
+  /// pipeline compilation. Safe to call at any point after setup.
+  void savePipelineCache() noexcept {
+    try {
+      savePipelineCacheData(PipelineCachePath,
+                            Device.getPipelineCacheData(PipelineCache));
+    } catch (std::exception &E) {
+      errsv("Failed to save pipeline cache: {}", E.what());
+    }
   }
 
   void setupWindow(VkSurfaceKHR Surface, int Width, int Height) {
+    auto &MainWindowData = MainWindow.Data;
     MainWindowData.Surface = Surface;
-    // Check for WSI support
-    vk::Bool32 Result{false};
-    PhysicalDevice.getSurfaceSupportKHR(QueueFamilyIndex, Surface, &Result);
-    if (Result != VK_TRUE)
-      throw std::invalid_argument("No WSI support");
+    checkPresentSupport(Surface);
 
     const VkFormat RequestSurfaceImageFormat[] = {
         VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_R8G8B8A8_UNORM,
@@ -181,49 +390,468 @@ struct VulkanContext {
         (size_t)IM_ARRAYSIZE(RequestSurfaceImageFormat),
         RequestSurfaceColorSpace);
 
-#ifdef IMGUI_UNLIMITED_FRAME_RATE
-    VkPresentModeKHR PresentModes[] = {VK_PRESENT_MODE_MAILBOX_KHR,
-                                       VK_PRESENT_MODE_IMMEDIATE_KHR,
-                                       VK_PRESENT_MODE_FIFO_KHR};
-#else
-    VkPresentModeKHR PresentModes[] = {VK_PRESENT_MODE_FIFO_KHR};
-#endif
+    SupportedPresentModes = PhysicalDevice.getSurfacePresentModesKHR(Surface);
+    MainWindowData.PresentMode =
+        selectPresentMode(Surface, RequestedPresentMode);
+    errsv("Selected PresentMode = <{}>",
+          vk::to_string(vk::PresentModeKHR(MainWindowData.PresentMode)));
+
+    createFrameRing();
+    createWindowRenderPass();
+    createWindowSemaphores(MainWindow);
+    createOrResizeSwapchain(MainWindow, Width, Height);
+    Windows.assign(1, &MainWindow);
+  }
+
+  /// Adds a window presenting to \p Surface, which the context takes
+  /// ownership of (it must have been created without allocation callbacks,
+  /// as SDL does). setupWindow must have been called: the window renders
+  /// through the main window's render pass and ImGui pipeline, so its
+  /// surface has to support the same format. From the next frame on,
+  /// frameRender draws into it alongside the others.
+  PresentWindow &addWindow(VkSurfaceKHR Surface, int Width, int Height) {
+    if (!MainWindow.Data.Swapchain)
+      throw std::logic_error("addWindow needs setupWindow first");
+    if (Windows.size() == MaxWindows) {
+      Instance.destroySurfaceKHR(Surface);
+      throw std::runtime_error(
+          fmt::format("At most {} windows are supported", MaxWindows));
+    }
+    auto Window = std::make_unique<PresentWindow>();
+    ImGui_ImplVulkanH_Window &Wd = Window->Data;
+    Wd.Surface = Surface;
+    try {
+      checkPresentSupport(Surface);
+      std::vector<vk::SurfaceFormatKHR> Formats =
+          PhysicalDevice.getSurfaceFormatsKHR(Surface);
+      auto const &Main = MainWindow.Data.SurfaceFormat;
+      if (std::none_of(Formats.begin(), Formats.end(),
+                       [&](vk::SurfaceFormatKHR Format) {
+                         return static_cast<VkFormat>(Format.format) ==
+                                Main.format;
+                       }))
+        throw std::runtime_error(
+            fmt::format("Window surface does not support {}",
+                        vk::to_string(static_cast<vk::Format>(Main.format))));
+    } catch (...) {
+      Instance.destroySurfaceKHR(Surface);
+      throw;
+    }
+    Wd.SurfaceFormat = MainWindow.Data.SurfaceFormat;
+    Wd.PresentMode = selectPresentMode(Surface, RequestedPresentMode);
+    Wd.RenderPass = MainWindow.Data.RenderPass;
+    Wd.ClearEnable = true;
+    Window->RequestedWidth = Width;
+    Window->RequestedHeight = Height;
+    createWindowSemaphores(*Window);
+    createOrResizeSwapchain(*Window, Width, Height);
+    Windows.push_back(Window.get());
+    SecondaryWindows.push_back(std::move(Window));
+    return *SecondaryWindows.back();
+  }
+
+  /// Destroys a window added by addWindow along with its surface. Waits for
+  /// the graphics queue, which also covers the window's pending present;
+  /// closing a window is rare enough not to bother retiring its semaphores.
+  void removeWindow(PresentWindow &Window) {
+    auto Found = std::find_if(
+        SecondaryWindows.begin(), SecondaryWindows.end(),
+        [&](auto const &Secondary) { return Secondary.get() == &Window; });
+    if (Found == SecondaryWindows.end())
+      throw std::logic_error("Not a window added by addWindow");
+    Queue.waitIdle();
+    // Retired swapchains have to go before their surface
+    collectRetiredSwapchains();
+    destroyWindowResources(Window);
+    Instance.destroySurfaceKHR(Window.Data.Surface);
+    std::erase(Windows, &Window);
+    SecondaryWindows.erase(Found);
+  }
+
+  /// (Re)creates the swapchain at the given size without idling the device.
+  /// The previous swapchain is passed as oldSwapchain and retired along with
+  /// its image views and framebuffers until the frames that may still use
+  /// them have completed. The render pass and the frame ring (command pools,
+  /// fences, semaphores) do not depend on the extent and are kept.
+  void createOrResizeSwapchain(int Width, int Height) {
+    createOrResizeSwapchain(MainWindow, Width, Height);
+  }
+
+  void createOrResizeSwapchain(PresentWindow &Window, int Width, int Height) {
+    Clock::time_point Start = Clock::now();
+    auto &Wd = Window.Data;
+    auto &SwapchainFrames = Window.SwapchainFrames;
+    vk::SurfaceCapabilitiesKHR Capabilities =
+        PhysicalDevice.getSurfaceCapabilitiesKHR(Wd.Surface);
+
+    vk::Extent2D Extent = Capabilities.currentExtent;
+    if (Extent.width == UINT32_MAX) {
+      Extent.width = std::clamp(static_cast<uint32_t>(Width),
+                                Capabilities.minImageExtent.width,
+                                Capabilities.maxImageExtent.width);
+      Extent.height = std::clamp(static_cast<uint32_t>(Height),
+                                 Capabilities.minImageExtent.height,
+                                 Capabilities.maxImageExtent.height);
+    }
+    uint32_t ImageCount = std::max(MinImageCount, Capabilities.minImageCount);
+    if (Capabilities.maxImageCount != 0)
+      ImageCount = std::min(ImageCount, Capabilities.maxImageCount);
+
+    vk::SwapchainKHR OldSwapchain = Wd.Swapchain;
+    vk::SwapchainCreateInfoKHR SwapchainCreateInfo(
+        {}, Wd.Surface, ImageCount,
+        static_cast<vk::Format>(Wd.SurfaceFormat.format),
+        static_cast<vk::ColorSpaceKHR>(Wd.SurfaceFormat.colorSpace), Extent, 1,
+        vk::ImageUsageFlagBits::eColorAttachment, vk::SharingMode::eExclusive,
+        {}, Capabilities.currentTransform,
+        vk::CompositeAlphaFlagBitsKHR::eOpaque,
+        static_cast<vk::PresentModeKHR>(Wd.PresentMode), VK_TRUE,
+        OldSwapchain);
+    vk::SwapchainKHR Swapchain =
+        Device.createSwapchainKHR(SwapchainCreateInfo, AllocationCallbacks);
+
+    if (OldSwapchain) {
+      RetiredSwapchain Retired{OldSwapchain, {}, {}, {},
+                               Frames.getSubmitCount()};
+      for (ImGui_ImplVulkanH_Frame const &Frame : SwapchainFrames) {
+        Retired.ImageViews.push_back(Frame.BackbufferView);
+        Retired.Framebuffers.push_back(Frame.Framebuffer);
+      }
+      Retired.RenderComplete.swap(Window.RenderComplete);
+      RetiredSwapchains.push_back(std::move(Retired));
+    }
 
-    MainWindowData.PresentMode = ImGui_ImplVulkanH_SelectPresentMode(
-        PhysicalDevice, Surface, PresentModes, IM_ARRAYSIZE(PresentModes));
-    errsv("Selected PresentMode = <{}>", MainWindowData.PresentMode);
+    std::vector<vk::Image> Images = Device.getSwapchainImagesKHR(Swapchain);
+    SwapchainFrames.assign(Images.size(), ImGui_ImplVulkanH_Frame{});
+    for (size_t I = 0; I < Images.size(); ++I) {
+      ImGui_ImplVulkanH_Frame &Frame = SwapchainFrames[I];
+      Frame.Backbuffer = Images[I];
+      vk::ImageViewCreateInfo ViewCreateInfo(
+          {}, Images[I], vk::ImageViewType::e2D,
+          static_cast<vk::Format>(Wd.SurfaceFormat.format), {},
+          {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+      vk::ImageView View =
+          Device.createImageView(ViewCreateInfo, AllocationCallbacks);
+      Frame.BackbufferView = View;
+      vk::FramebufferCreateInfo FramebufferCreateInfo(
+          {}, Wd.RenderPass, View, Extent.width, Extent.height, 1);
+      Frame.Framebuffer =
+          Device.createFramebuffer(FramebufferCreateInfo, AllocationCallbacks);
+      Window.RenderComplete.push_back(
+          Device.createSemaphore({}, AllocationCallbacks));
+    }
+
+    Wd.Swapchain = Swapchain;
+    Wd.Width = static_cast<int>(Extent.width);
+    Wd.Height = static_cast<int>(Extent.height);
+    Wd.ImageCount = static_cast<uint32_t>(Images.size());
+    Wd.Frames = SwapchainFrames.data();
+    Wd.FrameIndex = 0;
+    collectRetiredSwapchains();
+    LastSwapchainRebuildMs = millisecondsBetween(Start, Clock::now());
+  }
+
+  /// Destroys retired swapchains whose frames have all completed. Cheap and
+  /// non-blocking, called once per frame.
+  void collectRetiredSwapchains() {
+    std::erase_if(RetiredSwapchains, [this](RetiredSwapchain &Retired) {
+      if (!Frames.isComplete(Device, Retired.LastFrame))
+        return false;
+      destroySwapchainResources(Retired.Swapchain, Retired.ImageViews,
+                                Retired.Framebuffers);
+      for (vk::Semaphore Semaphore : Retired.RenderComplete)
+        Device.destroySemaphore(Semaphore, AllocationCallbacks);
+      return true;
+    });
+  }
+
+  /// CPU time the last createOrResizeSwapchain took.
+  double getLastSwapchainRebuildMs() const noexcept {
+    return LastSwapchainRebuildMs;
+  }
+
+  /// Switches the present mode at runtime. The swapchain is recreated by the
+  /// next rebuildSwapChain; unsupported modes fall back to FIFO, which every
+  /// surface supports.
+  void setPresentMode(vk::PresentModeKHR Mode) {
+    RequestedPresentMode = Mode;
+    for (PresentWindow *Window : Windows) {
+      auto &Wd = Window->Data;
+      if (!Wd.Surface)
+        continue;
+      VkPresentModeKHR Selected = selectPresentMode(Wd.Surface, Mode);
+      if (Selected == Wd.PresentMode)
+        continue;
+      Wd.PresentMode = Selected;
+      Window->Rebuild = true;
+      if (Window == &MainWindow)
+        errsv("Switching PresentMode to <{}>",
+              vk::to_string(vk::PresentModeKHR(Selected)));
+    }
+  }
+
+  bool isPresentModeSupported(vk::PresentModeKHR Mode) const {
+    return std::find(SupportedPresentModes.begin(), SupportedPresentModes.end(),
+                     Mode) != SupportedPresentModes.end();
+  }
+  vk::PresentModeKHR getPresentMode() const noexcept {
+    return static_cast<vk::PresentModeKHR>(MainWindow.Data.PresentMode);
+  }
 
-    ImGui_ImplVulkanH_CreateOrResizeWindow(
-        Instance, PhysicalDevice, Device, &MainWindowData, QueueFamilyIndex,
-        reinterpret_cast<VkAllocationCallbacks const *>(&AllocationCallbacks),
-        Width, Height, MinImageCount);
+  /// Number of images ImGui keeps vertex buffers for: enough for every frame
+  /// in flight, and never fewer than the swapchain minimum it asserts on.
+  /// Every window's draw data takes the next buffer of the same ring, so
+  /// that is sized for the most windows there can be.
+  uint32_t getRenderBufferCount() const noexcept {
+    return std::max(FramesInFlight, MinImageCount) * MaxWindows;
   }
 
+  /// Headless counterpart of setupWindow: renders into an offscreen color
+  /// image. The main window is filled in so that frameRender and the ImGui
+  /// backend see a single-image "window" without a swapchain.
+  void setupOffscreen(uint32_t Width, uint32_t Height) {
+    auto &MainWindowData = MainWindow.Data;
+    Offscreen = createOffscreenTarget(Device, DeviceMemory, AllocationCallbacks,
+                                      Width, Height);
+    createFrameRing();
+
+    OffscreenFrame = ImGui_ImplVulkanH_Frame{};
+    OffscreenFrame.Backbuffer = Offscreen->Image;
+    OffscreenFrame.BackbufferView = Offscreen->ImageView;
+    OffscreenFrame.Framebuffer = Offscreen->Framebuffer;
+
+    MainWindowData.Width = static_cast<int>(Width);
+    MainWindowData.Height = static_cast<int>(Height);
+    MainWindowData.SurfaceFormat.format =
+        static_cast<VkFormat>(OffscreenTarget::Format);
+    MainWindowData.RenderPass = Offscreen->RenderPass;
+    MainWindowData.ClearEnable = true;
+    MainWindowData.ImageCount = 1;
+    MainWindowData.FrameIndex = 0;
+    MainWindowData.Frames = &OffscreenFrame;
+    Windows.assign(1, &MainWindow);
+  }
+
+  /// Waits for the last submitted offscreen frame and returns its RGBA8
+  /// pixels. Readback has to be enabled before that frame was rendered.
+  std::span<uint8_t const> readbackOffscreen() {
+    if (!Offscreen || !Offscreen->ReadbackEnabled)
+      throw std::logic_error("Offscreen readback is not enabled");
+    Frames.wait(Device, Frames.getSubmitCount());
+    DeviceMemory.invalidate(Offscreen->ReadbackAllocation);
+    return {static_cast<uint8_t const *>(Offscreen->ReadbackAllocation.Mapped),
+            Offscreen->getReadbackSize()};
+  }
+
+  /// Entry point \p Name from the device when it is a device function, from
+  /// the instance otherwise, for code that loads its own (the ImGui backend).
+  PFN_vkVoidFunction getProcAddr(char const *Name) const {
+    if (PFN_vkVoidFunction Function =
+            VULKAN_HPP_DEFAULT_DISPATCHER.vkGetDeviceProcAddr(Device, Name))
+      return Function;
+    return VULKAN_HPP_DEFAULT_DISPATCHER.vkGetInstanceProcAddr(Instance, Name);
+  }
+
+  bool isHeadless() const noexcept { return Headless; }
+  auto &getOffscreenTarget() noexcept { return Offscreen; }
   auto &getInstance() noexcept { return Instance; }
-  auto &getMainWindowData() noexcept  { return MainWindowData; }
+  auto &getMainWindowData() noexcept  { return MainWindow.Data; }
+  auto &getMainWindow() noexcept { return MainWindow; }
+  /// Every window frameRender draws, the main window first.
+  std::vector<PresentWindow *> const &getWindows() const noexcept {
+    return Windows;
+  }
   auto &getPhysicalDevice() noexcept  { return PhysicalDevice; }
   auto &getDevice() noexcept { return Device; }
   auto getQueueFamilyIndex() const noexcept { return QueueFamilyIndex; }
   auto &getQueue() noexcept { return Queue; }
+  auto getComputeQueueFamilyIndex() const noexcept {
+    return ComputeQueueFamilyIndex;
+  }
+  /// Async compute queue; the graphics queue when there is no separate
+  /// compute family.
+  auto &getComputeQueue() noexcept { return ComputeQueue; }
+  auto &getSimulation() noexcept { return Simulation; }
+  auto getTransferQueueFamilyIndex() const noexcept {
+    return TransferQueueFamilyIndex;
+  }
+  auto &getTransferQueue() noexcept { return TransferQueue; }
   auto &getPipelineCache() noexcept { return PipelineCache; }
   auto &getDescriptorPool() noexcept { return DescriptorPool; }
   auto &getMinImageCount() noexcept { return MinImageCount; }
+  /// Takes effect on the next setupWindow/setupOffscreen.
+  auto &getFramesInFlight() noexcept { return FramesInFlight; }
+  auto &getFrameRing() noexcept { return Frames; }
+  /// Worker threads recording render layers, on top of the calling thread.
+  /// Takes effect on the next setupWindow/setupOffscreen.
+  auto &getRecordThreads() noexcept { return RecordThreads; }
+  auto &getRecordPool() noexcept { return Recorders; }
+  /// Drawn below the UI in this order, each into a secondary command buffer
+  /// recorded on the record pool. With none, the UI is recorded inline.
+  auto &getRenderLayers() noexcept { return Layers; }
   auto &getAllocationCallbacks() noexcept { return AllocationCallbacks; }
-  auto &getSwapChainRebuild() noexcept { return SwapChainRebuild; }
+  auto &getHostAllocator() noexcept { return HostAllocations; }
+  auto &getDeviceMemory() noexcept { return DeviceMemory; }
+  auto &getUploads() noexcept { return Uploads; }
+  /// ImGui font atlas, uploaded by initImGuiVulkan.
+  auto &getFontImage() noexcept { return FontImage; }
+  /// The main window's; see PresentWindow::Rebuild for the others.
+  auto &getSwapChainRebuild() noexcept { return MainWindow.Rebuild; }
+  auto &getProfiler() noexcept { return Profiler; }
+
+  /// Windows the main one and addWindow's together can reach.
+  static constexpr uint32_t MaxWindows = 8;
 
 private:
-  vk::AllocationCallbacks AllocationCallbacks;
+  static_assert(FrameRing::MaxFrames <= FrameProfiler::FramesBehind,
+                "GPU timestamps would be read before their frame completes");
+
+  VkPresentModeKHR selectPresentMode(VkSurfaceKHR Surface,
+                                     vk::PresentModeKHR Mode) const {
+    VkPresentModeKHR PresentModes[] = {static_cast<VkPresentModeKHR>(Mode),
+                                       VK_PRESENT_MODE_FIFO_KHR};
+    return ImGui_ImplVulkanH_SelectPresentMode(PhysicalDevice, Surface,
+                                               PresentModes,
+                                               IM_ARRAYSIZE(PresentModes));
+  }
+
+  void checkPresentSupport(VkSurfaceKHR Surface) {
+    vk::Bool32 Result{false};
+    PhysicalDevice.getSurfaceSupportKHR(QueueFamilyIndex, Surface, &Result);
+    if (Result != VK_TRUE)
+      throw std::invalid_argument("No WSI support");
+  }
+
+  /// Acquire semaphores, one per frame slot. The render-complete ones are
+  /// per swapchain image and come with the swapchain.
+  void createWindowSemaphores(PresentWindow &Window) {
+    for (uint32_t I = 0; I < Frames.size(); ++I)
+      Window.ImageAcquired.push_back(
+          Device.createSemaphore({}, AllocationCallbacks));
+  }
+
+  /// Swapchain, views, framebuffers and semaphores, not the surface or the
+  /// shared render pass. The window must be idle.
+  void destroyWindowResources(PresentWindow &Window) {
+    std::vector<vk::ImageView> ImageViews;
+    std::vector<vk::Framebuffer> Framebuffers;
+    for (ImGui_ImplVulkanH_Frame const &Frame : Window.SwapchainFrames) {
+      ImageViews.push_back(Frame.BackbufferView);
+      Framebuffers.push_back(Frame.Framebuffer);
+    }
+    destroySwapchainResources(Window.Data.Swapchain, ImageViews,
+                              Framebuffers);
+    for (vk::Semaphore Semaphore : Window.ImageAcquired)
+      Device.destroySemaphore(Semaphore, AllocationCallbacks);
+    for (vk::Semaphore Semaphore : Window.RenderComplete)
+      Device.destroySemaphore(Semaphore, AllocationCallbacks);
+    Window.Data.Swapchain = VK_NULL_HANDLE;
+    Window.SwapchainFrames.clear();
+    Window.ImageAcquired.clear();
+    Window.RenderComplete.clear();
+  }
+
+  /// Swapchain that was replaced but may still be in use by frames up to
+  /// LastFrame, along with the semaphores its presents wait on.
+  struct RetiredSwapchain {
+    vk::SwapchainKHR Swapchain;
+    std::vector<vk::ImageView> ImageViews;
+    std::vector<vk::Framebuffer> Framebuffers;
+    std::vector<vk::Semaphore> RenderComplete;
+    uint64_t LastFrame = 0;
+  };
+
+  void destroySwapchainResources(
+      vk::SwapchainKHR Swapchain, std::vector<vk::ImageView> const &ImageViews,
+      std::vector<vk::Framebuffer> const &Framebuffers) {
+    for (vk::Framebuffer Framebuffer : Framebuffers)
+      Device.destroyFramebuffer(Framebuffer, AllocationCallbacks);
+    for (vk::ImageView View : ImageViews)
+      Device.destroyImageView(View, AllocationCallbacks);
+    Device.destroySwapchainKHR(Swapchain, AllocationCallbacks);
+  }
+
+  /// Same render pass ImGui_ImplVulkanH_CreateOrResizeWindow would build;
+  /// it only depends on the surface format, so resizes keep it.
+  void createWindowRenderPass() {
+    auto &Wd = MainWindow.Data;
+    Wd.ClearEnable = true;
+    vk::AttachmentDescription Attachment(
+        {}, static_cast<vk::Format>(Wd.SurfaceFormat.format),
+        vk::SampleCountFlagBits::e1, vk::AttachmentLoadOp::eClear,
+        vk::AttachmentStoreOp::eStore, vk::AttachmentLoadOp::eDontCare,
+        vk::AttachmentStoreOp::eDontCare, vk::ImageLayout::eUndefined,
+        vk::ImageLayout::ePresentSrcKHR);
+    vk::AttachmentReference ColorAttachment(
+        0, vk::ImageLayout::eColorAttachmentOptimal);
+    vk::SubpassDescription Subpass({}, vk::PipelineBindPoint::eGraphics, {},
+                                   ColorAttachment);
+    vk::SubpassDependency Dependency(
+        VK_SUBPASS_EXTERNAL, 0,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput, {},
+        vk::AccessFlagBits::eColorAttachmentWrite);
+    Wd.RenderPass = Device.createRenderPass(
+        vk::RenderPassCreateInfo({}, Attachment, Subpass, Dependency),
+        AllocationCallbacks);
+  }
+
+  void createFrameRing() {
+    FramesInFlight = std::clamp(FramesInFlight, 1u, FrameRing::MaxFrames);
+    Frames.create(Device, QueueFamilyIndex, AllocationCallbacks,
+                  FramesInFlight, TimelineSemaphores, Synchronization2);
+    Recorders.create(Device, QueueFamilyIndex, AllocationCallbacks,
+                     FramesInFlight, RecordThreads);
+    errsv("Frames in flight = {}, record threads = {}", FramesInFlight,
+          Recorders.threadCount());
+  }
+
+  // Declared first so it outlives everything allocated through it
+  HostAllocator HostAllocations;
+  vk::AllocationCallbacks AllocationCallbacks = HostAllocations.callbacks();
   vk::Instance Instance;
   vk::PhysicalDevice PhysicalDevice;
   vk::Device Device;
   uint32_t QueueFamilyIndex = -1;
   vk::Queue Queue;
+  uint32_t ComputeQueueFamilyIndex = -1;
+  vk::Queue ComputeQueue;
+  uint32_t TransferQueueFamilyIndex = -1;
+  bool TimelineSemaphores = false;
+  /// VK_KHR_synchronization2 is enabled, only on top of TimelineSemaphores.
+  bool Synchronization2 = false;
+  ComputeStage Simulation;
+  vk::Queue TransferQueue;
   vk::PipelineCache PipelineCache;
+  std::filesystem::path PipelineCachePath;
   vk::DescriptorPool DescriptorPool;
+  bool MemoryBudget{false};
+  DeviceMemoryAllocator DeviceMemory;
+  UploadService Uploads;
+  UploadedImage FontImage;
 
-  ImGui_ImplVulkanH_Window MainWindowData;
+  PresentWindow MainWindow;
+  std::vector<std::unique_ptr<PresentWindow>> SecondaryWindows;
+  /// MainWindow, then SecondaryWindows in the order they were added.
+  std::vector<PresentWindow *> Windows;
+  std::vector<RetiredSwapchain> RetiredSwapchains;
+  double LastSwapchainRebuildMs = 0;
+  bool Headless{false};
+  std::optional<OffscreenTarget> Offscreen;
+  ImGui_ImplVulkanH_Frame OffscreenFrame;
   uint32_t MinImageCount = 2;
-  bool SwapChainRebuild{false};
+  std::vector<vk::PresentModeKHR> SupportedPresentModes;
+#ifdef IMGUI_UNLIMITED_FRAME_RATE
+  vk::PresentModeKHR RequestedPresentMode = vk::PresentModeKHR::eMailbox;
+#else
+  vk::PresentModeKHR RequestedPresentMode = vk::PresentModeKHR::eFifo;
+#endif
+  uint32_t FramesInFlight = 2;
+  FrameRing Frames;
+  uint32_t RecordThreads = 0;
+  RecordPool Recorders;
+  std::vector<RenderLayer> Layers;
+  FrameProfiler Profiler;
 };
 
 #endif